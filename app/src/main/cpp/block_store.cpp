@@ -0,0 +1,91 @@
+/*
+ * Content-Addressed Block Store
+ */
+
+#include "block_store.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <unordered_map>
+
+#include <zlib.h>
+
+static std::mutex g_store_mutex;
+static std::unordered_multimap<uint64_t, std::weak_ptr<const std::vector<uint8_t>>> g_store;
+// Expired entries are swept when the map reaches this size
+static size_t g_sweep_at = 1024;
+static uint64_t g_hits = 0;
+static uint64_t g_interns = 0;
+
+// Two independent 32-bit checksums make a 64-bit key; equal keys are
+// still compared byte for byte before sharing
+static uint64_t block_key(const std::vector<uint8_t>& data) {
+    uInt size = static_cast<uInt>(data.size());
+    uint64_t crc = crc32(0, data.data(), size);
+    uint64_t sum = adler32(1, data.data(), size);
+    return crc << 32 | sum;
+}
+
+static void sweep() {
+    for (auto it = g_store.begin(); it != g_store.end();) {
+        it = it->second.expired() ? g_store.erase(it) : std::next(it);
+    }
+    g_sweep_at = std::max<size_t>(1024, g_store.size() * 2);
+}
+
+shared_block block_store_intern(std::vector<uint8_t>&& data) {
+    uint64_t key = block_key(data);
+    std::lock_guard<std::mutex> lock(g_store_mutex);
+    g_interns++;
+
+    auto range = g_store.equal_range(key);
+    for (auto it = range.first; it != range.second;) {
+        shared_block live = it->second.lock();
+        if (!live) {
+            it = g_store.erase(it);
+            continue;
+        }
+        if (*live == data) {
+            g_hits++;
+            return live;
+        }
+        ++it;
+    }
+
+    if (g_store.size() >= g_sweep_at) sweep();
+    shared_block block = std::make_shared<const std::vector<uint8_t>>(std::move(data));
+    g_store.emplace(key, block);
+    return block;
+}
+
+block_store_stats block_store_get_stats() {
+    std::lock_guard<std::mutex> lock(g_store_mutex);
+    block_store_stats stats = {0, 0, 0, g_hits, g_interns};
+    for (const auto& entry : g_store) {
+        shared_block live = entry.second.lock();
+        if (!live) continue;
+        // Less the reference just taken
+        size_t users = static_cast<size_t>(live.use_count() - 1);
+        stats.blocks++;
+        stats.stored_bytes += live->size();
+        stats.referenced_bytes += live->size() * users;
+    }
+    return stats;
+}
+
+std::string block_store_report() {
+    block_store_stats stats = block_store_get_stats();
+    double ratio = stats.stored_bytes
+        ? static_cast<double>(stats.referenced_bytes) / stats.stored_bytes : 1.0;
+    char line[160];
+    snprintf(line, sizeof(line),
+             "block store: %zu blocks, %zu KB held for %zu KB referenced (%.2fx), "
+             "%llu of %llu loads shared",
+             stats.blocks, stats.stored_bytes / 1024, stats.referenced_bytes / 1024, ratio,
+             static_cast<unsigned long long>(stats.hits),
+             static_cast<unsigned long long>(stats.interns));
+    return line;
+}
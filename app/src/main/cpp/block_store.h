@@ -0,0 +1,42 @@
+/*
+ * Content-Addressed Block Store
+ *
+ * Process-wide pool of immutable disk blocks keyed by their contents.
+ * Interning a block returns the live copy with the same bytes if there is
+ * one, so units holding near-identical images (the CP/M 2.2, ZSDOS and
+ * NZCOM disks share most of their system tracks and utilities) and runs of
+ * identical blocks within one image keep a single copy in memory. Writers
+ * copy a block before changing it and intern the result once it is clean.
+ *
+ * Blocks are reference counted; the store only keeps weak references, so
+ * a block goes away with its last user. Safe to use from any thread.
+ */
+
+#ifndef BLOCK_STORE_H
+#define BLOCK_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+typedef std::shared_ptr<const std::vector<uint8_t>> shared_block;
+
+// The live block equal to data, or data itself, now registered
+shared_block block_store_intern(std::vector<uint8_t>&& data);
+
+struct block_store_stats {
+    size_t blocks;            // Distinct live blocks
+    size_t stored_bytes;      // Memory they take
+    size_t referenced_bytes;  // Memory they would take unshared
+    uint64_t hits;            // Interns answered by an existing block
+    uint64_t interns;
+};
+
+block_store_stats block_store_get_stats();
+
+// One line: blocks, bytes stored and referenced, and their ratio
+std::string block_store_report();
+
+#endif // BLOCK_STORE_H
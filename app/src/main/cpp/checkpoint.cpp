@@ -0,0 +1,275 @@
+/*
+ * Incremental Checkpoints
+ */
+
+#include "checkpoint.h"
+#include "emu_io.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <random>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const uint32_t TAG_PAGES = snapshot_tag('P', 'A', 'G', 'S');
+static const uint32_t TAG_CHAIN = snapshot_tag('C', 'H', 'N', 'G');
+static const uint32_t DELTA_MAGIC = 0x44504B43;  // "CKPD"
+
+// Precedes each record in the delta file
+struct delta_header {
+    uint32_t magic;
+    uint32_t length;
+    uint32_t checksum;  // FNV-1a of the record
+    uint32_t reserved;
+    uint64_t generation;
+};
+
+// Compact once restoring the chain would mean this much replay
+static const size_t MAX_DELTA_RECORDS = 120;
+static const size_t MAX_DELTA_BYTES = 4 * 1024 * 1024;
+
+static uint32_t fnv1a(const uint8_t* data, size_t count) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < count; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static bool write_all(int fd, const uint8_t* data, size_t count) {
+    while (count > 0) {
+        ssize_t n = write(fd, data, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        count -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+Checkpointer::Checkpointer() {
+    writer_ = std::thread(&Checkpointer::writer_loop, this);
+}
+
+Checkpointer::~Checkpointer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_one();
+    writer_.join();
+    if (delta_fd_ >= 0) close(delta_fd_);
+}
+
+void Checkpointer::writer_loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        wake_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+        if (queue_.empty()) return;
+
+        job j = std::move(queue_.front());
+        queue_.pop_front();
+        busy_ = true;
+        lock.unlock();
+
+        bool ok = j.base ? write_base_file(j) : write_delta_record(j);
+
+        lock.lock();
+        failed_ = failed_ || !ok;
+        busy_ = false;
+        if (queue_.empty()) idle_.notify_all();
+    }
+}
+
+// Make a rename in path's directory durable
+static bool sync_parent(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "." : path.substr(0, slash);
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+bool Checkpointer::write_base_file(const job& j) {
+    // The new base replaces the old one first; the old deltas are then
+    // emptied, and until then their generation keeps them off the new base
+    std::string temp = j.path + ".tmp";
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0 && write_all(fd, j.data.data(), j.data.size()) && fsync(fd) == 0;
+    if (fd >= 0) close(fd);
+    if (!ok || rename(temp.c_str(), j.path.c_str()) != 0 || !sync_parent(j.path)) {
+        emu_error("checkpoint: cannot write %s: %s", j.path.c_str(), strerror(errno));
+        unlink(temp.c_str());
+        return false;
+    }
+
+    std::string delta_path = j.path + ".delta";
+    if (delta_fd_ >= 0) close(delta_fd_);
+    delta_fd_ = open(delta_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (delta_fd_ < 0 || fdatasync(delta_fd_) != 0) {
+        emu_error("checkpoint: cannot reset %s: %s", delta_path.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool Checkpointer::write_delta_record(const job& j) {
+    delta_header header;
+    header.magic = DELTA_MAGIC;
+    header.length = static_cast<uint32_t>(j.data.size());
+    header.checksum = fnv1a(j.data.data(), j.data.size());
+    header.reserved = 0;
+    header.generation = j.generation;
+    if (delta_fd_ < 0 ||
+        !write_all(delta_fd_, reinterpret_cast<const uint8_t*>(&header), sizeof(header)) ||
+        !write_all(delta_fd_, j.data.data(), j.data.size()) ||
+        fdatasync(delta_fd_) != 0) {
+        emu_error("checkpoint: delta write failed: %s", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool Checkpointer::wait_idle() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this] { return queue_.empty() && !busy_; });
+    bool ok = !failed_;
+    failed_ = false;
+    return ok;
+}
+
+// Nonzero and unlikely to repeat across runs
+static uint64_t new_generation() {
+    std::random_device random;
+    uint64_t id = (static_cast<uint64_t>(random()) << 32) ^ random() ^
+                  static_cast<uint64_t>(std::chrono::system_clock::now().time_since_epoch().count());
+    return id ? id : 1;
+}
+
+void Checkpointer::write_base(const std::string& path, SnapshotWriter& snapshot,
+                              paged_mem* memory) {
+    generation_ = new_generation();
+    snapshot.begin_chunk(TAG_CHAIN);
+    snapshot.put_u64(generation_);
+    snapshot.end_chunk();
+
+    // Reference contents for the next delta
+    shadow_.resize(paged_mem::RAM_SIZE);
+    memcpy(shadow_.data(), memory->get_ram(), paged_mem::RAM_SIZE);
+    path_ = path;
+    delta_records_ = 0;
+    delta_bytes_ = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back({true, path, snapshot.data(), generation_});
+    }
+    wake_.notify_one();
+}
+
+bool Checkpointer::needs_compaction() const {
+    return delta_records_ >= MAX_DELTA_RECORDS || delta_bytes_ >= MAX_DELTA_BYTES;
+}
+
+size_t Checkpointer::capture_pages(SnapshotWriter& writer, paged_mem* memory) {
+    // Every RAM page is compared, see the header. ROM can't change.
+    std::vector<uint16_t> changed;
+    std::vector<uint8_t> data;
+    for (size_t index = paged_mem::FIRST_RAM_PAGE; index < paged_mem::PAGE_COUNT; index++) {
+        const uint8_t* current = memory->page(index);
+        uint8_t* previous =
+            shadow_.data() + (index - paged_mem::FIRST_RAM_PAGE) * paged_mem::PAGE_SIZE;
+        if (memcmp(current, previous, paged_mem::PAGE_SIZE) == 0) continue;
+        memcpy(previous, current, paged_mem::PAGE_SIZE);
+        changed.push_back(static_cast<uint16_t>(index));
+        data.insert(data.end(), current, current + paged_mem::PAGE_SIZE);
+    }
+
+    writer.begin_chunk(TAG_PAGES);
+    writer.put_u16(static_cast<uint16_t>(changed.size()));
+    for (uint16_t index : changed) {
+        writer.put_u16(index);
+    }
+    writer.put_compressed(data.data(), data.size());
+    writer.end_chunk();
+    return changed.size();
+}
+
+void Checkpointer::append_delta(std::vector<uint8_t> delta) {
+    delta_records_++;
+    delta_bytes_ += delta.size();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back({false, std::string(), std::move(delta), generation_});
+    }
+    wake_.notify_one();
+}
+
+bool Checkpointer::apply_pages(SnapshotReader& reader, paged_mem* memory) {
+    if (!reader.open_chunk(TAG_PAGES)) return false;
+    size_t count = reader.get_u16();
+    std::vector<uint16_t> indices(count);
+    for (size_t i = 0; i < count; i++) {
+        indices[i] = reader.get_u16();
+        if (indices[i] >= paged_mem::PAGE_COUNT) return false;
+    }
+    std::vector<uint8_t> data(count * paged_mem::PAGE_SIZE);
+    if (!reader.get_compressed(data.data(), data.size())) return false;
+    for (size_t i = 0; i < count; i++) {
+        memcpy(memory->page(indices[i]), data.data() + i * paged_mem::PAGE_SIZE,
+               paged_mem::PAGE_SIZE);
+    }
+    return reader.ok();
+}
+
+uint64_t Checkpointer::generation(SnapshotReader& base) {
+    if (!base.open_chunk(TAG_CHAIN)) return 0;
+    uint64_t id = base.get_u64();
+    return base.ok() ? id : 0;
+}
+
+size_t Checkpointer::read_deltas(const std::string& path, uint64_t generation,
+                                 const std::function<bool(std::vector<uint8_t>)>& fn) {
+    std::string delta_path = path + ".delta";
+    int fd = open(delta_path.c_str(), O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    off_t left = fstat(fd, &st) == 0 ? st.st_size : 0;
+
+    size_t applied = 0;
+    for (;;) {
+        delta_header header;
+        if (read(fd, &header, sizeof(header)) != static_cast<ssize_t>(sizeof(header)) ||
+            header.magic != DELTA_MAGIC) {
+            break;
+        }
+        // Left over from another chain: the base was replaced before the
+        // delta file was emptied
+        if (header.generation != generation) break;
+        // A length past the end of the file is a corrupt header, not a
+        // record to allocate for
+        left -= static_cast<off_t>(sizeof(header));
+        if (static_cast<off_t>(header.length) > left) {
+            emu_status("checkpoint: %s ends in a torn record", delta_path.c_str());
+            break;
+        }
+        left -= static_cast<off_t>(header.length);
+        std::vector<uint8_t> delta(header.length);
+        if (read(fd, delta.data(), delta.size()) != static_cast<ssize_t>(delta.size()) ||
+            fnv1a(delta.data(), delta.size()) != header.checksum) {
+            emu_status("checkpoint: %s ends in a torn record", delta_path.c_str());
+            break;
+        }
+        if (!fn(std::move(delta))) break;
+        applied++;
+    }
+    close(fd);
+    return applied;
+}
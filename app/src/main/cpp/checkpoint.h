@@ -0,0 +1,122 @@
+/*
+ * Incremental Checkpoints
+ *
+ * Keeps a save-state current at low cost as a delta chain: a full snapshot
+ * (the base, see snapshot.h) plus <base>.delta, an append-only file of
+ * small snapshots that each hold the CPU state and only the memory pages
+ * changed since the previous checkpoint. Restoring loads the base and
+ * applies the deltas in order; writing a new base compacts the chain.
+ * The base and every delta carry the chain's generation id, so deltas
+ * left over from an older chain are never applied to a newer base (or the
+ * reverse), whatever point a crash interrupted the files at.
+ *
+ * Changed pages are found by comparing all of RAM against a shadow copy of
+ * the last checkpointed contents. Tracking CPU stores isn't enough: HBIOS
+ * writes guest memory without going through store_mem (disk DMA), and a
+ * page missed by one delta would stay wrong in every restore after it.
+ * The compare is 512KB once a second; ROM never changes and is left to
+ * the base.
+ *
+ * Disks are kept in step through the disk journal (disk_journal.h): each
+ * checkpoint records the journal epoch it covers, and journals are only
+ * compacted once a checkpoint covering them is durable.
+ *
+ * Capture runs on the emulator thread between batches; file writes and
+ * fdatasync happen on a background thread.
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "snapshot.h"
+#include "paged_mem.h"
+
+class Checkpointer {
+public:
+    Checkpointer();
+    ~Checkpointer();
+
+    Checkpointer(const Checkpointer&) = delete;
+    Checkpointer& operator=(const Checkpointer&) = delete;
+
+    // Start a new chain with snapshot as the base at path; its generation
+    // chunk is added here. The current memory becomes the reference for the
+    // next delta; the files are written in the background (wait_idle to
+    // make it durable).
+    void write_base(const std::string& path, SnapshotWriter& snapshot, paged_mem* memory);
+
+    // True once a base has been written this session (and not ended)
+    bool active() const { return !path_.empty(); }
+    const std::string& path() const { return path_; }
+
+    // Stop adding to the chain; its files are left for the caller to delete
+    void end_chain() { path_.clear(); }
+
+    // True when the chain is long enough that a new base is cheaper to restore
+    bool needs_compaction() const;
+
+    // Add a chunk with the pages changed since the last checkpoint. Returns
+    // the number of pages written.
+    size_t capture_pages(SnapshotWriter& writer, paged_mem* memory);
+
+    // Queue a finished delta snapshot for the background writer
+    void append_delta(std::vector<uint8_t> delta);
+
+    // Block until queued writes are on disk. False if any failed.
+    bool wait_idle();
+
+    // Apply a delta's page chunk to memory
+    static bool apply_pages(SnapshotReader& reader, paged_mem* memory);
+
+    // Generation of a base snapshot, 0 if it has none
+    static uint64_t generation(SnapshotReader& base);
+
+    // Call fn with each intact delta of generation in the chain at path,
+    // in order. Stops at a torn or corrupt record or one from another
+    // generation. Returns the number applied.
+    static size_t read_deltas(const std::string& path, uint64_t generation,
+                              const std::function<bool(std::vector<uint8_t>)>& fn);
+
+private:
+    struct job {
+        bool base;
+        std::string path;
+        std::vector<uint8_t> data;
+        uint64_t generation;
+    };
+
+    // Emulator thread only
+    std::string path_;
+    uint64_t generation_ = 0;
+    std::vector<uint8_t> shadow_;  // RAM as of the last checkpoint
+    size_t delta_records_ = 0;
+    size_t delta_bytes_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable idle_;
+    std::deque<job> queue_;
+    bool busy_ = false;
+    bool stop_ = false;
+    bool failed_ = false;
+    std::thread writer_;
+
+    // Writer thread only
+    int delta_fd_ = -1;
+
+    void writer_loop();
+    bool write_base_file(const job& j);
+    bool write_delta_record(const job& j);
+};
+
+#endif // CHECKPOINT_H
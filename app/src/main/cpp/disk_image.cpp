@@ -0,0 +1,414 @@
+/*
+ * Memory-Mapped Disk Images
+ */
+
+#include "disk_image.h"
+#include "emu_io.h"
+#include "sparse_disk.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Open images by path. Opens come from the emulator thread while saves may
+// run on the UI thread, so the registry is locked; reads and writes are not.
+static std::mutex g_images_mutex;
+static std::unordered_map<std::string, disk_image*> g_images;
+
+static const char* mode_name(disk_map_mode mode) {
+    switch (mode) {
+        case DISK_MAP_READONLY: return "read-only";
+        case DISK_MAP_PRIVATE:  return "private";
+        case DISK_MAP_SHARED:   return "shared";
+    }
+    return "?";
+}
+
+// Map fd, which the image owns from here on, and register it as path.
+// Called with g_images_mutex held.
+static disk_image* map_image(int fd, const std::string& path, disk_map_mode mode) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        emu_error("disk_image: %s is empty or unreadable", path.c_str());
+        close(fd);
+        return nullptr;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+
+    disk_image* image = new disk_image();
+    image->path = path;
+    image->mode = mode;
+    image->fd = fd;
+    image->data = nullptr;
+    image->sparse = nullptr;
+    image->refs = 1;
+    image->journal = nullptr;
+    image->clock_hand = 0;
+    image->max_resident = DISK_DEFAULT_RESIDENT / DISK_EXTENT;
+
+    if (sparse_disk_detect(fd)) {
+        image->sparse = sparse_disk_open(fd, path);
+        if (!image->sparse) {
+            close(fd);
+            delete image;
+            return nullptr;
+        }
+        size = sparse_disk_size(image->sparse);
+    } else {
+        // A private writable mapping of a read-only fd is legal: written
+        // pages are copied into anonymous memory and the file is left alone
+        int prot = mode == DISK_MAP_READONLY ? PROT_READ : PROT_READ | PROT_WRITE;
+        int flags = mode == DISK_MAP_SHARED ? MAP_SHARED : MAP_PRIVATE;
+        void* addr = mmap(nullptr, size, prot, flags, fd, 0);
+        if (addr == MAP_FAILED) {
+            emu_error("disk_image: mmap of %s failed: %s", path.c_str(), strerror(errno));
+            close(fd);
+            delete image;
+            return nullptr;
+        }
+
+        // CP/M directory and allocation access is scattered; don't read ahead
+        madvise(addr, size, MADV_RANDOM);
+        image->data = static_cast<uint8_t*>(addr);
+        image->extents.assign((size + DISK_EXTENT - 1) / DISK_EXTENT, 0);
+        image->resident.reserve(image->max_resident);
+    }
+    image->size = size;
+    size_t pages = (size + DISK_DIRTY_PAGE - 1) / DISK_DIRTY_PAGE;
+    image->dirty_words = (pages + 63) / 64;
+    image->dirty.reset(new std::atomic<uint64_t>[image->dirty_words]);
+    for (size_t i = 0; i < image->dirty_words; i++) {
+        image->dirty[i].store(0, std::memory_order_relaxed);
+    }
+    g_images[path] = image;
+
+    emu_status("disk_image: mapped %s (%zu bytes, %s%s)", path.c_str(), size, mode_name(mode),
+               image->sparse ? ", sparse" : "");
+    return image;
+}
+
+disk_image* disk_image_open(const std::string& path, disk_map_mode mode) {
+    std::lock_guard<std::mutex> lock(g_images_mutex);
+
+    auto it = g_images.find(path);
+    if (it != g_images.end()) {
+        it->second->refs++;
+        return it->second;
+    }
+
+    int fd = open(path.c_str(), mode == DISK_MAP_SHARED ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+        emu_error("disk_image: cannot open %s: %s", path.c_str(), strerror(errno));
+        return nullptr;
+    }
+    return map_image(fd, path, mode);
+}
+
+disk_image* disk_image_open_fd(int fd, const std::string& name, disk_map_mode mode) {
+    std::lock_guard<std::mutex> lock(g_images_mutex);
+
+    auto it = g_images.find(name);
+    if (it != g_images.end()) {
+        it->second->refs++;
+        return it->second;
+    }
+
+    int own = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (own < 0) {
+        emu_error("disk_image: cannot duplicate fd %d for %s: %s", fd, name.c_str(),
+                  strerror(errno));
+        return nullptr;
+    }
+    // Saving a container in place goes through a rename, which needs a path
+    if (mode == DISK_MAP_SHARED && sparse_disk_detect(own)) {
+        mode = DISK_MAP_PRIVATE;
+    }
+    return map_image(own, name, mode);
+}
+
+//=============================================================================
+// Residency
+//=============================================================================
+
+enum : uint8_t {
+    EXTENT_RESIDENT = 1,    // Touched since it was last dropped
+    EXTENT_REFERENCED = 2,  // Touched since the clock last passed it
+    EXTENT_PINNED = 4,      // Written in a private mapping: the only copy
+};
+
+static void drop_extent(disk_image* image, size_t extent) {
+    size_t offset = extent * DISK_EXTENT;
+    madvise(image->data + offset, std::min(DISK_EXTENT, image->size - offset), MADV_DONTNEED);
+    image->extents[extent] = 0;
+}
+
+// Second-chance clock: make room for one more extent by dropping the first
+// unreferenced one after the hand. Pinned extents leave the clock for good.
+static bool evict_extent(disk_image* image, uint32_t replacement) {
+    std::vector<uint32_t>& ring = image->resident;
+    while (!ring.empty()) {
+        if (image->clock_hand >= ring.size()) image->clock_hand = 0;
+        uint8_t& state = image->extents[ring[image->clock_hand]];
+        if (state & EXTENT_PINNED) {
+            ring[image->clock_hand] = ring.back();
+            ring.pop_back();
+        } else if (state & EXTENT_REFERENCED) {
+            state &= ~EXTENT_REFERENCED;
+            image->clock_hand++;
+        } else {
+            drop_extent(image, ring[image->clock_hand]);
+            ring[image->clock_hand++] = replacement;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Note an access to [offset, offset + count), dropping cold extents when
+// over budget. Shared mappings can drop written extents too: their pages
+// live on in the page cache until written back.
+static void touch_extents(disk_image* image, size_t offset, size_t count, bool write) {
+    if (!image->data || count == 0) return;
+    bool pin = write && image->mode == DISK_MAP_PRIVATE;
+    size_t last = (offset + count - 1) / DISK_EXTENT;
+    for (size_t extent = offset / DISK_EXTENT; extent <= last; extent++) {
+        uint8_t& state = image->extents[extent];
+        if (pin) state |= EXTENT_PINNED;
+        if (state & EXTENT_RESIDENT) {
+            state |= EXTENT_REFERENCED;
+            continue;
+        }
+        state |= EXTENT_RESIDENT;
+        if (state & EXTENT_PINNED) continue;
+
+        uint32_t id = static_cast<uint32_t>(extent);
+        if (image->max_resident == 0 || image->resident.size() < image->max_resident ||
+            !evict_extent(image, id)) {
+            image->resident.push_back(id);
+        }
+    }
+}
+
+void disk_image_set_residency(disk_image* image, size_t bytes) {
+    if (!image || !image->data) return;
+    image->max_resident = bytes ? std::max<size_t>(1, bytes / DISK_EXTENT) : 0;
+    while (image->max_resident && image->resident.size() > image->max_resident) {
+        uint32_t extent = image->resident.back();
+        image->resident.pop_back();
+        if (!(image->extents[extent] & EXTENT_PINNED)) drop_extent(image, extent);
+    }
+}
+
+//=============================================================================
+// Release, Reads and Writes
+//=============================================================================
+
+void disk_image_release(disk_image* image) {
+    if (!image) return;
+    std::lock_guard<std::mutex> lock(g_images_mutex);
+
+    if (--image->refs > 0) return;
+
+    if (image->sparse) {
+        if (image->mode == DISK_MAP_SHARED && !disk_image_dirty_ranges(image, false).empty()) {
+            sparse_disk_save(image->sparse, image->path);
+        }
+        sparse_disk_close(image->sparse);
+    } else {
+        if (image->mode == DISK_MAP_SHARED) {
+            msync(image->data, image->size, MS_SYNC);
+        }
+        munmap(image->data, image->size);
+    }
+    close(image->fd);
+    g_images.erase(image->path);
+    delete image;
+}
+
+size_t disk_image_read(disk_image* image, size_t offset, uint8_t* buffer, size_t count) {
+    if (!image || offset >= image->size) return 0;
+    size_t avail = image->size - offset;
+    if (count > avail) count = avail;
+    if (image->sparse) return sparse_disk_read(image->sparse, offset, buffer, count);
+    touch_extents(image, offset, count, false);
+    memcpy(buffer, image->data + offset, count);
+    return count;
+}
+
+static void mark_dirty(disk_image* image, size_t offset, size_t length) {
+    if (length == 0) return;
+    size_t first = offset / DISK_DIRTY_PAGE;
+    size_t last = (offset + length - 1) / DISK_DIRTY_PAGE;
+    for (size_t page = first; page <= last; page++) {
+        image->dirty[page / 64].fetch_or(1ull << (page % 64), std::memory_order_release);
+    }
+}
+
+static void mark_dirty(disk_image* image, const std::vector<disk_range>& ranges) {
+    for (const disk_range& range : ranges) {
+        mark_dirty(image, range.offset, range.length);
+    }
+}
+
+// Images are fixed size; writes past the end are truncated
+size_t disk_image_write(disk_image* image, size_t offset, const uint8_t* buffer, size_t count) {
+    if (!image || image->mode == DISK_MAP_READONLY || offset >= image->size) return 0;
+    size_t avail = image->size - offset;
+    if (count > avail) count = avail;
+    if (image->sparse) {
+        count = sparse_disk_write(image->sparse, offset, buffer, count);
+    } else {
+        touch_extents(image, offset, count, true);
+        memcpy(image->data + offset, buffer, count);
+    }
+    mark_dirty(image, offset, count);
+    return count;
+}
+
+std::vector<disk_range> disk_image_dirty_ranges(disk_image* image, bool clear) {
+    std::vector<disk_range> ranges;
+    if (!image) return ranges;
+
+    for (size_t word = 0; word < image->dirty_words; word++) {
+        uint64_t bits = clear ? image->dirty[word].exchange(0, std::memory_order_acq_rel)
+                              : image->dirty[word].load(std::memory_order_acquire);
+        while (bits) {
+            int bit = __builtin_ctzll(bits);
+            bits &= bits - 1;
+            size_t offset = (word * 64 + bit) * DISK_DIRTY_PAGE;
+            size_t length = std::min(DISK_DIRTY_PAGE, image->size - offset);
+            // Coalesce adjacent pages
+            if (!ranges.empty() && ranges.back().offset + ranges.back().length == offset) {
+                ranges.back().length += length;
+            } else {
+                ranges.push_back({offset, length});
+            }
+        }
+    }
+    return ranges;
+}
+
+bool disk_image_dirty(disk_image* image) {
+    if (!image) return false;
+    for (size_t word = 0; word < image->dirty_words; word++) {
+        if (image->dirty[word].load(std::memory_order_acquire)) return true;
+    }
+    return false;
+}
+
+static bool write_fully(int fd, const uint8_t* data, size_t length, size_t offset) {
+    while (length > 0) {
+        ssize_t n = pwrite(fd, data, length, static_cast<off_t>(offset));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        length -= static_cast<size_t>(n);
+        offset += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Write a sparse image's contents to target as a new container
+static long long save_sparse(disk_image* image, const std::string& target) {
+    std::vector<disk_range> ranges = disk_image_dirty_ranges(image, true);
+    long long bytes = sparse_disk_save(image->sparse, target);
+    if (bytes < 0) mark_dirty(image, ranges);
+    return bytes;
+}
+
+// Sync dirty ranges of a shared mapping to its own file
+static long long sync_shared(disk_image* image) {
+    if (image->sparse) return save_sparse(image, image->path);
+    std::vector<disk_range> ranges = disk_image_dirty_ranges(image, true);
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    long long bytes = 0;
+    for (const disk_range& range : ranges) {
+        // msync needs a system-page-aligned start, which may be larger than 4KB
+        size_t start = range.offset - range.offset % page;
+        if (msync(image->data + start, range.offset + range.length - start, MS_SYNC) != 0) {
+            emu_error("disk_image: msync of %s failed: %s", image->path.c_str(), strerror(errno));
+            mark_dirty(image, ranges);
+            return -1;
+        }
+        bytes += static_cast<long long>(range.length);
+    }
+    return bytes;
+}
+
+// Write the whole image to a new target, replacing it atomically
+static long long save_whole(disk_image* image, const std::string& target) {
+    std::vector<disk_range> ranges = disk_image_dirty_ranges(image, true);
+    std::string temp = target + ".tmp";
+
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0 && write_fully(fd, image->data, image->size, 0) && fsync(fd) == 0;
+    if (fd >= 0) close(fd);
+    if (ok && rename(temp.c_str(), target.c_str()) != 0) ok = false;
+
+    if (!ok) {
+        emu_error("disk_image: cannot write %s: %s", target.c_str(), strerror(errno));
+        unlink(temp.c_str());
+        mark_dirty(image, ranges);
+        return -1;
+    }
+    return static_cast<long long>(image->size);
+}
+
+long long disk_image_save(disk_image* image, const std::string& target) {
+    if (!image) return -1;
+    if (disk_image_dirty_ranges(image, false).empty()) return 0;
+    if (image->mode == DISK_MAP_SHARED && target == image->path) {
+        return sync_shared(image);
+    }
+    if (image->sparse) {
+        return save_sparse(image, target);
+    }
+
+    int fd = open(target.c_str(), O_RDWR);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) != image->size) {
+        if (fd >= 0) close(fd);
+        return save_whole(image, target);
+    }
+
+    std::vector<disk_range> ranges = disk_image_dirty_ranges(image, true);
+    long long bytes = 0;
+    bool ok = true;
+    for (const disk_range& range : ranges) {
+        if (!write_fully(fd, image->data + range.offset, range.length, range.offset)) {
+            ok = false;
+            break;
+        }
+        bytes += static_cast<long long>(range.length);
+    }
+    if (ok && !ranges.empty() && fdatasync(fd) != 0) ok = false;
+    close(fd);
+
+    if (!ok) {
+        emu_error("disk_image: cannot update %s: %s", target.c_str(), strerror(errno));
+        mark_dirty(image, ranges);
+        return -1;
+    }
+    return bytes;
+}
+
+bool disk_image_flush(disk_image* image) {
+    if (!image || image->mode != DISK_MAP_SHARED) return false;
+    return sync_shared(image) >= 0;
+}
+
+void disk_image_flush_all() {
+    std::lock_guard<std::mutex> lock(g_images_mutex);
+    for (auto& entry : g_images) {
+        disk_image_flush(entry.second);
+    }
+}
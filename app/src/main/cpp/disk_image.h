@@ -0,0 +1,110 @@
+/*
+ * Memory-Mapped Disk Images
+ *
+ * Backs emu_disk_* with an mmap of the image file instead of a copy in
+ * RAM. Pages are faulted in on demand and clean pages stay reclaimable by
+ * the kernel, so a large hd1k image costs only what the guest touches.
+ * Residency is also bounded explicitly: the mapping is tracked in 64KB
+ * extents and, past the image's budget, the least recently used clean
+ * extent is dropped (MADV_DONTNEED) and refaulted from the file if the
+ * guest comes back to it. Idle slices cost no RAM however large the image.
+ *
+ * Files in the sparse container format (sparse_disk.h) are opened through
+ * that backend instead: data is null and reads and writes go through its
+ * block cache. Saving such an image writes a container.
+ *
+ * Images are registered by path and reference counted. The JNI layer keeps
+ * one reference per mounted unit, so the mapping (and any copy-on-write
+ * changes in it) survives HBIOSDispatch being recreated on reset.
+ */
+
+#ifndef DISK_IMAGE_H
+#define DISK_IMAGE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum disk_map_mode {
+    DISK_MAP_READONLY,  // Writes are rejected
+    DISK_MAP_PRIVATE,   // Copy-on-write; the file is never modified
+    DISK_MAP_SHARED,    // Writes go through to the file
+};
+
+// Writes are tracked per DISK_DIRTY_PAGE so saves only touch what changed
+static const size_t DISK_DIRTY_PAGE = 4096;
+
+// Unit of residency tracking, and the default budget per image
+static const size_t DISK_EXTENT = 64 * 1024;
+static const size_t DISK_DEFAULT_RESIDENT = 4 * 1024 * 1024;
+
+struct disk_range {
+    size_t offset;
+    size_t length;
+};
+
+struct disk_journal;
+struct sparse_disk;
+
+struct disk_image {
+    std::string path;
+    disk_map_mode mode;
+    int fd;
+    uint8_t* data;        // Null for sparse images
+    size_t size;          // Expanded size
+    sparse_disk* sparse;  // Block-compressed backend, or null
+    int refs;
+    // One bit per page, set by the CPU thread and taken by the saver
+    std::unique_ptr<std::atomic<uint64_t>[]> dirty;
+    size_t dirty_words;
+    // Write journal attached by the JNI layer, see disk_journal.h
+    disk_journal* journal;
+    // Residency clock over mapped extents (CPU thread only): state per
+    // extent, resident extents in clock order, and the budget in extents
+    std::vector<uint8_t> extents;
+    std::vector<uint32_t> resident;
+    size_t clock_hand;
+    size_t max_resident;
+};
+
+// Map path, or take another reference if it is already mapped (the
+// existing mode is kept). Returns nullptr on failure.
+disk_image* disk_image_open(const std::string& path, disk_map_mode mode);
+
+// Map an already open file (e.g. a descriptor handed over by Android's
+// storage framework), registered as name. fd is duplicated; the caller
+// keeps its own. A sparse container opened this way can't be rewritten in
+// place, so shared mode falls back to private for one.
+disk_image* disk_image_open_fd(int fd, const std::string& name, disk_map_mode mode);
+
+// Resident bytes allowed before clean extents are dropped (0 = unbounded)
+void disk_image_set_residency(disk_image* image, size_t bytes);
+
+// Drop a reference; the mapping is removed with the last one
+void disk_image_release(disk_image* image);
+
+size_t disk_image_read(disk_image* image, size_t offset, uint8_t* buffer, size_t count);
+size_t disk_image_write(disk_image* image, size_t offset, const uint8_t* buffer, size_t count);
+
+// Dirty pages as coalesced byte ranges. With clear set the bits are taken
+// atomically, so a write racing with a save is picked up by the next one.
+std::vector<disk_range> disk_image_dirty_ranges(disk_image* image, bool clear);
+
+// True if any page is dirty. Failed saves leave their pages dirty.
+bool disk_image_dirty(disk_image* image);
+
+// Write the dirty ranges to target and clear them. For a shared image whose
+// own file is the target the ranges are synced instead. If target is
+// missing or a different size the whole image is written (via a temporary
+// file and rename). Returns the number of bytes written, or -1 on error
+// (the ranges stay dirty).
+long long disk_image_save(disk_image* image, const std::string& target);
+
+// Write shared-mode changes back to the file. No-op for other modes.
+bool disk_image_flush(disk_image* image);
+void disk_image_flush_all();
+
+#endif // DISK_IMAGE_H
@@ -0,0 +1,288 @@
+/*
+ * Disk Write Journal
+ */
+
+#include "disk_journal.h"
+#include "emu_io.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Writes arriving within this window share one fdatasync
+static const int GROUP_COMMIT_MS = 2;
+
+// Compact once the journal grows past this
+static const size_t COMPACT_THRESHOLD = 4 * 1024 * 1024;
+
+static const uint32_t RECORD_MAGIC = 0x4C4E4A44;  // "DJNL"
+
+struct journal_record {
+    uint32_t magic;
+    uint32_t length;    // Data bytes following the header
+    uint64_t offset;    // Image offset of the data
+    uint32_t checksum;  // FNV-1a over offset, length and data
+    uint32_t epoch;     // 0 in journals written before epochs existed
+};
+
+static std::atomic<uint32_t> g_epoch{1};
+static std::atomic<bool> g_hold_compaction{false};
+
+struct disk_journal {
+    disk_image* image;
+    std::string target;
+    std::string path;
+    int fd;
+    std::atomic<size_t> file_bytes;  // Written under io_mutex
+
+    // Records past this epoch are in the file but not the image; compaction
+    // would lose them. DISK_JOURNAL_ALL when none are held. Under io_mutex.
+    uint32_t held_after;
+
+    // Records not yet written; the CPU thread only ever holds this briefly
+    std::mutex pending_mutex;
+    std::condition_variable wake;
+    std::vector<uint8_t> pending;
+    bool stop;
+
+    // Serializes journal file writes with compaction, so a truncate never
+    // drops a record whose data hasn't reached the target
+    std::mutex io_mutex;
+    std::vector<uint8_t> writing;
+
+    std::thread writer;
+};
+
+static uint32_t record_checksum(uint64_t offset, uint32_t length, const uint8_t* data) {
+    uint32_t hash = 2166136261u;
+    auto mix = [&hash](const uint8_t* p, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            hash = (hash ^ p[i]) * 16777619u;
+        }
+    };
+    mix(reinterpret_cast<const uint8_t*>(&offset), sizeof(offset));
+    mix(reinterpret_cast<const uint8_t*>(&length), sizeof(length));
+    mix(data, length);
+    return hash;
+}
+
+static bool write_all(int fd, const uint8_t* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        length -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Apply every intact record from min_epoch to max_epoch to the image.
+// Stops at the first torn or corrupt record, which is where the previous
+// process died. Returns the records read; skipped counts those out of range.
+static size_t replay(disk_journal* journal, uint32_t min_epoch, uint32_t max_epoch,
+                     size_t* skipped) {
+    struct stat st;
+    if (fstat(journal->fd, &st) != 0 || st.st_size == 0) return 0;
+
+    std::vector<uint8_t> log(static_cast<size_t>(st.st_size));
+    ssize_t got = pread(journal->fd, log.data(), log.size(), 0);
+    if (got <= 0) return 0;
+    log.resize(static_cast<size_t>(got));
+
+    size_t pos = 0;
+    size_t records = 0;
+    while (pos + sizeof(journal_record) <= log.size()) {
+        journal_record header;
+        memcpy(&header, log.data() + pos, sizeof(header));
+        const uint8_t* data = log.data() + pos + sizeof(header);
+        if (header.magic != RECORD_MAGIC ||
+            header.length > log.size() - pos - sizeof(header) ||
+            header.checksum != record_checksum(header.offset, header.length, data)) {
+            break;
+        }
+        if (header.epoch >= min_epoch && header.epoch <= max_epoch) {
+            disk_image_write(journal->image, static_cast<size_t>(header.offset), data, header.length);
+        } else {
+            (*skipped)++;
+        }
+        pos += sizeof(header) + header.length;
+        records++;
+    }
+    if (pos < log.size()) {
+        emu_status("disk_journal: %s has a torn tail (%zu bytes ignored)",
+                   journal->path.c_str(), log.size() - pos);
+    }
+    return records;
+}
+
+// Caller holds io_mutex
+static long long compact_locked(disk_journal* journal) {
+    if (journal->held_after != DISK_JOURNAL_ALL) {
+        size_t skipped = 0;
+        replay(journal, journal->held_after + 1, DISK_JOURNAL_ALL, &skipped);
+        journal->held_after = DISK_JOURNAL_ALL;
+    }
+    long long bytes = disk_image_save(journal->image, journal->target);
+    if (bytes < 0) return -1;
+    if (ftruncate(journal->fd, 0) != 0 || fdatasync(journal->fd) != 0) {
+        emu_error("disk_journal: cannot truncate %s: %s", journal->path.c_str(), strerror(errno));
+        return -1;
+    }
+    journal->file_bytes = 0;
+    return bytes;
+}
+
+static void writer_loop(disk_journal* journal) {
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(journal->pending_mutex);
+            journal->wake.wait(lock, [journal] {
+                return journal->stop || !journal->pending.empty();
+            });
+            if (journal->pending.empty()) return;  // Stopping with nothing left
+        }
+
+        // Let a burst of sector writes (one CP/M file write is many) collect
+        std::this_thread::sleep_for(std::chrono::milliseconds(GROUP_COMMIT_MS));
+
+        std::lock_guard<std::mutex> io(journal->io_mutex);
+        {
+            std::lock_guard<std::mutex> lock(journal->pending_mutex);
+            journal->writing.swap(journal->pending);
+        }
+        if (!write_all(journal->fd, journal->writing.data(), journal->writing.size()) ||
+            fdatasync(journal->fd) != 0) {
+            emu_error("disk_journal: write to %s failed: %s", journal->path.c_str(), strerror(errno));
+        } else {
+            journal->file_bytes += journal->writing.size();
+        }
+        journal->writing.clear();
+
+        if (journal->file_bytes > COMPACT_THRESHOLD &&
+            journal->held_after == DISK_JOURNAL_ALL &&
+            !g_hold_compaction.load(std::memory_order_relaxed)) {
+            compact_locked(journal);
+        }
+    }
+}
+
+disk_journal* disk_journal_open(disk_image* image, const std::string& target,
+                                uint32_t max_epoch) {
+    if (!image) return nullptr;
+
+    std::string path = target + ".jnl";
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        emu_error("disk_journal: cannot open %s: %s", path.c_str(), strerror(errno));
+        return nullptr;
+    }
+
+    disk_journal* journal = new disk_journal();
+    journal->image = image;
+    journal->target = target;
+    journal->path = path;
+    journal->fd = fd;
+    journal->file_bytes = 0;
+    journal->held_after = DISK_JOURNAL_ALL;
+    journal->stop = false;
+
+    size_t held = 0;
+    size_t records = replay(journal, 0, max_epoch, &held);
+    if (held > 0) {
+        // Written after the state being resumed; kept until the restore
+        // decides whether they are dropped (disk_journal_settle)
+        emu_status("disk_journal: replayed %zu records from %s (%zu past the saved state held)",
+                   records - held, path.c_str(), held);
+        struct stat st;
+        journal->file_bytes = fstat(fd, &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+        journal->held_after = max_epoch;
+    } else if (records > 0) {
+        emu_status("disk_journal: replayed %zu records from %s", records, path.c_str());
+        std::lock_guard<std::mutex> io(journal->io_mutex);
+        compact_locked(journal);
+    } else if (ftruncate(fd, 0) != 0) {
+        // Nothing usable, but a torn leftover that stays would hide the
+        // records appended after it from the next replay
+        emu_error("disk_journal: cannot truncate %s: %s", path.c_str(), strerror(errno));
+    }
+
+    journal->writer = std::thread(writer_loop, journal);
+    return journal;
+}
+
+void disk_journal_close(disk_journal* journal) {
+    if (!journal) return;
+    {
+        std::lock_guard<std::mutex> lock(journal->pending_mutex);
+        journal->stop = true;
+    }
+    journal->wake.notify_one();
+    journal->writer.join();
+    close(journal->fd);
+    delete journal;
+}
+
+void disk_journal_append(disk_journal* journal, size_t offset, const uint8_t* data, size_t count) {
+    if (!journal || count == 0) return;
+
+    journal_record header;
+    header.magic = RECORD_MAGIC;
+    header.length = static_cast<uint32_t>(count);
+    header.offset = offset;
+    header.checksum = record_checksum(header.offset, header.length, data);
+    header.epoch = g_epoch.load(std::memory_order_relaxed);
+
+    {
+        std::lock_guard<std::mutex> lock(journal->pending_mutex);
+        const uint8_t* h = reinterpret_cast<const uint8_t*>(&header);
+        journal->pending.insert(journal->pending.end(), h, h + sizeof(header));
+        journal->pending.insert(journal->pending.end(), data, data + count);
+    }
+    journal->wake.notify_one();
+}
+
+void disk_journal_settle(disk_journal* journal, bool drop_held) {
+    if (!journal) return;
+    std::lock_guard<std::mutex> io(journal->io_mutex);
+    if (journal->held_after == DISK_JOURNAL_ALL) return;
+    if (drop_held) {
+        journal->held_after = DISK_JOURNAL_ALL;
+    }
+    compact_locked(journal);
+}
+
+long long disk_journal_compact(disk_journal* journal) {
+    if (!journal) return -1;
+    std::lock_guard<std::mutex> io(journal->io_mutex);
+    return compact_locked(journal);
+}
+
+bool disk_journal_needs_compaction(disk_journal* journal) {
+    if (!journal) return false;
+    std::lock_guard<std::mutex> lock(journal->pending_mutex);
+    return journal->file_bytes + journal->pending.size() > COMPACT_THRESHOLD;
+}
+
+uint32_t disk_journal_epoch() {
+    return g_epoch.load(std::memory_order_relaxed);
+}
+
+void disk_journal_set_epoch(uint32_t epoch) {
+    g_epoch.store(epoch, std::memory_order_relaxed);
+}
+
+void disk_journal_hold_compaction(bool hold) {
+    g_hold_compaction.store(hold, std::memory_order_relaxed);
+}
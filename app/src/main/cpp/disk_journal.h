@@ -0,0 +1,72 @@
+/*
+ * Disk Write Journal
+ *
+ * Append-only log of guest disk writes, kept next to the persisted image
+ * as <target>.jnl. Each emu_disk_write appends an (offset, data) record;
+ * a writer thread commits records in small groups with fdatasync, so a
+ * write is durable within a few milliseconds even though the image itself
+ * is only saved occasionally. Compaction saves the image's dirty pages to
+ * the target and truncates the journal. Opening replays whatever a killed
+ * process left behind.
+ *
+ * Records carry the epoch current when they were written. Resume
+ * checkpoints (checkpoint.h) each close an epoch, so a restore can replay
+ * the journal only as far as the checkpoint it restores; disks are then
+ * never ahead of memory. The later records stay in the journal until the
+ * restore is settled, so a rejected restore loses no writes. While
+ * checkpoints are taken, compaction is held until a checkpoint covering
+ * the journal is durable.
+ */
+
+#ifndef DISK_JOURNAL_H
+#define DISK_JOURNAL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "disk_image.h"
+
+struct disk_journal;
+
+// Replay every record, whatever its epoch
+static const uint32_t DISK_JOURNAL_ALL = UINT32_MAX;
+
+// Attach a journal for image, persisted to target. An existing journal is
+// replayed into the image and compacted first. Records past max_epoch are
+// left out of the image but kept in the file, uncompacted, until
+// disk_journal_settle. Returns nullptr on failure.
+disk_journal* disk_journal_open(disk_image* image, const std::string& target,
+                                uint32_t max_epoch);
+
+// Resolve records held back by disk_journal_open, before the guest writes
+// to the disk: drop them once the state they are past has been restored,
+// or apply them if it wasn't. Either way the journal is then compacted.
+// Does nothing if none are held.
+void disk_journal_settle(disk_journal* journal, bool drop_held);
+
+// Commit pending records and stop the writer thread. The journal file is
+// kept, so anything not yet compacted is replayed on the next open.
+void disk_journal_close(disk_journal* journal);
+
+// Queue a record; called from the CPU thread after the write hit the image
+void disk_journal_append(disk_journal* journal, size_t offset, const uint8_t* data, size_t count);
+
+// Save the image's dirty pages to the target and empty the journal.
+// Held records are applied first. Returns bytes written to the target,
+// or -1 on error.
+long long disk_journal_compact(disk_journal* journal);
+
+// True once the journal has grown past the compaction threshold
+bool disk_journal_needs_compaction(disk_journal* journal);
+
+// Epoch for records appended from now on, shared by all journals. Starts
+// at 1; set from the CPU thread only.
+uint32_t disk_journal_epoch();
+void disk_journal_set_epoch(uint32_t epoch);
+
+// Keep the writer threads from compacting on their own (at the size
+// threshold); the caller compacts at checkpoint boundaries instead
+void disk_journal_hold_compaction(bool hold);
+
+#endif // DISK_JOURNAL_H
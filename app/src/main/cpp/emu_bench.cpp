@@ -0,0 +1,567 @@
+/*
+ * Emulator Benchmarks (host build)
+ *
+ * Fixed workloads timed on the real run loop (emu_run_instructions), with
+ * results as one JSON document so runs can be diffed and tracked:
+ *
+ *   alu_loop      ALU, stack, CALL/RET and DJNZ mix in RAM (no ROM needed)
+ *   ldir_copy     8KB LDIR block copies in RAM (no ROM needed)
+ *   exit_poll     alu_loop with the run loop's exit test done the old way,
+ *                 polling isWaitingForInput()/getState() after every
+ *                 instruction, against the single g_exit_request load
+ *   boot          reset to the A> prompt            (--rom, --disk)
+ *   bdos_copy     PIP file copies from A> on a scratch mount (--rom, --disk)
+ *   console_ring  SpscRing vs mutex+deque, 2 threads (the console queues)
+ *   vt_parse      VT100 output through the terminal (directory listings,
+ *                 cursor addressing, colour, scrolling)
+ *
+ * Each timed workload runs --repeat times and reports the median. T-states
+ * and HBIOS calls come from one extra counting pass (instruction by
+ * instruction, so not timed) and are scaled to the timed rate.
+ *
+ *   cpmdroid_bench --rom emu_avw.rom --disk 0:hd1k_combo.img > bench.json
+ */
+
+#include "emu_io.h"
+#include "emu_io_host.h"
+#include "host_machine.h"
+#include "spsc_ring.h"
+#include "terminal.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Instructions per run call, as in the app's run loop
+static const int64_t RUN_SLICE = 50000;
+
+// Give up on a scripted workload that hasn't finished after this many
+static const int64_t SCRIPT_LIMIT = 4000000000LL;
+
+using bench_clock = std::chrono::steady_clock;
+
+struct bench_options {
+    host_machine_config machine;
+    int repeat = 5;
+    double scale = 1.0;
+    std::string filter;
+    std::string output;
+    std::string copy_command = "PIP BENCH.TMP=PIP.COM";
+    int copies = 20;
+};
+
+struct bench_result {
+    std::string name;
+    std::string status = "ok";
+    int64_t instructions = 0;
+    double seconds = 0;
+    double tstates_per_instruction = 0;
+    double hbios_calls_per_instruction = 0;
+    int64_t bytes = 0;  // Throughput benchmarks
+};
+
+static double median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    return v.empty() ? 0 : v[v.size() / 2];
+}
+
+static double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+//=============================================================================
+// Counting Pass
+//=============================================================================
+
+// Run up to max instructions one at a time, counting T-states and HBIOS
+// entries. Returns the number executed.
+static int64_t count_pass(EmulatorState* emu, int64_t max, uint64_t* tstates,
+                          uint64_t* hbios_calls, bool* stopped) {
+    int64_t executed = 0;
+    *stopped = false;
+    while (executed < max && !*stopped) {
+        if (emu->cpu->regs.PC.get_pair16() == HBIOS_ENTRY) (*hbios_calls)++;
+        executed += emu_run_timed(emu, 1, tstates, UINT64_MAX, stopped);
+    }
+    return executed;
+}
+
+//=============================================================================
+// RAM Loops
+//=============================================================================
+
+// ALU, memory, stack and branch mix; writes stay within 0x4000-0x40FF
+static const uint8_t ALU_LOOP[] = {
+    0x21, 0x00, 0x40,  // 0100 LD HL,4000h
+    0x06, 0x00,        // 0103 LD B,0
+    0x80,              // 0105 ADD A,B
+    0xA9,              // 0106 XOR C
+    0x0C,              // 0107 INC C
+    0x77,              // 0108 LD (HL),A
+    0x23,              // 0109 INC HL
+    0xC5,              // 010A PUSH BC
+    0xCD, 0x14, 0x01,  // 010B CALL 0114h
+    0xC1,              // 010E POP BC
+    0x10, 0xF4,        // 010F DJNZ 0105h
+    0xC3, 0x00, 0x01,  // 0111 JP 0100h
+    0x57,              // 0114 LD D,A
+    0x07,              // 0115 RLCA
+    0xC9,              // 0116 RET
+};
+
+// 8KB block copy, repeated
+static const uint8_t LDIR_LOOP[] = {
+    0x21, 0x00, 0x20,  // 0100 LD HL,2000h
+    0x11, 0x00, 0x60,  // 0103 LD DE,6000h
+    0x01, 0x00, 0x20,  // 0106 LD BC,2000h
+    0xED, 0xB0,        // 0109 LDIR
+    0xC3, 0x00, 0x01,  // 010B JP 0100h
+};
+
+// Fresh machine with RAM bank 0 in the lower 32K and code at 0100h
+static void load_ram_program(HostMachine& machine, const uint8_t* code, size_t size) {
+    EmulatorState* emu = machine.emu;
+    emu->memory->select_bank(0x80);
+    for (size_t i = 0; i < size; i++) {
+        emu->memory->store_mem(static_cast<uint16_t>(0x0100 + i), code[i]);
+    }
+    emu->cpu->set_cpu_mode(qkz80::MODE_Z80);
+    emu->cpu->regs.PC.set_pair16(0x0100);
+    emu->cpu->regs.SP.set_pair16(0xFF00);
+}
+
+static bench_result bench_ram_loop(const char* name, const uint8_t* code, size_t size,
+                                   int64_t instructions, int repeat) {
+    bench_result result;
+    result.name = name;
+    result.instructions = instructions;
+
+    std::vector<double> times;
+    for (int r = 0; r < repeat; r++) {
+        HostMachine machine;
+        load_ram_program(machine, code, size);
+        bench_clock::time_point start = bench_clock::now();
+        int64_t done = 0;
+        bool stopped = false;
+        while (done < instructions && !stopped) {
+            g_exit_request.store(0, std::memory_order_relaxed);
+            done += emu_run_instructions(machine.emu, std::min(RUN_SLICE, instructions - done),
+                                         &stopped);
+        }
+        times.push_back(seconds_since(start));
+        if (stopped) result.status = "stopped";
+    }
+    result.seconds = median(times);
+
+    HostMachine machine;
+    load_ram_program(machine, code, size);
+    uint64_t tstates = 0;
+    uint64_t hbios_calls = 0;
+    bool stopped;
+    int64_t counted = count_pass(machine.emu, std::min<int64_t>(instructions, 1000000),
+                                 &tstates, &hbios_calls, &stopped);
+    if (counted > 0) {
+        result.tstates_per_instruction = static_cast<double>(tstates) / counted;
+    }
+    return result;
+}
+
+// The run loop before exit requests: HBIOS asked after every instruction
+// whether it is waiting for input or halted
+static bool g_poll_running = false;
+
+static int64_t run_polling(EmulatorState* emu, int64_t max_instructions, bool* stopped) {
+    *stopped = false;
+    g_poll_running = true;
+    int64_t i = 0;
+    while (i < max_instructions && g_poll_running) {
+        emu->cpu->execute();
+        i++;
+        if (emu->hbios->isWaitingForInput()) {
+            *stopped = true;
+            break;
+        }
+        if (emu->hbios->getState() == HBIOS_HALTED) {
+            g_poll_running = false;
+            *stopped = true;
+            break;
+        }
+    }
+    return i;
+}
+
+// alu_loop timed under both exit tests, alternating so drift hits both
+static std::vector<bench_result> bench_exit_test(int64_t instructions, int repeat) {
+    bench_result polled;
+    polled.name = "exit_poll";
+    polled.instructions = instructions;
+    bench_result flagged;
+    flagged.name = "exit_flag";
+    flagged.instructions = instructions;
+
+    std::vector<double> poll_times;
+    std::vector<double> flag_times;
+    for (int r = 0; r < repeat; r++) {
+        for (int polling = 0; polling < 2; polling++) {
+            HostMachine machine;
+            load_ram_program(machine, ALU_LOOP, sizeof(ALU_LOOP));
+            bench_clock::time_point start = bench_clock::now();
+            int64_t done = 0;
+            bool stopped = false;
+            while (done < instructions && !stopped) {
+                int64_t slice = std::min(RUN_SLICE, instructions - done);
+                if (polling) {
+                    done += run_polling(machine.emu, slice, &stopped);
+                } else {
+                    g_exit_request.store(0, std::memory_order_relaxed);
+                    done += emu_run_instructions(machine.emu, slice, &stopped);
+                }
+            }
+            (polling ? poll_times : flag_times).push_back(seconds_since(start));
+            if (stopped) (polling ? polled : flagged).status = "stopped";
+        }
+    }
+    polled.seconds = median(poll_times);
+    flagged.seconds = median(flag_times);
+    return {polled, flagged};
+}
+
+//=============================================================================
+// Scripted Workloads
+//=============================================================================
+
+// Boot a scratch machine and feed script lines one at a time, each when
+// the guest waits for input with nothing queued. Instructions and time are
+// measured from feeding line measure_from to the final input wait.
+// Returns false if the guest halted or the run hit SCRIPT_LIMIT.
+static bool run_script(const bench_options& opts, const std::vector<std::string>& script,
+                       size_t measure_from, bool counting, bench_result* result,
+                       uint64_t* tstates, uint64_t* hbios_calls) {
+    HostMachine machine;
+    host_machine_config config = opts.machine;
+    config.scratch = true;
+    if (!machine.boot(config)) return false;
+    EmulatorState* emu = machine.emu;
+
+    size_t next = 0;
+    int64_t total = 0;
+    int64_t measured = 0;
+    bool measuring = measure_from == 0;
+    bench_clock::time_point start = bench_clock::now();
+    while (total < SCRIPT_LIMIT) {
+        if (emu->hbios->isWaitingForInput()) {
+            if (!emu_console_has_input()) {
+                if (next == script.size()) break;
+                if (next == measure_from && !measuring) {
+                    measuring = true;
+                    measured = 0;
+                    *tstates = 0;
+                    *hbios_calls = 0;
+                    start = bench_clock::now();
+                }
+                const std::string& line = script[next++];
+                host_io_queue_input(reinterpret_cast<const uint8_t*>(line.data()), line.size());
+            }
+            emu->hbios->clearWaitingForInput();
+        }
+
+        g_exit_request.store(0, std::memory_order_relaxed);
+        bool stopped;
+        int64_t n = counting ? count_pass(emu, RUN_SLICE, tstates, hbios_calls, &stopped)
+                             : emu_run_instructions(emu, RUN_SLICE, &stopped);
+        total += n;
+        measured += n;
+        if (stopped && emu->hbios->getState() == HBIOS_HALTED) return false;
+    }
+    result->instructions = measured;
+    result->seconds = seconds_since(start);
+    return total < SCRIPT_LIMIT;
+}
+
+static bench_result bench_script(const bench_options& opts, const char* name,
+                                 const std::vector<std::string>& script, size_t measure_from,
+                                 const char* expect) {
+    bench_result result;
+    result.name = name;
+    if (opts.machine.rom.empty() || opts.machine.disks.empty()) {
+        result.status = "skipped";
+        return result;
+    }
+
+    std::vector<double> times;
+    uint64_t tstates = 0;
+    uint64_t hbios_calls = 0;
+    for (int r = 0; r < opts.repeat; r++) {
+        bench_result run;
+        if (!run_script(opts, script, measure_from, false, &run, &tstates, &hbios_calls)) {
+            result.status = "incomplete";
+            return result;
+        }
+        times.push_back(run.seconds);
+        result.instructions = run.instructions;
+    }
+    result.seconds = median(times);
+    if (expect && host_io_output_tail().find(expect) == std::string::npos) {
+        result.status = "unexpected_output";
+    }
+
+    bench_result counted;
+    tstates = 0;
+    hbios_calls = 0;
+    if (run_script(opts, script, measure_from, true, &counted, &tstates, &hbios_calls) &&
+        counted.instructions > 0) {
+        result.tstates_per_instruction = static_cast<double>(tstates) / counted.instructions;
+        result.hbios_calls_per_instruction = static_cast<double>(hbios_calls) / counted.instructions;
+    }
+    return result;
+}
+
+//=============================================================================
+// Console Queues
+//=============================================================================
+
+// One producer thread, one consumer, bytes moved in small bursts as the UI
+// and CPU threads do
+static double queue_throughput(int64_t bytes, const std::function<bool(uint8_t)>& push,
+                               const std::function<bool(uint8_t*)>& pop) {
+    bench_clock::time_point start = bench_clock::now();
+    std::thread producer([&] {
+        for (int64_t i = 0; i < bytes; i++) {
+            while (!push(static_cast<uint8_t>(i))) std::this_thread::yield();
+        }
+    });
+    uint8_t byte;
+    for (int64_t i = 0; i < bytes; i++) {
+        while (!pop(&byte)) std::this_thread::yield();
+    }
+    producer.join();
+    return seconds_since(start);
+}
+
+static std::vector<bench_result> bench_console_queues(int64_t bytes, int repeat) {
+    std::vector<double> ring_times;
+    std::vector<double> mutex_times;
+    for (int r = 0; r < repeat; r++) {
+        SpscRing<4096> ring;
+        ring_times.push_back(queue_throughput(
+            bytes, [&](uint8_t b) { return ring.push(b); },
+            [&](uint8_t* b) { return ring.pop(b); }));
+
+        std::mutex mutex;
+        std::deque<uint8_t> queue;
+        mutex_times.push_back(queue_throughput(
+            bytes,
+            [&](uint8_t b) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (queue.size() >= 4096) return false;
+                queue.push_back(b);
+                return true;
+            },
+            [&](uint8_t* b) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (queue.empty()) return false;
+                *b = queue.front();
+                queue.pop_front();
+                return true;
+            }));
+    }
+
+    bench_result ring;
+    ring.name = "console_ring";
+    ring.bytes = bytes;
+    ring.seconds = median(ring_times);
+    bench_result locked;
+    locked.name = "console_mutex_queue";
+    locked.bytes = bytes;
+    locked.seconds = median(mutex_times);
+    return {ring, locked};
+}
+
+// Parse a synthetic session of roughly bytes bytes: scrolling text, a
+// full-screen editor's cursor addressing and erases, and colour changes
+static bench_result bench_vt_parse(int64_t bytes, int repeat) {
+    std::string session;
+    char line[96];
+    for (int i = 0; session.size() < 64 * 1024; i++) {
+        snprintf(line, sizeof(line), "A: FILE%04d  COM : PROG%04d  BAS : DATA%04d  DAT\r\n", i,
+                 i + 1, i + 2);
+        session += line;
+        snprintf(line, sizeof(line), "\x1b[%d;%dH\x1b[K\x1b[3%dmLine %d\x1b[0m", i % 24 + 1,
+                 i % 40 + 1, i % 8, i);
+        session += line;
+        if (i % 64 == 0) session += "\x1b[2J\x1b[H";
+    }
+
+    int64_t passes = std::max<int64_t>(1, bytes / static_cast<int64_t>(session.size()));
+    std::vector<double> times;
+    for (int r = 0; r < repeat; r++) {
+        Terminal terminal;
+        auto start = bench_clock::now();
+        for (int64_t i = 0; i < passes; i++) {
+            terminal.write(reinterpret_cast<const uint8_t*>(session.data()), session.size());
+        }
+        times.push_back(seconds_since(start));
+    }
+
+    bench_result result;
+    result.name = "vt_parse";
+    result.bytes = passes * static_cast<int64_t>(session.size());
+    result.seconds = median(times);
+    return result;
+}
+
+//=============================================================================
+// Output
+//=============================================================================
+
+static void write_json(FILE* f, const bench_options& opts, const std::vector<bench_result>& results) {
+    fprintf(f, "{\n");
+    fprintf(f, "  \"benchmark\": \"cpmdroid\",\n");
+    fprintf(f, "  \"format\": 1,\n");
+#ifdef __VERSION__
+    fprintf(f, "  \"compiler\": \"%s\",\n", __VERSION__);
+#endif
+#ifdef NDEBUG
+    fprintf(f, "  \"optimized\": true,\n");
+#else
+    fprintf(f, "  \"optimized\": false,\n");
+#endif
+    fprintf(f, "  \"repeat\": %d,\n", opts.repeat);
+    fprintf(f, "  \"scale\": %g,\n", opts.scale);
+    fprintf(f, "  \"results\": [");
+    for (size_t i = 0; i < results.size(); i++) {
+        const bench_result& r = results[i];
+        fprintf(f, "%s\n    {\"name\": \"%s\", \"status\": \"%s\"", i ? "," : "",
+                r.name.c_str(), r.status.c_str());
+        if (r.status == "ok" && r.seconds > 0) {
+            fprintf(f, ", \"seconds\": %.6f", r.seconds);
+            if (r.bytes) {
+                fprintf(f, ", \"bytes\": %lld, \"bytes_per_s\": %.0f",
+                        static_cast<long long>(r.bytes), r.bytes / r.seconds);
+            } else {
+                double ips = r.instructions / r.seconds;
+                fprintf(f, ", \"instructions\": %lld, \"instructions_per_s\": %.0f",
+                        static_cast<long long>(r.instructions), ips);
+                fprintf(f, ", \"tstates_per_s\": %.0f, \"hbios_calls_per_s\": %.1f",
+                        ips * r.tstates_per_instruction, ips * r.hbios_calls_per_instruction);
+            }
+        }
+        fprintf(f, "}");
+    }
+    fprintf(f, "\n  ]\n}\n");
+}
+
+static void usage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --rom FILE          RomWBW ROM image (boot, bdos_copy)\n"
+            "  --disk UNIT:FILE    boot disk, mounted copy-on-write (boot, bdos_copy)\n"
+            "  --repeat N          timed runs per workload, median reported (default 5)\n"
+            "  --scale F           multiply RAM loop and queue sizes (default 1)\n"
+            "  --filter NAME       run only workloads whose name contains NAME\n"
+            "  --copy TEXT         bdos_copy command (default \"PIP BENCH.TMP=PIP.COM\")\n"
+            "  --copies N          bdos_copy repetitions (default 20)\n"
+            "  --output FILE       write JSON here instead of stdout\n",
+            argv0);
+}
+
+static bool parse_args(int argc, char** argv, bench_options* opts) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--rom" && has_value) {
+            opts->machine.rom = argv[++i];
+        } else if (arg == "--disk" && has_value) {
+            const char* spec = argv[++i];
+            const char* colon = strchr(spec, ':');
+            int unit = colon ? atoi(spec) : -1;
+            if (unit < 0 || unit >= 16) return false;
+            opts->machine.disks.emplace_back(unit, colon + 1);
+        } else if (arg == "--repeat" && has_value) {
+            opts->repeat = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--scale" && has_value) {
+            opts->scale = atof(argv[++i]);
+        } else if (arg == "--filter" && has_value) {
+            opts->filter = argv[++i];
+        } else if (arg == "--copy" && has_value) {
+            opts->copy_command = argv[++i];
+        } else if (arg == "--copies" && has_value) {
+            opts->copies = atoi(argv[++i]);
+        } else if (arg == "--output" && has_value) {
+            opts->output = argv[++i];
+        } else {
+            return false;
+        }
+    }
+    return opts->scale > 0;
+}
+
+int main(int argc, char** argv) {
+    bench_options opts;
+    if (!parse_args(argc, argv, &opts)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    emu_io_init();
+    host_io_use_stdin(false);
+    host_io_discard_output(true);
+
+    auto wanted = [&](const char* name) {
+        return opts.filter.empty() || strstr(name, opts.filter.c_str()) != nullptr;
+    };
+    int64_t loop_instructions = static_cast<int64_t>(20000000 * opts.scale);
+
+    std::vector<bench_result> results;
+    if (wanted("alu_loop")) {
+        results.push_back(bench_ram_loop("alu_loop", ALU_LOOP, sizeof(ALU_LOOP),
+                                         loop_instructions, opts.repeat));
+    }
+    if (wanted("ldir_copy")) {
+        results.push_back(bench_ram_loop("ldir_copy", LDIR_LOOP, sizeof(LDIR_LOOP),
+                                         loop_instructions, opts.repeat));
+    }
+    if (wanted("exit_poll") || wanted("exit_flag")) {
+        for (const bench_result& r : bench_exit_test(loop_instructions, opts.repeat)) {
+            results.push_back(r);
+        }
+    }
+    if (wanted("boot")) {
+        results.push_back(bench_script(opts, "boot", {"0\r"}, 0, "A>"));
+    }
+    if (wanted("bdos_copy")) {
+        std::vector<std::string> script = {"0\r"};
+        for (int i = 0; i < opts.copies; i++) {
+            script.push_back(opts.copy_command + "\r");
+            script.push_back("ERA BENCH.TMP\r");
+        }
+        results.push_back(bench_script(opts, "bdos_copy", script, 1, "A>"));
+    }
+    if (wanted("console_ring") || wanted("console_mutex_queue")) {
+        for (const bench_result& r :
+             bench_console_queues(static_cast<int64_t>(10000000 * opts.scale), opts.repeat)) {
+            results.push_back(r);
+        }
+    }
+    if (wanted("vt_parse")) {
+        results.push_back(bench_vt_parse(static_cast<int64_t>(50000000 * opts.scale), opts.repeat));
+    }
+
+    FILE* out = stdout;
+    if (!opts.output.empty() && !(out = fopen(opts.output.c_str(), "w"))) {
+        emu_error("Cannot write %s", opts.output.c_str());
+        return 1;
+    }
+    write_json(out, opts, results);
+    if (out != stdout) fclose(out);
+    emu_io_cleanup();
+    return 0;
+}
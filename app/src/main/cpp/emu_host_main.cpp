@@ -0,0 +1,230 @@
+/*
+ * Host Console Front End
+ *
+ * Boots a RomWBW ROM and disk images on Linux with the console on
+ * stdin/stdout, for running, scripting and profiling the emulator core
+ * off-device:
+ *
+ *   cpmdroid_host --rom emu_avw.rom --disk 0:hd1k_combo.img
+ *   printf '0\rDIR\r' | cpmdroid_host --rom ... --disk ... > out.txt
+ *
+ * With piped input the run ends once the guest waits for input and stdin
+ * is exhausted. On a terminal, Ctrl-] exits. --profile-pc prints a
+ * profile at exit; --trace writes the last instructions executed.
+ */
+
+#include "emu_io.h"
+#include "emu_io_host.h"
+#include "host_machine.h"
+#include "sparse_disk.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Instructions per run call between input and exit checks
+static const int64_t RUN_SLICE = 100000;
+
+struct host_options {
+    host_machine_config machine;
+    std::string input;
+    bool use_stdin = true;
+    int64_t max_instructions = 0;
+    int profile_pc = 0;
+    bool profile_hbios = false;
+    std::string symbols;
+    size_t trace_records = 0;
+    std::string trace_file = "trace.txt";
+    bool debug = false;
+};
+
+static void usage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s --rom FILE [options]\n"
+            "       %s --pack RAW OUT\n"
+            "       %s --unpack PACKED OUT\n"
+            "  --rom FILE              RomWBW ROM image (required)\n"
+            "  --disk UNIT:FILE        mount a disk image on unit 0-15 (repeatable)\n"
+            "  --slices N              slices per disk (default 8/4/2 by disk count)\n"
+            "  --scratch               keep disk writes in memory, leave files unchanged\n"
+            "  --input TEXT            queue console input first (\\r, \\n, \\e, \\\\ escapes)\n"
+            "  --no-stdin              take console input only from --input\n"
+            "  --max-instructions N    stop after N instructions\n"
+            "  --profile-pc N          sample the PC every N instructions, report at exit\n"
+            "  --profile-hbios         with --profile-pc, count HBIOS calls by function\n"
+            "  --symbols FILE          .SYM or .PRN/.LST labels for the PC report\n"
+            "  --trace N               keep the last N instructions, write them at exit\n"
+            "  --trace-file FILE       where --trace writes (default trace.txt)\n"
+            "  --debug                 enable debug logging\n"
+            "  --pack RAW OUT          convert a raw disk image to a sparse container\n"
+            "  --unpack PACKED OUT     expand a sparse container to a raw disk image\n",
+            argv0, argv0, argv0);
+}
+
+static std::string unescape(const char* s) {
+    std::string out;
+    for (; *s; s++) {
+        if (*s != '\\' || !s[1]) {
+            out += *s;
+            continue;
+        }
+        s++;
+        switch (*s) {
+            case 'r': out += '\r'; break;
+            case 'n': out += '\n'; break;
+            case 'e': out += '\x1B'; break;
+            default: out += *s; break;
+        }
+    }
+    return out;
+}
+
+static bool parse_args(int argc, char** argv, host_options* opts) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--rom" && has_value) {
+            opts->machine.rom = argv[++i];
+        } else if (arg == "--disk" && has_value) {
+            const char* spec = argv[++i];
+            const char* colon = strchr(spec, ':');
+            int unit = colon ? atoi(spec) : -1;
+            if (unit < 0 || unit >= 16) {
+                fprintf(stderr, "bad --disk %s (want UNIT:FILE)\n", spec);
+                return false;
+            }
+            opts->machine.disks.emplace_back(unit, colon + 1);
+        } else if (arg == "--slices" && has_value) {
+            opts->machine.slices = atoi(argv[++i]);
+        } else if (arg == "--scratch") {
+            opts->machine.scratch = true;
+        } else if (arg == "--input" && has_value) {
+            opts->input += unescape(argv[++i]);
+        } else if (arg == "--no-stdin") {
+            opts->use_stdin = false;
+        } else if (arg == "--max-instructions" && has_value) {
+            opts->max_instructions = strtoll(argv[++i], nullptr, 10);
+        } else if (arg == "--profile-pc" && has_value) {
+            opts->profile_pc = atoi(argv[++i]);
+        } else if (arg == "--profile-hbios") {
+            opts->profile_hbios = true;
+        } else if (arg == "--symbols" && has_value) {
+            opts->symbols = argv[++i];
+        } else if (arg == "--trace" && has_value) {
+            opts->trace_records = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--trace-file" && has_value) {
+            opts->trace_file = argv[++i];
+        } else if (arg == "--debug") {
+            opts->debug = true;
+        } else {
+            return false;
+        }
+    }
+    return !opts->machine.rom.empty();
+}
+
+int main(int argc, char** argv) {
+    if (argc == 4 && strcmp(argv[1], "--pack") == 0) {
+        emu_io_init();
+        long long bytes = sparse_disk_pack(argv[2], argv[3]);
+        if (bytes < 0) return 1;
+        fprintf(stderr, "%s: %lld bytes\n", argv[3], bytes);
+        return 0;
+    }
+    if (argc == 4 && strcmp(argv[1], "--unpack") == 0) {
+        emu_io_init();
+        long long bytes = sparse_disk_unpack(argv[2], argv[3]);
+        if (bytes < 0) return 1;
+        fprintf(stderr, "%s: %lld bytes\n", argv[3], bytes);
+        return 0;
+    }
+
+    host_options opts;
+    if (!parse_args(argc, argv, &opts)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    emu_io_init();
+    emu_set_debug(opts.debug);
+
+    HostMachine machine;
+    if (!machine.boot(opts.machine)) {
+        return 1;
+    }
+    EmulatorState* emu = machine.emu;
+    PcSampler sampler;
+    if (opts.profile_pc > 0) {
+        if (!opts.symbols.empty() && sampler.load_symbols(opts.symbols) < 0) return 1;
+        sampler.start(static_cast<uint32_t>(opts.profile_pc), opts.profile_hbios);
+        emu->pc_sampler = &sampler;
+    }
+    std::unique_ptr<TraceRing> trace;
+    if (opts.trace_records > 0) {
+        trace.reset(new TraceRing(opts.trace_records));
+        emu->set_trace(trace.get());
+    }
+
+    host_io_use_stdin(opts.use_stdin);
+    if (opts.use_stdin) host_io_raw_terminal();
+    host_io_queue_input(reinterpret_cast<const uint8_t*>(opts.input.data()), opts.input.size());
+
+    auto start = std::chrono::steady_clock::now();
+    int64_t executed = 0;
+    const char* reason = "stopped";
+    for (;;) {
+        if (host_io_exit_requested()) {
+            reason = "exit key";
+            break;
+        }
+        if (emu->hbios->isWaitingForInput()) {
+            if (!emu_console_has_input()) {
+                if (host_io_input_exhausted()) {
+                    reason = "input exhausted";
+                    break;
+                }
+                host_io_wait_input(50);
+                continue;
+            }
+            emu->hbios->clearWaitingForInput();
+        }
+
+        int64_t slice = RUN_SLICE;
+        if (opts.max_instructions > 0) {
+            if (executed >= opts.max_instructions) {
+                reason = "instruction limit";
+                break;
+            }
+            slice = std::min(slice, opts.max_instructions - executed);
+        }
+
+        g_exit_request.store(0, std::memory_order_relaxed);
+        bool stopped;
+        executed += emu_run_instructions(emu, slice, &stopped);
+        if (stopped && emu->hbios->getState() == HBIOS_HALTED) {
+            reason = "halted";
+            break;
+        }
+    }
+
+    host_io_flush();
+    host_io_restore_terminal();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    emu_status("\n[%s] %lld instructions in %.3f s (%.1f MIPS), PC=0x%04X", reason,
+               static_cast<long long>(executed), seconds,
+               seconds > 0 ? static_cast<double>(executed) / seconds / 1e6 : 0.0,
+               emu->cpu->regs.PC.get_pair16());
+    if (opts.profile_pc > 0) fprintf(stderr, "\n%s", sampler.report(20, emu->memory).c_str());
+    if (trace) {
+        long written = trace->dump(opts.trace_file, opts.trace_records);
+        if (written >= 0) emu_status("Trace: %ld records in %s", written, opts.trace_file.c_str());
+    }
+
+    emu_io_cleanup();
+    return 0;
+}
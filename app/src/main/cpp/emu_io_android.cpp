@@ -9,8 +9,6 @@
 #include <jni.h>
 #include <android/log.h>
 #include <string>
-#include <queue>
-#include <mutex>
 #include <vector>
 #include <cstring>
 #include <cstdarg>
@@ -18,99 +16,31 @@
 #include <random>
 #include <thread>
 #include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <cstdio>
+#include <unistd.h>
 
 #include "hbios_cpu.h"
 #include "hbios_dispatch.h"
 #include "emu_init.h"
 #include "romwbw_mem.h"
+#include "spsc_ring.h"
+#include "disk_image.h"
+#include "disk_journal.h"
+#include "sparse_disk.h"
+#include "block_store.h"
+#include "snapshot.h"
+#include "checkpoint.h"
+#include "emu_machine.h"
+#include "terminal.h"
 
 #define LOG_TAG "CPMDroid"
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
 #define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
 
-//=============================================================================
-// Android Emulator Delegate
-//=============================================================================
-
-class AndroidEmulatorDelegate : public HBIOSCPUDelegate {
-private:
-    banked_mem* memory;
-    HBIOSDispatch* hbios;
-    bool debug;
-
-public:
-    AndroidEmulatorDelegate(banked_mem* mem, HBIOSDispatch* hb)
-        : memory(mem), hbios(hb), debug(false) {}
-
-    banked_mem* getMemory() override { return memory; }
-    HBIOSDispatch* getHBIOS() override { return hbios; }
-
-    void initializeRamBankIfNeeded(uint8_t bank) override {
-        // Use HBIOSDispatch's shared bitmap
-        uint16_t* bitmap = hbios->getInitializedBanksBitmap();
-        if (bitmap) {
-            emu_init_ram_bank(memory, bank, bitmap);
-        }
-    }
-
-    void onHalt() override {
-        LOGE("CPU HALT at PC=0x%04X", 0);
-    }
-
-    void onUnimplementedOpcode(uint8_t opcode, uint16_t pc) override {
-        LOGE("Unimplemented opcode 0x%02X at PC=0x%04X", opcode, pc);
-    }
-
-    void logDebug(const char* fmt, ...) override {
-        if (debug) {
-            char buf[1024];
-            va_list args;
-            va_start(args, fmt);
-            vsnprintf(buf, sizeof(buf), fmt, args);
-            va_end(args);
-            LOGD("%s", buf);
-        }
-    }
-
-    void setDebug(bool d) { debug = d; }
-};
-
-//=============================================================================
-// Emulator State Class - Encapsulates all emulator state for clean reboot
-//=============================================================================
-
-class EmulatorState {
-public:
-    banked_mem* memory = nullptr;
-    hbios_cpu* cpu = nullptr;
-    HBIOSDispatch* hbios = nullptr;
-    AndroidEmulatorDelegate* delegate = nullptr;
-
-    EmulatorState() {
-        LOGI("EmulatorState: Creating new instance");
-        memory = new banked_mem();
-        hbios = new HBIOSDispatch();
-        delegate = new AndroidEmulatorDelegate(memory, hbios);
-        cpu = new hbios_cpu(memory, delegate);
-        hbios->setCPU(cpu);
-        hbios->setMemory(memory);
-        hbios->setBlockingAllowed(false);  // Android uses non-blocking I/O
-    }
-
-    ~EmulatorState() {
-        LOGI("EmulatorState: Destroying instance");
-        delete cpu;
-        delete delegate;
-        delete hbios;
-        delete memory;
-    }
-
-    // Non-copyable
-    EmulatorState(const EmulatorState&) = delete;
-    EmulatorState& operator=(const EmulatorState&) = delete;
-};
-
 //=============================================================================
 // Global State
 //=============================================================================
@@ -119,25 +49,92 @@ static EmulatorState* g_emu = nullptr;
 static bool g_running = false;
 static bool g_initialized = false;
 
-// Cached ROM and disk data for reboot
+// Cached ROM data and mounted disk images for reboot. Each unit holds a
+// reference on its mapping so reset remounts it without rereading the file.
 static std::vector<uint8_t> g_cached_rom;
-static std::vector<uint8_t> g_cached_disks[16];
+static disk_image* g_disk_images[16] = {nullptr};
 static int g_cached_disk_slices[16] = {0};
 static bool g_cached_disk_manifest[16] = {false};  // Track which disks are manifest (downloaded)
 
+// PC sampler, kept across resets; idle until nativeProfileStart
+static PcSampler g_pc_sampler;
+
+// Execution trace, kept across resets and after nativeTraceStop for
+// dumping. Written to g_trace_crash_path by emu_fatal while active.
+static TraceRing* g_trace = nullptr;
+static bool g_trace_active = false;
+static std::string g_trace_crash_path;
+
+// Incremental save-state chain, created by the first nativeSaveState.
+// Emulator thread only; other threads read g_checkpoints_active instead.
+static Checkpointer* g_checkpointer = nullptr;
+static std::atomic<bool> g_checkpoints_active{false};
+
+// Journals opened by mounts replay up to here (nativePrepareResume), so
+// disks match the state about to be restored
+static uint32_t g_journal_replay_limit = DISK_JOURNAL_ALL;
+
+// Set by nativeSaveDisk while checkpoints are taken: compact the journals
+// at the next checkpoint instead
+static std::atomic<bool> g_compact_journals{false};
+
+// Machine as left by nativeCompleteInit, so reboot can copy it back in
+// place instead of rebuilding EmulatorState. Invalidated by anything that
+// changes what emu_complete_init would produce (ROM, mounts, slices).
+struct PristineImage {
+    std::vector<uint8_t> rom;
+    std::vector<uint8_t> ram;
+    qkz80_reg_set regs;
+    uint8_t bank = 0;
+    uint16_t banks_initialized = 0;
+    bool valid = false;
+};
+static PristineImage g_pristine;
+
+static void capture_pristine() {
+    // Sized once; later captures reuse the buffers
+    g_pristine.rom.resize(paged_mem::ROM_SIZE);
+    g_pristine.ram.resize(paged_mem::RAM_SIZE);
+    memcpy(g_pristine.rom.data(), g_emu->memory->get_rom(), paged_mem::ROM_SIZE);
+    memcpy(g_pristine.ram.data(), g_emu->memory->get_ram(), paged_mem::RAM_SIZE);
+    g_pristine.regs = g_emu->cpu->regs;
+    g_pristine.bank = g_emu->memory->get_current_bank();
+    uint16_t* bitmap = g_emu->hbios->getInitializedBanksBitmap();
+    g_pristine.banks_initialized = bitmap ? *bitmap : 0;
+    g_pristine.valid = true;
+}
+
 //=============================================================================
 // I/O State
 //=============================================================================
 
-static std::queue<int> g_input_queue;
-static std::queue<uint8_t> g_output_queue;
-static std::mutex g_input_mutex;
-static std::mutex g_output_mutex;
-
-// JNI callback references
+// Console input from the UI. Producers (nativeQueueInput*) are serialized
+// by EmulatorEngine; the CPU thread is the only consumer. LF is translated
+// to CR once on the way in.
+static SpscRing<4096> g_input_ring;
+
+// Console screen. Direct port writes, HBIOS CIOOUT output and emu_video_*
+// calls all draw into it on the CPU thread, in the order the guest produced
+// them; see terminal.h.
+static Terminal g_terminal;
+
+// Screen frames shared with Kotlin through a direct ByteBuffer
+// (nativeGetScreenBuffer). Frames are numbered: each run call takes the
+// number of the last frame Kotlin copied out, publishes a new one only if
+// that is the latest (so the buffer is never written while Kotlin reads it)
+// and the screen changed, and returns the latest number.
+static uint8_t* g_shared_screen = nullptr;
+static uint32_t g_screen_frame = 0;
+
+// Requests from the UI thread, applied by the CPU thread at the next run
+// call: terminal size (rows << 16 | cols << 8 | wrap columns, 0 = none) and
+// text the app writes to the screen itself, such as the version banner
+static std::atomic<uint32_t> g_terminal_size{0};
+static std::mutex g_terminal_text_mutex;
+static std::vector<uint8_t> g_terminal_text;
+
+// JNI references
 static JavaVM* g_jvm = nullptr;
-static jobject g_callback_obj = nullptr;
-static jmethodID g_on_output_method = nullptr;
 
 // Debug and logging state
 static volatile bool g_debug_enabled = false;
@@ -148,9 +145,8 @@ static int g_consecutive_ctrl_c = 0;
 // Random number generator
 static std::mt19937 g_rng(std::random_device{}());
 
-// Video state
-static int g_cursor_row = 0;
-static int g_cursor_col = 0;
+// Video attribute as last set through emu_video_set_attr. Colours on the
+// screen come from SGR sequences; the CGA attribute is only reported back.
 static uint8_t g_text_attr = 0x07;
 
 // Host file transfer state
@@ -189,42 +185,89 @@ void emu_io_cleanup() {
     LOGI("emu_io_cleanup");
 }
 
+// An empty poll is the only way HBIOSDispatch can decide to wait for
+// input, so it raises EXIT_INPUT_POLL for the run loop to check.
 bool emu_console_has_input() {
-    std::lock_guard<std::mutex> lock(g_input_mutex);
-    return !g_input_queue.empty();
+    if (g_input_ring.empty()) {
+        request_exit(EXIT_INPUT_POLL);
+        return false;
+    }
+    return true;
 }
 
 int emu_console_read_char() {
-    std::lock_guard<std::mutex> lock(g_input_mutex);
-    if (g_input_queue.empty()) {
+    uint8_t ch;
+    if (!g_input_ring.pop(&ch)) {
+        request_exit(EXIT_INPUT_POLL);
         return -1;
     }
-    int ch = g_input_queue.front();
-    g_input_queue.pop();
-    if (ch == '\n') ch = '\r';  // LF -> CR for CP/M
     return ch;
 }
 
 void emu_console_queue_char(int ch) {
-    std::lock_guard<std::mutex> lock(g_input_mutex);
-    g_input_queue.push(ch);
+    uint8_t byte = static_cast<uint8_t>(ch);
+    if (byte == '\n') byte = '\r';  // LF -> CR for CP/M
+    g_input_ring.push(byte);
+}
+
+// Bulk enqueue with LF -> CR translation. Returns the number of bytes
+// accepted, which is less than count once the ring is full.
+static size_t console_queue_bytes(const uint8_t* data, size_t count) {
+    uint8_t chunk[256];
+    size_t accepted = 0;
+    while (accepted < count) {
+        size_t n = std::min(count - accepted, std::min(sizeof(chunk), g_input_ring.free_space()));
+        if (n == 0) break;
+        for (size_t i = 0; i < n; i++) {
+            uint8_t byte = data[accepted + i];
+            chunk[i] = (byte == '\n') ? '\r' : byte;
+        }
+        accepted += g_input_ring.write(chunk, n);
+    }
+    return accepted;
 }
 
+// Consumer side; only called while the CPU thread is not running
 void emu_console_clear_queue() {
-    std::lock_guard<std::mutex> lock(g_input_mutex);
-    while (!g_input_queue.empty()) g_input_queue.pop();
+    g_input_ring.clear();
+}
+
+// All guest output reaches the screen here. In jump scroll mode it is
+// simply applied and frames show the result; in smooth scroll mode the
+// batch ends once a screenful has scrolled past unseen, so the guest runs
+// no further ahead of the display than that.
+static void terminal_write(const uint8_t* data, size_t count) {
+    g_terminal.write(data, count);
+    if (!g_terminal.jump_scroll() && g_terminal.scrolled_off() >= g_terminal.rows()) {
+        request_exit(EXIT_OUTPUT_FULL);
+    }
+}
+
+// HBIOSDispatch buffers CIOOUT characters internally. Draw them before
+// anything else reaches the screen so the two paths stay in order.
+static void output_sink_sync_hbios() {
+    if (!g_emu || !g_emu->hbios) return;
+    std::vector<uint8_t> hbios_output = g_emu->hbios->getOutputChars();
+    if (!hbios_output.empty()) {
+        terminal_write(hbios_output.data(), hbios_output.size());
+    }
+}
+
+// Bulk write to the console screen
+static void console_write_bytes(const uint8_t* data, size_t count) {
+    output_sink_sync_hbios();
+    terminal_write(data, count);
 }
 
 void emu_console_write_char(uint8_t ch) {
     ch &= 0x7F;  // Strip high bit
-    std::lock_guard<std::mutex> lock(g_output_mutex);
-    g_output_queue.push(ch);
+    console_write_bytes(&ch, 1);
 }
 
 bool emu_console_check_escape(char escape_char) {
-    std::lock_guard<std::mutex> lock(g_input_mutex);
-    if (!g_input_queue.empty() && g_input_queue.front() == escape_char) {
-        g_input_queue.pop();
+    uint8_t ch;
+    if (g_input_ring.peek(&ch) && ch == static_cast<uint8_t>(escape_char)) {
+        g_input_ring.pop(&ch);
         return true;
     }
     return false;
@@ -311,6 +354,10 @@ void emu_error(const char* fmt, ...) {
     va_end(args);
     LOGE("*** FATAL ERROR ***");
     LOGE("%s", buf);
+    if (g_trace_active && !g_trace_crash_path.empty()) {
+        LOGE("Trace: %ld records to %s", g_trace->dump(g_trace_crash_path, 0),
+             g_trace_crash_path.c_str());
+    }
     LOGE("*** ABORTING ***");
     abort();
 }
@@ -362,70 +409,84 @@ size_t emu_file_size(const std::string& path) {
 }
 
 //=============================================================================
-// Disk Image I/O (In-memory for Android)
+// Disk Image I/O (memory-mapped, see disk_image.h)
 //=============================================================================
 
-// Disk images are loaded entirely into memory on Android
-struct disk_mem {
-    std::vector<uint8_t> data;
-    bool readonly;
-};
-
+// Images mounted through nativeOpenDisk are already registered with the
+// mode chosen there; anything else is mapped according to the fopen mode.
 emu_disk_handle emu_disk_open(const std::string& path, const char* mode) {
-    (void)path;
-    (void)mode;
-    // Disk images are loaded via JNI, not by path
-    return nullptr;
+    bool writable = mode && (strchr(mode, '+') || strchr(mode, 'w'));
+    return disk_image_open(path, writable ? DISK_MAP_SHARED : DISK_MAP_READONLY);
 }
 
 void emu_disk_close(emu_disk_handle handle) {
-    if (!handle) return;
-    disk_mem* disk = static_cast<disk_mem*>(handle);
-    delete disk;
+    disk_image_release(static_cast<disk_image*>(handle));
 }
 
 size_t emu_disk_read(emu_disk_handle handle, size_t offset,
                      uint8_t* buffer, size_t count) {
-    if (!handle) return 0;
-    disk_mem* disk = static_cast<disk_mem*>(handle);
-
-    if (offset >= disk->data.size()) return 0;
-    size_t avail = disk->data.size() - offset;
-    if (count > avail) count = avail;
-
-    memcpy(buffer, disk->data.data() + offset, count);
-    return count;
+    return disk_image_read(static_cast<disk_image*>(handle), offset, buffer, count);
 }
 
 size_t emu_disk_write(emu_disk_handle handle, size_t offset,
                       const uint8_t* buffer, size_t count) {
-    if (!handle) return 0;
-    disk_mem* disk = static_cast<disk_mem*>(handle);
-    if (disk->readonly) return 0;
-
-    size_t needed = offset + count;
-    if (needed > disk->data.size()) {
-        disk->data.resize(needed);
+    disk_image* image = static_cast<disk_image*>(handle);
+    size_t written = disk_image_write(image, offset, buffer, count);
+    // Journal after the write lands so compaction never truncates a record
+    // whose data it didn't save
+    if (written && image->journal) {
+        disk_journal_append(image->journal, offset, buffer, written);
     }
-
-    memcpy(disk->data.data() + offset, buffer, count);
-    return count;
+    return written;
 }
 
 void emu_disk_flush(emu_disk_handle handle) {
-    (void)handle;
-    // In-memory, nothing to flush
+    disk_image_flush(static_cast<disk_image*>(handle));
 }
 
 void emu_disk_flush_all() {
-    // In-memory disks - persistence is handled by Java layer via saveDirtyDisks()
-    // This is called on warm boot; Java polls dirty flags periodically and on pause/exit
+    // Shared mappings are synced here (called on warm boot); private ones
+    // are persisted by the Java layer via saveDirtyDisks()
+    disk_image_flush_all();
 }
 
 size_t emu_disk_size(emu_disk_handle handle) {
     if (!handle) return 0;
-    disk_mem* disk = static_cast<disk_mem*>(handle);
-    return disk->data.size();
+    return static_cast<disk_image*>(handle)->size;
+}
+
+static std::string jstring_to_string(JNIEnv* env, jstring str) {
+    if (!str) return std::string();
+    const char* chars = env->GetStringUTFChars(str, nullptr);
+    if (!chars) return std::string();
+    std::string result = chars;
+    env->ReleaseStringUTFChars(str, chars);
+    return result;
+}
+
+// Stop journaling unit's image and drop the unit's reference on it
+static void unmount_disk(int unit) {
+    disk_image* image = g_disk_images[unit];
+    if (!image) return;
+    g_pristine.valid = false;
+    if (image->journal) {
+        disk_journal_close(image->journal);
+        image->journal = nullptr;
+    }
+    disk_image_release(image);
+    g_disk_images[unit] = nullptr;
+}
+
+// Resident set size in KB, for reporting disk memory use
+static long process_rss_kb() {
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f) return -1;
+    long pages_total = 0;
+    long pages_resident = 0;
+    int n = fscanf(f, "%ld %ld", &pages_total, &pages_resident);
+    fclose(f);
+    if (n != 2) return -1;
+    return pages_resident * (sysconf(_SC_PAGESIZE) / 1024);
 }
 
 //=============================================================================
@@ -469,38 +530,27 @@ void emu_video_get_caps(emu_video_caps* caps) {
     caps->pixel_height = 0;
 }
 
+// The video functions work on the console screen directly, after any
+// pending HBIOS output so they land in order with it
+
 void emu_video_clear() {
-    g_cursor_row = 0;
-    g_cursor_col = 0;
-    // Clear is handled by VT100 escape in terminal view
-    emu_console_write_char(0x1B);
-    emu_console_write_char('[');
-    emu_console_write_char('2');
-    emu_console_write_char('J');
-    emu_console_write_char(0x1B);
-    emu_console_write_char('[');
-    emu_console_write_char('H');
+    output_sink_sync_hbios();
+    g_terminal.clear();
 }
 
 void emu_video_set_cursor(int row, int col) {
-    g_cursor_row = row;
-    g_cursor_col = col;
-    // Emit VT100 cursor position sequence
-    char buf[32];
-    snprintf(buf, sizeof(buf), "\x1B[%d;%dH", row + 1, col + 1);
-    for (char* p = buf; *p; p++) {
-        emu_console_write_char(*p);
-    }
+    output_sink_sync_hbios();
+    g_terminal.move_cursor(row, col);
 }
 
 void emu_video_get_cursor(int* row, int* col) {
-    *row = g_cursor_row;
-    *col = g_cursor_col;
+    output_sink_sync_hbios();
+    *row = g_terminal.cursor_row();
+    *col = g_terminal.cursor_col();
 }
 
 void emu_video_write_char(uint8_t ch) {
     emu_console_write_char(ch);
-    g_cursor_col++;
 }
 
 void emu_video_write_char_at(int row, int col, uint8_t ch) {
@@ -509,8 +559,8 @@ void emu_video_write_char_at(int row, int col, uint8_t ch) {
 }
 
 void emu_video_scroll_up(int lines) {
-    (void)lines;
-    // Scrolling handled by terminal view
+    output_sink_sync_hbios();
+    g_terminal.scroll_up(lines);
 }
 
 void emu_video_set_attr(uint8_t attr) {
@@ -667,29 +717,38 @@ JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void* reserved) {
 
 JNIEXPORT void JNICALL
 Java_com_awohl_cpmdroid_EmulatorEngine_nativeInit(JNIEnv* env, jobject thiz) {
+    (void)env;
+    (void)thiz;
     LOGI("Initializing emulator engine");
 
     if (g_initialized) {
         LOGI("Already initialized");
+        // A new EmulatorEngine starts counting frames from zero and has
+        // nothing on screen yet
+        g_screen_frame = 0;
+        g_terminal.invalidate();
         return;
     }
 
     emu_io_init();
 
     // Create emulator state (memory, cpu, hbios, delegate)
-    g_emu = new EmulatorState();
+    g_emu = new EmulatorState(false);  // Android uses non-blocking I/O
+    g_emu->pc_sampler = &g_pc_sampler;
+    if (g_trace_active) g_emu->set_trace(g_trace);
 
     // Clear cached data
     g_cached_rom.clear();
     for (int i = 0; i < 16; i++) {
-        g_cached_disks[i].clear();
+        unmount_disk(i);
         g_cached_disk_slices[i] = 0;
         g_cached_disk_manifest[i] = false;
     }
 
-    g_callback_obj = env->NewGlobalRef(thiz);
-    jclass clazz = env->GetObjectClass(thiz);
-    g_on_output_method = env->GetMethodID(clazz, "onOutput", "([B)V");
+    // Shared screen buffer lives as long as the engine; Kotlin wraps it once
+    g_shared_screen = new uint8_t[Terminal::MAX_FRAME];
+    g_screen_frame = 0;
+    g_terminal.reset();
 
     g_initialized = true;
     LOGI("Emulator engine initialized");
@@ -697,23 +756,29 @@ Java_com_awohl_cpmdroid_EmulatorEngine_nativeInit(JNIEnv* env, jobject thiz) {
 
 JNIEXPORT void JNICALL
 Java_com_awohl_cpmdroid_EmulatorEngine_nativeDestroy(JNIEnv* env, jobject thiz) {
+    (void)env;
     (void)thiz;
     LOGI("Destroying emulator engine");
 
     g_running = false;
-
-    if (g_callback_obj) {
-        env->DeleteGlobalRef(g_callback_obj);
-        g_callback_obj = nullptr;
-    }
+    request_exit(EXIT_STOP);
 
     delete g_emu;
     g_emu = nullptr;
 
+    // Finishes any queued checkpoint writes
+    g_checkpoints_active.store(false, std::memory_order_relaxed);
+    delete g_checkpointer;
+    g_checkpointer = nullptr;
+
+    // Kotlin drops its ByteBuffer wrapper before calling destroy
+    delete[] g_shared_screen;
+    g_shared_screen = nullptr;
+
     // Clear cached data
     g_cached_rom.clear();
     for (int i = 0; i < 16; i++) {
-        g_cached_disks[i].clear();
+        unmount_disk(i);
         g_cached_disk_slices[i] = 0;
         g_cached_disk_manifest[i] = false;
     }
@@ -737,6 +802,7 @@ Java_com_awohl_cpmdroid_EmulatorEngine_nativeLoadRom(JNIEnv* env, jobject thiz,
     jbyte* data = env->GetByteArrayElements(romData, nullptr);
 
     LOGI("Loading ROM, size: %d bytes", len);
+    g_pristine.valid = false;
 
     // Cache ROM data for reboot
     g_cached_rom.assign(reinterpret_cast<uint8_t*>(data),
@@ -757,38 +823,187 @@ Java_com_awohl_cpmdroid_EmulatorEngine_nativeLoadRom(JNIEnv* env, jobject thiz,
     return success ? JNI_TRUE : JNI_FALSE;
 }
 
-JNIEXPORT jboolean JNICALL
-Java_com_awohl_cpmdroid_EmulatorEngine_nativeLoadDisk(JNIEnv* env, jobject thiz,
-                                                        jint unit, jbyteArray diskData) {
-    (void)thiz;
+static bool check_disk_unit(int unit) {
     if (!g_initialized || !g_emu) {
         LOGE("Engine not initialized");
-        return JNI_FALSE;
+        return false;
     }
-
     if (unit < 0 || unit >= 16) {
         LOGE("Invalid disk unit: %d", unit);
+        return false;
+    }
+    return true;
+}
+
+// Put an opened image (registered as image_path) on unit, attaching its
+// journal and handing it to HBIOS. Takes over the image reference.
+static bool mount_image(int unit, disk_image* image, const std::string& image_path,
+                        const std::string& persist_path, long rss_before) {
+    LOGI("Opening disk unit %d: %s (%zu bytes, %s)", unit, image_path.c_str(),
+         image->size, image->mode == DISK_MAP_SHARED ? "shared" : "copy-on-write");
+
+    // Remounting the same image keeps its journal running
+    if (g_disk_images[unit] == image) {
+        disk_image_release(image);
+    } else {
+        unmount_disk(unit);
+    }
+
+    // Replay before HBIOS sees the disk so it mounts the recovered contents
+    if (!image->journal && !persist_path.empty()) {
+        image->journal = disk_journal_open(image, persist_path, g_journal_replay_limit);
+    }
+
+    // HBIOSDispatch opens the path through emu_disk_open and gets this mapping
+    g_pristine.valid = false;
+    bool success = g_emu->hbios->loadDisk(static_cast<uint8_t>(unit), image_path);
+    g_disk_images[unit] = image;
+    if (!success) {
+        unmount_disk(unit);
+    }
+
+    LOGI("RSS before disk %d: %ld KB, after: %ld KB", unit, rss_before, process_rss_kb());
+    if (success && image->sparse) LOGI("%s", block_store_report().c_str());
+    return success;
+}
+
+// Mount the image file at path on unit. Shared mappings write through to
+// the file; otherwise writes stay in a private copy-on-write mapping until
+// saved via nativeSaveDisk. Writes are journaled next to persistPath (if
+// not empty), and a journal left by a killed process is replayed first.
+JNIEXPORT jboolean JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativeOpenDisk(JNIEnv* env, jobject thiz,
+                                                        jint unit, jstring path, jboolean shared,
+                                                        jstring persistPath) {
+    (void)thiz;
+    if (!check_disk_unit(unit)) {
+        return JNI_FALSE;
+    }
+
+    std::string image_path = jstring_to_string(env, path);
+    std::string persist_path = jstring_to_string(env, persistPath);
+    if (image_path.empty()) {
+        return JNI_FALSE;
+    }
+
+    long rss_before = process_rss_kb();
+    disk_image* image = disk_image_open(image_path,
+                                        shared ? DISK_MAP_SHARED : DISK_MAP_PRIVATE);
+    if (!image) {
         return JNI_FALSE;
     }
+    return mount_image(unit, image, image_path, persist_path, rss_before) ? JNI_TRUE : JNI_FALSE;
+}
 
-    jsize len = env->GetArrayLength(diskData);
-    jbyte* data = env->GetByteArrayElements(diskData, nullptr);
+// As nativeOpenDisk, for an image the app can only reach through a file
+// descriptor (storage framework documents). fd is duplicated, so the caller
+// closes its own; name identifies the image for remounts and the log.
+JNIEXPORT jboolean JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativeOpenDiskFd(JNIEnv* env, jobject thiz,
+                                                          jint unit, jint fd, jstring name,
+                                                          jboolean shared, jstring persistPath) {
+    (void)thiz;
+    if (!check_disk_unit(unit)) {
+        return JNI_FALSE;
+    }
 
-    LOGI("Loading disk unit %d, size: %d bytes", unit, len);
+    std::string image_name = jstring_to_string(env, name);
+    std::string persist_path = jstring_to_string(env, persistPath);
+    if (image_name.empty() || fd < 0) {
+        return JNI_FALSE;
+    }
 
-    // Cache disk data for reboot
-    g_cached_disks[unit].assign(reinterpret_cast<uint8_t*>(data),
-                                 reinterpret_cast<uint8_t*>(data) + len);
+    long rss_before = process_rss_kb();
+    disk_image* image = disk_image_open_fd(fd, image_name,
+                                           shared ? DISK_MAP_SHARED : DISK_MAP_PRIVATE);
+    if (!image) {
+        return JNI_FALSE;
+    }
+    return mount_image(unit, image, image_name, persist_path, rss_before) ? JNI_TRUE : JNI_FALSE;
+}
 
-    bool success = g_emu->hbios->loadDisk(
-        static_cast<uint8_t>(unit),
-        reinterpret_cast<uint8_t*>(data),
-        static_cast<size_t>(len)
-    );
+// Sharing of packed disks' cached blocks across units, as one line
+JNIEXPORT jstring JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativeDiskStoreReport(JNIEnv* env, jobject thiz) {
+    (void)thiz;
+    return env->NewStringUTF(block_store_report().c_str());
+}
+
+// Pack a raw image into a sparse container (static; no engine needed)
+JNIEXPORT jlong JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativePackDisk(JNIEnv* env, jclass clazz,
+                                                       jstring input, jstring output) {
+    (void)clazz;
+    std::string in = jstring_to_string(env, input);
+    std::string out = jstring_to_string(env, output);
+    long long bytes = sparse_disk_pack(in, out);
+    if (bytes >= 0) LOGI("Packed %s into %lld bytes", in.c_str(), bytes);
+    return static_cast<jlong>(bytes);
+}
+
+// Expand a packed image (or copy a raw one) to a raw image file (static)
+JNIEXPORT jlong JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativeUnpackDisk(JNIEnv* env, jclass clazz,
+                                                         jstring input, jstring output) {
+    (void)clazz;
+    std::string in = jstring_to_string(env, input);
+    std::string out = jstring_to_string(env, output);
+    long long bytes = sparse_disk_unpack(in, out);
+    if (bytes >= 0) LOGI("Unpacked %s to %s (%lld bytes)", in.c_str(), out.c_str(), bytes);
+    return static_cast<jlong>(bytes);
+}
+
+// Persist unit's dirty pages to path (its own file for a shared mapping, the
+// persisted copy for a copy-on-write one). Only changed 4KB pages are
+// written. With a journal attached this compacts it into its own target,
+// or while checkpoints are taken asks the next checkpoint to (the journal
+// already has the writes, and the target must not get ahead of the saved
+// state). Returns bytes written, or -1 on error or if no image is mounted.
+JNIEXPORT jlong JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativeSaveDisk(JNIEnv* env, jobject thiz,
+                                                        jint unit, jstring path) {
+    (void)thiz;
+    if (unit < 0 || unit >= 16 || !g_disk_images[unit]) {
+        return -1;
+    }
+    std::string target = jstring_to_string(env, path);
+    disk_image* image = g_disk_images[unit];
+
+    // Called from the UI thread too, so only the flag is read here
+    if (image->journal && g_checkpoints_active.load(std::memory_order_relaxed)) {
+        g_compact_journals.store(true, std::memory_order_relaxed);
+        LOGI("Disk %d is journaled; compacting at the next checkpoint", unit);
+        return 0;
+    }
 
-    env->ReleaseByteArrayElements(diskData, data, JNI_ABORT);
+    size_t ranges = disk_image_dirty_ranges(image, false).size();
+    long long bytes = image->journal ? disk_journal_compact(image->journal)
+                                     : disk_image_save(image, target);
+    if (bytes >= 0) {
+        LOGI("Saved disk %d: %lld bytes in %zu ranges to %s", unit, bytes, ranges, target.c_str());
+    }
+    return bytes;
+}
 
-    return success ? JNI_TRUE : JNI_FALSE;
+// Resident set size of the process in KB (-1 if unavailable)
+JNIEXPORT jlong JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativeGetRssKb(JNIEnv* env, jobject thiz) {
+    (void)env;
+    (void)thiz;
+    return process_rss_kb();
+}
+
+// Register reset callback for SYSRESET (ROM reboot command)
+static void install_reset_callback() {
+    g_emu->hbios->setResetCallback([](uint8_t reset_type) {
+        LOGI("[SYSRESET] %s boot - restarting",
+             reset_type == 0x01 ? "Warm" : "Cold");
+        // Switch to ROM bank 0
+        g_emu->memory->select_bank(0x00);
+        // Set PC to 0 to restart from ROM
+        g_emu->cpu->regs.PC.set_pair16(0x0000);
+        request_exit(EXIT_RESET);
+    });
 }
 
 JNIEXPORT void JNICALL
@@ -816,15 +1031,7 @@ Java_com_awohl_cpmdroid_EmulatorEngine_nativeCompleteInit(JNIEnv* env, jobject t
 
     emu_complete_init(g_emu->memory, g_emu->hbios, disk_slices);
 
-    // Register reset callback for SYSRESET (ROM reboot command)
-    g_emu->hbios->setResetCallback([](uint8_t reset_type) {
-        LOGI("[SYSRESET] %s boot - restarting",
-             reset_type == 0x01 ? "Warm" : "Cold");
-        // Switch to ROM bank 0
-        g_emu->memory->select_bank(0x00);
-        // Set PC to 0 to restart from ROM
-        g_emu->cpu->regs.PC.set_pair16(0x0000);
-    });
+    install_reset_callback();
 
     // Debug: dump drive map after init
     uint8_t* rom = g_emu->memory->get_rom();
@@ -843,87 +1050,313 @@ Java_com_awohl_cpmdroid_EmulatorEngine_nativeCompleteInit(JNIEnv* env, jobject t
     g_emu->cpu->regs.PC.set_pair16(0x0000);
     g_emu->cpu->regs.SP.set_pair16(0x0000);
 
+    capture_pristine();
+
     LOGI("Emulator ready to run");
 }
 
-JNIEXPORT void JNICALL
+//=============================================================================
+// Run Loop
+//=============================================================================
+
+// Time-budget mode executes in slices of roughly this many microseconds,
+// checking the clock between slices rather than after every instruction
+static const int64_t RUN_SLICE_US = 1000;
+static const int64_t RUN_MIN_SLICE = 1000;
+
+// Measured host speed, refined after every timed batch
+static double g_instructions_per_us = 20.0;
+
+//=============================================================================
+// Clock Throttling
+//=============================================================================
+
+// Target emulated clock in Hz; 0 runs at full host speed
+static uint32_t g_clock_hz = 0;
+
+// T-states accounted since the pacer epoch. The goal for any moment is
+// computed from the epoch rather than per frame, so early or late frames
+// are made up on the next one instead of accumulating drift.
+static uint64_t g_tstates = 0;
+static std::chrono::steady_clock::time_point g_pacer_epoch;
+static bool g_pacer_resync = true;
+
+// If the emulator falls further behind than this (paused, blocked on input,
+// slow host) the pacer restarts rather than trying to catch up in a burst
+static const int64_t PACER_MAX_LAG_US = 50000;
+
+// Achieved clock, measured over windows of at least MEASURE_WINDOW_US
+static const int64_t MEASURE_WINDOW_US = 1000000;
+static uint64_t g_measure_tstates = 0;
+static std::chrono::steady_clock::time_point g_measure_start;
+static double g_achieved_mhz = 0.0;
+
+// T-states due at 'when' according to the pacer epoch
+static uint64_t pacer_goal_at(std::chrono::steady_clock::time_point when) {
+    int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+        when - g_pacer_epoch).count();
+    if (us <= 0) return 0;
+    return static_cast<uint64_t>(us) * g_clock_hz / 1000000;
+}
+
+static void pacer_restart(std::chrono::steady_clock::time_point now) {
+    g_pacer_epoch = now;
+    g_tstates = 0;
+    g_measure_start = now;
+    g_measure_tstates = 0;
+    g_pacer_resync = false;
+}
+
+// Counts for the startup debug logging in the run functions
+static int g_run_count = 0;
+static int g_output_log_count = 0;
+
+// Returns false if the CPU is blocked on console input with nothing queued,
+// in which case execution is skipped entirely (power saving)
+static bool prepare_run() {
+    // Check if we're blocked waiting for input (CIOIN/VDAKRD called with no data)
+    if (g_emu->hbios->isWaitingForInput()) {
+        if (!emu_console_has_input()) {
+            // Idle time is not owed to the guest once it resumes
+            g_pacer_resync = true;
+            return false;
+        }
+        // Input arrived - clear waiting flag so CPU will process it
+        g_emu->hbios->clearWaitingForInput();
+    }
+    g_running = true;
+    g_exit_request.store(0, std::memory_order_relaxed);
+    return true;
+}
+
+// HALT ends the session until reset; anything else just ends the batch
+static int64_t execute_instructions(int64_t maxInstructions, bool* stopped) {
+    int64_t n = emu_run_instructions(g_emu, maxInstructions, stopped);
+    if (*stopped && g_emu->hbios->getState() == HBIOS_HALTED) {
+        g_running = false;
+    }
+    return n;
+}
+
+static int64_t execute_timed_instructions(int64_t maxInstructions, uint64_t tstateGoal,
+                                          bool* stopped) {
+    int64_t n = emu_run_timed(g_emu, maxInstructions, &g_tstates, tstateGoal, stopped);
+    if (*stopped && g_emu->hbios->getState() == HBIOS_HALTED) {
+        g_running = false;
+    }
+    return n;
+}
+
+// Apply what the UI thread asked for since the last run call: a new
+// terminal size, then text to show ahead of the guest's next output
+static void apply_terminal_requests() {
+    uint32_t size = g_terminal_size.exchange(0, std::memory_order_acquire);
+    if (size) {
+        g_terminal.resize(static_cast<int>(size >> 16), static_cast<int>((size >> 8) & 0xFF),
+                          static_cast<int>(size & 0xFF));
+    }
+    std::lock_guard<std::mutex> lock(g_terminal_text_mutex);
+    if (!g_terminal_text.empty()) {
+        output_sink_sync_hbios();
+        g_terminal.write(g_terminal_text.data(), g_terminal_text.size());
+        g_terminal_text.clear();
+    }
+}
+
+// Publish the screen into the shared buffer if it changed and Kotlin has
+// copied out the latest frame (displayedFrame). Returns the latest frame.
+static uint32_t publish_screen(uint32_t displayedFrame) {
+    // Pick up HBIOS output written since the last direct write
+    output_sink_sync_hbios();
+
+    if (displayedFrame != g_screen_frame || !g_terminal.changed()) {
+        return g_screen_frame;
+    }
+    g_terminal.publish(g_shared_screen);
+    g_screen_frame++;
+
+    if (g_output_log_count++ < 3) {
+        LOGI("nativeRun: published frame %u (%dx%d)", g_screen_frame,
+             g_terminal.rows(), g_terminal.cols());
+    }
+    return g_screen_frame;
+}
+
+// Run a fixed number of instructions. Returns the latest screen frame.
+JNIEXPORT jint JNICALL
 Java_com_awohl_cpmdroid_EmulatorEngine_nativeRun(JNIEnv* env, jobject thiz,
-                                                   jint instructionCount) {
+                                                   jint instructionCount, jint displayedFrame) {
+    (void)env;
     (void)thiz;
     if (!g_initialized || !g_emu) {
         LOGE("nativeRun: not initialized");
-        return;
+        return 0;
     }
 
-    // Debug counter (declared before goto to satisfy C++ scoping rules)
-    static int run_count = 0;
+    apply_terminal_requests();
 
-    // Check if we're blocked waiting for input (CIOIN/VDAKRD called with no data)
-    if (g_emu->hbios->isWaitingForInput()) {
-        if (emu_console_has_input()) {
-            // Input arrived - clear waiting flag so CPU will process it
-            g_emu->hbios->clearWaitingForInput();
-        } else {
-            // No input available - skip execution entirely (power saving)
-            // Just flush any pending output below and return
-            goto flush_output;
+    if (prepare_run()) {
+        bool stopped;
+        execute_instructions(instructionCount, &stopped);
+
+        // Debug: log PC after batch
+        if (++g_run_count <= 5) {
+            LOGI("nativeRun #%d: PC=0x%04X after %d instructions",
+                 g_run_count, g_emu->cpu->regs.PC.get_pair16(), instructionCount);
         }
     }
 
-    g_running = true;
+    return static_cast<jint>(publish_screen(static_cast<uint32_t>(displayedFrame)));
+}
 
-    for (int i = 0; i < instructionCount && g_running; i++) {
-        g_emu->cpu->execute();
+// Run until budgetMicros of wall-clock time has elapsed, the CPU blocks on
+// input, or it halts. Slice size adapts to the measured instructions/us so
+// the clock is read about once per RUN_SLICE_US regardless of host speed.
+// With a target clock set, execution also stops once the emulated T-states
+// catch up with wall time. stats[0] receives the instructions executed,
+// stats[1] the elapsed micros, stats[2] the T-states (throttled only) and
+// stats[3] the latest screen frame after publishing.
+JNIEXPORT void JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativeRunTimed(JNIEnv* env, jobject thiz,
+                                                        jint budgetMicros, jlongArray stats,
+                                                        jint displayedFrame) {
+    (void)thiz;
+    if (!g_initialized || !g_emu) {
+        LOGE("nativeRunTimed: not initialized");
+        return;
+    }
 
-        // Check if CPU is now waiting for input
-        if (g_emu->hbios->isWaitingForInput()) {
-            break;  // Stop executing until input is provided
-        }
-        if (g_emu->hbios->getState() == HBIOS_HALTED) {
-            g_running = false;
-            break;
+    apply_terminal_requests();
+
+    using clock = std::chrono::steady_clock;
+    const clock::time_point start = clock::now();
+    const clock::time_point deadline = start + std::chrono::microseconds(budgetMicros);
+    const bool throttled = g_clock_hz != 0;
+    int64_t executed = 0;
+    uint64_t tstates_before = 0;
+
+    if (prepare_run()) {
+        uint64_t goal = 0;
+        if (throttled) {
+            if (g_pacer_resync ||
+                pacer_goal_at(start) > g_tstates +
+                    static_cast<uint64_t>(PACER_MAX_LAG_US) * g_clock_hz / 1000000) {
+                pacer_restart(start);
+            }
+            tstates_before = g_tstates;
+            goal = pacer_goal_at(deadline);
         }
-    }
 
-    // Debug: log PC after batch
-    if (++run_count <= 5) {
-        LOGI("nativeRun #%d: PC=0x%04X after %d instructions",
-             run_count, g_emu->cpu->regs.PC.get_pair16(), instructionCount);
-    }
+        clock::time_point now = start;
+        bool stopped = false;
+        while (!stopped && now < deadline && (!throttled || g_tstates < goal)) {
+            int64_t remaining_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                deadline - now).count();
+            int64_t slice = static_cast<int64_t>(g_instructions_per_us *
+                                                 std::min(remaining_us, RUN_SLICE_US));
+            if (slice < RUN_MIN_SLICE) slice = RUN_MIN_SLICE;
+
+            int64_t n = throttled ? execute_timed_instructions(slice, goal, &stopped)
+                                  : execute_instructions(slice, &stopped);
+            executed += n;
+
+            clock::time_point after = clock::now();
+            int64_t slice_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                after - now).count();
+            if (n == slice && slice_us > 0) {
+                // Smooth the estimate so one slow slice (GC, preemption) doesn't swing it
+                double measured = static_cast<double>(n) / static_cast<double>(slice_us);
+                g_instructions_per_us = 0.75 * g_instructions_per_us + 0.25 * measured;
+            }
+            now = after;
+        }
 
-flush_output:
-    // Flush output queue (from direct port 0x01 writes)
-    std::vector<uint8_t> output;
-    {
-        std::lock_guard<std::mutex> lock(g_output_mutex);
-        while (!g_output_queue.empty()) {
-            output.push_back(g_output_queue.front());
-            g_output_queue.pop();
+        if (throttled) {
+            g_measure_tstates += g_tstates - tstates_before;
+            int64_t window_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                now - g_measure_start).count();
+            if (window_us >= MEASURE_WINDOW_US) {
+                g_achieved_mhz = static_cast<double>(g_measure_tstates) /
+                                 static_cast<double>(window_us);
+                g_measure_start = now;
+                g_measure_tstates = 0;
+            }
         }
-    }
 
-    // Also flush HBIOS output buffer (from CIOOUT calls via port 0xEF dispatch)
-    if (g_emu->hbios) {
-        std::vector<uint8_t> hbios_output = g_emu->hbios->getOutputChars();
-        if (!hbios_output.empty() && run_count <= 5) {
-            LOGI("nativeRun: got %zu chars from HBIOS buffer", hbios_output.size());
+        if (++g_run_count <= 5) {
+            LOGI("nativeRunTimed #%d: PC=0x%04X after %lld instructions (%.1f instr/us)",
+                 g_run_count, g_emu->cpu->regs.PC.get_pair16(),
+                 static_cast<long long>(executed), g_instructions_per_us);
         }
-        output.insert(output.end(), hbios_output.begin(), hbios_output.end());
     }
 
-    // Debug: log output
-    static int output_log_count = 0;
-    if (!output.empty() && output_log_count++ < 3) {
-        LOGI("nativeRun: sending %zu chars to Java", output.size());
+    uint32_t frame = publish_screen(static_cast<uint32_t>(displayedFrame));
+
+    if (stats) {
+        jlong result[4];
+        result[0] = executed;
+        result[1] = std::chrono::duration_cast<std::chrono::microseconds>(
+            clock::now() - start).count();
+        result[2] = throttled ? static_cast<jlong>(g_tstates - tstates_before) : 0;
+        result[3] = frame;
+        env->SetLongArrayRegion(stats, 0, 4, result);
     }
+}
 
-    if (!output.empty() && g_callback_obj && g_on_output_method) {
-        jbyteArray arr = env->NewByteArray(static_cast<jsize>(output.size()));
-        env->SetByteArrayRegion(arr, 0, static_cast<jsize>(output.size()),
-                               reinterpret_cast<jbyte*>(output.data()));
-        env->CallVoidMethod(g_callback_obj, g_on_output_method, arr);
-        env->DeleteLocalRef(arr);
+// Direct ByteBuffer over the shared screen frame, fetched once after init
+JNIEXPORT jobject JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativeGetScreenBuffer(JNIEnv* env, jobject thiz) {
+    (void)thiz;
+    if (!g_shared_screen) {
+        LOGE("nativeGetScreenBuffer: not initialized");
+        return nullptr;
     }
+    return env->NewDirectByteBuffer(g_shared_screen, Terminal::MAX_FRAME);
+}
+
+// Terminal size chosen by the view; takes effect at the next run call.
+// wrapCols is the visible width to wrap at, 0 to truncate at cols.
+JNIEXPORT void JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativeSetTerminalSize(JNIEnv* env, jobject thiz,
+                                                               jint rows, jint cols, jint wrapCols) {
+    (void)env;
+    (void)thiz;
+    uint32_t r = static_cast<uint32_t>(std::max(1, std::min<int>(rows, Terminal::MAX_ROWS)));
+    uint32_t c = static_cast<uint32_t>(std::max(1, std::min<int>(cols, Terminal::MAX_COLS)));
+    uint32_t w = static_cast<uint32_t>(std::max(0, std::min<int>(wrapCols, Terminal::MAX_COLS)));
+    g_terminal_size.store(r << 16 | c << 8 | w, std::memory_order_release);
+}
+
+// Show text on the screen as if the guest had written it, at the next run call
+JNIEXPORT void JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativeTerminalWrite(JNIEnv* env, jobject thiz,
+                                                             jbyteArray data) {
+    (void)thiz;
+    jsize length = env->GetArrayLength(data);
+    std::lock_guard<std::mutex> lock(g_terminal_text_mutex);
+    size_t start = g_terminal_text.size();
+    g_terminal_text.resize(start + static_cast<size_t>(length));
+    env->GetByteArrayRegion(data, 0, length, reinterpret_cast<jbyte*>(g_terminal_text.data() + start));
+}
+
+// Set the emulated Z80 clock in Hz for nativeRunTimed; 0 = unlimited
+JNIEXPORT void JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativeSetClockHz(JNIEnv* env, jobject thiz, jint hz) {
+    (void)env;
+    (void)thiz;
+    g_clock_hz = hz > 0 ? static_cast<uint32_t>(hz) : 0;
+    g_pacer_resync = true;
+    g_achieved_mhz = 0.0;
+    LOGI("CPU clock set to %u Hz%s", g_clock_hz, g_clock_hz ? "" : " (unlimited)");
+}
+
+// Emulated clock achieved over the last measurement window, in MHz
+// (0 when unthrottled or not yet measured)
+JNIEXPORT jdouble JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativeGetAchievedMHz(JNIEnv* env, jobject thiz) {
+    (void)env;
+    (void)thiz;
+    return g_clock_hz ? g_achieved_mhz : 0.0;
 }
 
 JNIEXPORT void JNICALL
@@ -931,6 +1364,7 @@ Java_com_awohl_cpmdroid_EmulatorEngine_nativeStop(JNIEnv* env, jobject thiz) {
     (void)env;
     (void)thiz;
     g_running = false;
+    request_exit(EXIT_STOP);
 }
 
 JNIEXPORT jboolean JNICALL
@@ -956,12 +1390,47 @@ Java_com_awohl_cpmdroid_EmulatorEngine_nativeQueueInputString(JNIEnv* env, jobje
                                                                 jstring str) {
     (void)thiz;
     const char* cstr = env->GetStringUTFChars(str, nullptr);
-    for (size_t i = 0; cstr[i] != '\0'; i++) {
-        emu_console_queue_char(static_cast<int>(cstr[i]));
-    }
+    console_queue_bytes(reinterpret_cast<const uint8_t*>(cstr), strlen(cstr));
     env->ReleaseStringUTFChars(str, cstr);
 }
 
+// Queue length bytes of data starting at offset. Returns the number
+// accepted; the caller keeps the rest and retries as the guest reads.
+JNIEXPORT jint JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativeQueueInputBytes(JNIEnv* env, jobject thiz,
+                                                               jbyteArray data, jint offset,
+                                                               jint length) {
+    (void)thiz;
+    jsize size = env->GetArrayLength(data);
+    if (offset < 0 || length <= 0 || offset > size || length > size - offset) {
+        if (length != 0) LOGE("nativeQueueInputBytes: bad range %d+%d of %d", offset, length, size);
+        return 0;
+    }
+
+    // Copy out only what the ring can take, a chunk at a time
+    uint8_t chunk[256];
+    size_t accepted = 0;
+    while (accepted < static_cast<size_t>(length)) {
+        size_t n = std::min(static_cast<size_t>(length) - accepted,
+                            std::min(sizeof(chunk), g_input_ring.free_space()));
+        if (n == 0) break;
+        env->GetByteArrayRegion(data, offset + static_cast<jsize>(accepted),
+                                static_cast<jsize>(n), reinterpret_cast<jbyte*>(chunk));
+        size_t queued = console_queue_bytes(chunk, n);
+        accepted += queued;
+        if (queued < n) break;
+    }
+    return static_cast<jint>(accepted);
+}
+
+// Number of input bytes queued but not yet read by the guest
+JNIEXPORT jint JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativeGetInputPending(JNIEnv* env, jobject thiz) {
+    (void)env;
+    (void)thiz;
+    return static_cast<jint>(g_input_ring.size());
+}
+
 JNIEXPORT void JNICALL
 Java_com_awohl_cpmdroid_EmulatorEngine_nativeReset(JNIEnv* env, jobject thiz) {
     (void)env;
@@ -970,23 +1439,47 @@ Java_com_awohl_cpmdroid_EmulatorEngine_nativeReset(JNIEnv* env, jobject thiz) {
         return;
     }
 
-    LOGI("Emulator reset: destroying and recreating state");
-
     g_running = false;
+    request_exit(EXIT_STOP);
 
-    // Clear console queues
+    // Clear console input and the screen
     emu_console_clear_queue();
-    {
-        std::lock_guard<std::mutex> lock(g_output_mutex);
-        while (!g_output_queue.empty()) g_output_queue.pop();
+    g_terminal.reset();
+
+    // Same ROM, mounts and slices as at nativeCompleteInit: copy the image
+    // captured there back over memory. Nothing is reallocated and the disk
+    // mappings, HBIOS disk state and reset callback stay as they are.
+    // HBIOSDispatch has no way to leave the halted state (e.g. after the
+    // guest executed HALT), so then only recreating it recovers.
+    if (g_pristine.valid && g_emu && g_emu->hbios->getState() != HBIOS_HALTED) {
+        auto start = std::chrono::steady_clock::now();
+        g_emu->hbios->getOutputChars();  // Drop output from before the reset
+        g_emu->hbios->clearWaitingForInput();
+        memcpy(g_emu->memory->get_rom(), g_pristine.rom.data(), paged_mem::ROM_SIZE);
+        memcpy(g_emu->memory->get_ram(), g_pristine.ram.data(), paged_mem::RAM_SIZE);
+        g_emu->memory->select_bank(g_pristine.bank);
+        uint16_t* bitmap = g_emu->hbios->getInitializedBanksBitmap();
+        if (bitmap) *bitmap = g_pristine.banks_initialized;
+        g_emu->cpu->regs = g_pristine.regs;
+        g_emu->cpu->set_cpu_mode(qkz80::MODE_Z80);
+        g_pacer_resync = true;
+
+        long long us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        LOGI("Emulator reset in place (%lld us)", us);
+        return;
     }
 
+    LOGI("Emulator reset: destroying and recreating state");
+
     // Destroy old emulator state
     delete g_emu;
     g_emu = nullptr;
 
     // Create fresh emulator state
-    g_emu = new EmulatorState();
+    g_emu = new EmulatorState(false);  // Android uses non-blocking I/O
+    g_emu->pc_sampler = &g_pc_sampler;
+    if (g_trace_active) g_emu->set_trace(g_trace);
 
     // Reload ROM from cache
     if (!g_cached_rom.empty()) {
@@ -994,11 +1487,11 @@ Java_com_awohl_cpmdroid_EmulatorEngine_nativeReset(JNIEnv* env, jobject thiz) {
         emu_load_rom_from_buffer(g_emu->memory, g_cached_rom.data(), g_cached_rom.size());
     }
 
-    // Reload disks from cache
+    // Remount disks; emu_disk_open finds the mappings still registered
     for (int i = 0; i < 16; i++) {
-        if (!g_cached_disks[i].empty()) {
-            LOGI("Reloading disk %d from cache (%zu bytes)", i, g_cached_disks[i].size());
-            g_emu->hbios->loadDisk(i, g_cached_disks[i].data(), g_cached_disks[i].size());
+        if (g_disk_images[i]) {
+            LOGI("Remounting disk %d from %s", i, g_disk_images[i]->path.c_str());
+            g_emu->hbios->loadDisk(i, g_disk_images[i]->path);
             if (g_cached_disk_slices[i] > 0) {
                 g_emu->hbios->setDiskSliceCount(i, g_cached_disk_slices[i]);
             }
@@ -1011,6 +1504,7 @@ Java_com_awohl_cpmdroid_EmulatorEngine_nativeReset(JNIEnv* env, jobject thiz) {
 
     // Complete initialization (builds drive map, sets up HCB, etc.)
     emu_complete_init(g_emu->memory, g_emu->hbios, g_cached_disk_slices);
+    install_reset_callback();
 
     // Debug: dump drive map after reset
     uint8_t* rom = g_emu->memory->get_rom();
@@ -1030,6 +1524,9 @@ Java_com_awohl_cpmdroid_EmulatorEngine_nativeReset(JNIEnv* env, jobject thiz) {
     g_emu->cpu->regs.PC.set_pair16(0x0000);
     g_emu->cpu->regs.SP.set_pair16(0x0000);
 
+    // Later reboots with the same configuration take the fast path
+    capture_pristine();
+
     LOGI("Emulator reset complete (fresh state)");
 }
 
@@ -1044,6 +1541,7 @@ Java_com_awohl_cpmdroid_EmulatorEngine_nativeSetDiskSliceCount(JNIEnv* env, jobj
     g_emu->hbios->setDiskSliceCount(unit, slices);
     // Also cache for reboot
     if (unit >= 0 && unit < 16) {
+        if (g_cached_disk_slices[unit] != slices) g_pristine.valid = false;
         g_cached_disk_slices[unit] = slices;
     }
     LOGI("Set disk %d slice count to %d", unit, slices);
@@ -1233,7 +1731,11 @@ Java_com_awohl_cpmdroid_EmulatorEngine_nativeIsDiskDirty(JNIEnv* env, jobject th
     if (!g_initialized || !g_emu) {
         return JNI_FALSE;
     }
-    return g_emu->hbios->isDiskDirty(unit) ? JNI_TRUE : JNI_FALSE;
+    // HBIOS's flag is cleared before each save; the image's page bits are
+    // only cleared by a save that succeeds
+    bool dirty = g_emu->hbios->isDiskDirty(unit) ||
+                 (unit >= 0 && unit < 16 && disk_image_dirty(g_disk_images[unit]));
+    return dirty ? JNI_TRUE : JNI_FALSE;
 }
 
 JNIEXPORT void JNICALL
@@ -1247,30 +1749,476 @@ Java_com_awohl_cpmdroid_EmulatorEngine_nativeClearDiskDirty(JNIEnv* env, jobject
     LOGI("Cleared dirty flag for disk %d", unit);
 }
 
-JNIEXPORT jbyteArray JNICALL
-Java_com_awohl_cpmdroid_EmulatorEngine_nativeGetDiskData(JNIEnv* env, jobject thiz, jint unit) {
+//=============================================================================
+// Save State
+//=============================================================================
+
+// Front-end chunks; CPU and memory are written by snapshot.cpp
+static const uint32_t SNAP_ROM_ID = snapshot_tag('R', 'O', 'M', 'I');
+static const uint32_t SNAP_HBIOS = snapshot_tag('H', 'B', 'I', 'O');
+static const uint32_t SNAP_DISKS = snapshot_tag('D', 'I', 'S', 'K');
+static const uint32_t SNAP_DISK_SIZES = snapshot_tag('D', 'S', 'I', 'Z');
+static const uint32_t SNAP_CONSOLE = snapshot_tag('C', 'O', 'N', 'S');
+static const uint32_t SNAP_TERMINAL = snapshot_tag('T', 'E', 'R', 'M');
+static const uint32_t SNAP_JOURNAL = snapshot_tag('J', 'R', 'N', 'L');
+
+// A mounted disk as snapshots identify it: the slot's file name and the
+// image size. Directories are left out because the same slot resolves to
+// the catalog file until the first save and to ModifiedDisks after it.
+static std::string disk_identity_name(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+static uint64_t mounted_disk_size(int unit) {
+    return g_disk_images[unit] ? g_disk_images[unit]->size : 0;
+}
+
+// Identifies the loaded ROM image so a snapshot is never restored over a
+// different one (FNV-1a)
+static uint32_t cached_rom_hash() {
+    uint32_t hash = 2166136261u;
+    for (uint8_t b : g_cached_rom) {
+        hash = (hash ^ b) * 16777619u;
+    }
+    return hash;
+}
+
+// Chunks shared by full snapshots and checkpoint deltas
+static void put_runtime_chunks(SnapshotWriter& writer) {
+    // Disk journal records up to this epoch are part of this state
+    writer.begin_chunk(SNAP_JOURNAL);
+    writer.put_u32(disk_journal_epoch());
+    writer.end_chunk();
+
+    // The drive map and HCB live in ROM/RAM and are already covered
+    writer.begin_chunk(SNAP_HBIOS);
+    uint16_t* bitmap = g_emu->hbios->getInitializedBanksBitmap();
+    writer.put_u16(bitmap ? *bitmap : 0);
+    writer.put_string(g_emu->hbios->getNvramSetting());
+    writer.put_u8(g_emu->hbios->isWaitingForInput() ? 1 : 0);
+    writer.end_chunk();
+
+    // Queued input; output goes straight to the terminal below
+    output_sink_sync_hbios();
+    writer.begin_chunk(SNAP_CONSOLE);
+    std::vector<uint8_t> queued(g_input_ring.capacity());
+    size_t n = g_input_ring.copy(queued.data(), queued.size());
+    writer.put_u32(static_cast<uint32_t>(n));
+    writer.put_bytes(queued.data(), n);
+    writer.put_u8(g_text_attr);
+    writer.end_chunk();
+
+    // Screen contents, which now live here rather than in the view
+    writer.begin_chunk(SNAP_TERMINAL);
+    writer.put_u8(static_cast<uint8_t>(g_terminal.rows()));
+    writer.put_u8(static_cast<uint8_t>(g_terminal.cols()));
+    writer.put_u8(static_cast<uint8_t>(g_terminal.cursor_row()));
+    writer.put_u8(static_cast<uint8_t>(std::min(g_terminal.cursor_col(), 255)));
+    writer.put_u8(g_terminal.attr());
+    writer.put_compressed(reinterpret_cast<const uint8_t*>(g_terminal.cells()),
+                          static_cast<size_t>(g_terminal.rows()) * g_terminal.cols() *
+                              sizeof(uint16_t));
+    writer.end_chunk();
+}
+
+static void get_runtime_chunks(SnapshotReader& reader) {
+    if (reader.open_chunk(SNAP_HBIOS)) {
+        uint16_t banks = reader.get_u16();
+        std::string nvram = reader.get_string();
+        uint16_t* bitmap = g_emu->hbios->getInitializedBanksBitmap();
+        if (bitmap) *bitmap = banks;
+        if (!nvram.empty()) {
+            g_emu->hbios->setNvramSetting(nvram);
+        }
+        // The input-wait flag isn't restored: the guest's pending CIOIN
+        // simply polls again and sets it
+    }
+
+    // The length comes from the file: anything larger than the queue it was
+    // taken from, or than what is left of the chunk, means it is corrupt
+    if (reader.open_chunk(SNAP_CONSOLE)) {
+        std::vector<uint8_t> input;
+        uint8_t attr = 0;
+        uint32_t length = reader.get_u32();
+        bool valid = length <= g_input_ring.capacity() && length <= reader.remaining();
+        if (valid) {
+            input.resize(length);
+            reader.get_bytes(input.data(), input.size());
+            attr = reader.get_u8();
+            valid = reader.ok();
+        }
+
+        if (valid) {
+            g_input_ring.clear();
+            g_input_ring.write(input.data(), input.size());
+            g_text_attr = attr;
+        } else {
+            LOGE("Saved state has a bad console chunk, ignoring it");
+        }
+    }
+
+    if (reader.open_chunk(SNAP_TERMINAL)) {
+        int rows = reader.get_u8();
+        int cols = reader.get_u8();
+        int row = reader.get_u8();
+        int col = reader.get_u8();
+        uint8_t attr = reader.get_u8();
+        std::vector<uint16_t> cells(static_cast<size_t>(rows) * cols);
+        if (reader.get_compressed(reinterpret_cast<uint8_t*>(cells.data()),
+                                  cells.size() * sizeof(uint16_t))) {
+            g_terminal.reset();
+            g_terminal.load_cells(rows, cols, cells.data());
+            g_terminal.move_cursor(row, col);
+            g_terminal.set_attr(attr);
+        }
+    }
+}
+
+// Journal epoch recorded by a snapshot or delta, if it has one
+static bool get_journal_epoch(SnapshotReader& reader, uint32_t* epoch) {
+    if (!reader.open_chunk(SNAP_JOURNAL)) return false;
+    uint32_t value = reader.get_u32();
+    if (!reader.ok()) return false;
+    *epoch = value;
+    return true;
+}
+
+// Called once the state holding the current epoch is queued: later disk
+// writes belong to the next checkpoint
+static void close_journal_epoch() {
+    disk_journal_set_epoch(disk_journal_epoch() + 1);
+}
+
+// Fold every journal into its target. Only done once the checkpoint
+// covering all their records is durable, so a restore never finds a disk
+// ahead of memory.
+static void compact_journals() {
+    for (int i = 0; i < 16; i++) {
+        if (g_disk_images[i] && g_disk_images[i]->journal) {
+            disk_journal_compact(g_disk_images[i]->journal);
+        }
+    }
+    g_compact_journals.store(false, std::memory_order_relaxed);
+}
+
+static void put_full_snapshot(SnapshotWriter& writer) {
+    snapshot_put_machine(writer, g_emu->cpu, g_emu->memory);
+
+    writer.begin_chunk(SNAP_ROM_ID);
+    writer.put_u32(static_cast<uint32_t>(g_cached_rom.size()));
+    writer.put_u32(cached_rom_hash());
+    writer.end_chunk();
+
+    writer.begin_chunk(SNAP_DISKS);
+    for (int i = 0; i < 16; i++) {
+        writer.put_string(g_disk_images[i] ? g_disk_images[i]->path : std::string());
+        writer.put_u32(static_cast<uint32_t>(g_cached_disk_slices[i]));
+        writer.put_u8(g_cached_disk_manifest[i] ? 1 : 0);
+    }
+    writer.end_chunk();
+
+    writer.begin_chunk(SNAP_DISK_SIZES);
+    for (int i = 0; i < 16; i++) {
+        writer.put_u64(mounted_disk_size(i));
+    }
+    writer.end_chunk();
+
+    put_runtime_chunks(writer);
+}
+
+// Snapshot the machine to path and start a new checkpoint chain there.
+// Call with the CPU stopped; disk contents are not included, only which
+// images are mounted where and how far their journals go. Once the file is
+// durable the journals are compacted, then this returns.
+JNIEXPORT jboolean JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativeSaveState(JNIEnv* env, jobject thiz, jstring path) {
     (void)thiz;
     if (!g_initialized || !g_emu) {
-        return nullptr;
+        return JNI_FALSE;
     }
+    auto start = std::chrono::steady_clock::now();
+    std::string target = jstring_to_string(env, path);
 
-    const uint8_t* data = g_emu->hbios->getDiskData(unit);
-    size_t size = g_emu->hbios->getDiskDataSize(unit);
+    SnapshotWriter writer;
+    put_full_snapshot(writer);
 
-    if (data == nullptr || size == 0) {
-        return nullptr;
+    if (!g_checkpointer) {
+        g_checkpointer = new Checkpointer();
+    }
+    g_checkpointer->write_base(target, writer, g_emu->memory);
+    g_checkpoints_active.store(true, std::memory_order_relaxed);
+    close_journal_epoch();
+    bool ok = g_checkpointer->wait_idle();
+    if (ok) {
+        compact_journals();
     }
+    disk_journal_hold_compaction(true);
 
-    jbyteArray result = env->NewByteArray(static_cast<jsize>(size));
-    if (result == nullptr) {
-        LOGE("Failed to allocate byte array for disk %d data (%zu bytes)", unit, size);
-        return nullptr;
+    long long us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    LOGI("Saved state to %s: %zu bytes in %lld us (PC=0x%04X)", target.c_str(),
+         writer.data().size(), us, g_emu->cpu->regs.PC.get_pair16());
+    return ok ? JNI_TRUE : JNI_FALSE;
+}
+
+// Append the pages changed since the last checkpoint (plus CPU and console
+// state) to the chain started by nativeSaveState. Runs between batches on
+// the emulator thread; the file write happens in the background, except
+// when disk journals are due for compaction, which waits for it. Long
+// chains are compacted into a new base. Returns the number of pages
+// written, or -1 if no chain is active.
+JNIEXPORT jint JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativeCheckpoint(JNIEnv* env, jobject thiz) {
+    (void)env;
+    (void)thiz;
+    if (!g_initialized || !g_emu || !g_checkpointer || !g_checkpointer->active()) {
+        return -1;
     }
 
-    env->SetByteArrayRegion(result, 0, static_cast<jsize>(size),
-                            reinterpret_cast<const jbyte*>(data));
-    LOGI("Retrieved disk %d data (%zu bytes)", unit, size);
-    return result;
+    size_t pages = paged_mem::PAGE_COUNT;
+    if (g_checkpointer->needs_compaction()) {
+        SnapshotWriter writer;
+        put_full_snapshot(writer);
+        LOGI("Checkpoint chain compacted (%zu byte base)", writer.data().size());
+        g_checkpointer->write_base(g_checkpointer->path(), writer, g_emu->memory);
+    } else {
+        SnapshotWriter writer;
+        snapshot_put_cpu(writer, g_emu->cpu, g_emu->memory);
+        pages = g_checkpointer->capture_pages(writer, g_emu->memory);
+        put_runtime_chunks(writer);
+        g_checkpointer->append_delta(writer.data());
+    }
+    close_journal_epoch();
+
+    // The disks are exactly as this checkpoint describes them until the
+    // next batch runs, so this is where a journal can be compacted
+    bool compact = g_compact_journals.load(std::memory_order_relaxed);
+    for (int i = 0; i < 16 && !compact; i++) {
+        compact = g_disk_images[i] && disk_journal_needs_compaction(g_disk_images[i]->journal);
+    }
+    if (compact && g_checkpointer->wait_idle()) {
+        compact_journals();
+    }
+    return static_cast<jint>(pages);
+}
+
+// Stop checkpointing (resume was turned off). Journals go back to
+// compacting on their own and through nativeSaveDisk.
+JNIEXPORT void JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativeStopCheckpoints(JNIEnv* env, jobject thiz) {
+    (void)env;
+    (void)thiz;
+    if (g_checkpointer) {
+        g_checkpointer->end_chain();
+    }
+    g_checkpoints_active.store(false, std::memory_order_relaxed);
+    disk_journal_hold_compaction(false);
+}
+
+// Read how far the disk journals go in the state at path (base and intact
+// deltas), so disks mounted next replay their journals only that far and
+// match it. Call before mounting; nativeRestoreState clears the limit.
+JNIEXPORT void JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativePrepareResume(JNIEnv* env, jobject thiz, jstring path) {
+    (void)thiz;
+    std::string source = jstring_to_string(env, path);
+    g_journal_replay_limit = DISK_JOURNAL_ALL;
+
+    SnapshotReader reader;
+    uint32_t epoch = 0;
+    if (!reader.load_file(source) || !get_journal_epoch(reader, &epoch)) {
+        return;  // No state, or one from before journal epochs
+    }
+    Checkpointer::read_deltas(source, Checkpointer::generation(reader),
+                              [&epoch](std::vector<uint8_t> delta) {
+        SnapshotReader d;
+        return d.load(std::move(delta)) && get_journal_epoch(d, &epoch);
+    });
+    g_journal_replay_limit = epoch;
+    LOGI("Disk journals replay up to epoch %u for %s", epoch, source.c_str());
+}
+
+// Restore a snapshot over a booted machine, then replay its checkpoint
+// chain. The same ROM must be loaded and the same disk images mounted
+// (nativeCompleteInit done); otherwise nothing is changed and false is
+// returned. A failure while loading memory leaves the machine
+// inconsistent, so callers should reset on false.
+static bool restore_state(const std::string& source) {
+    auto start = std::chrono::steady_clock::now();
+    SnapshotReader reader;
+    if (!reader.load_file(source)) {
+        LOGI("No usable state at %s", source.c_str());
+        return false;
+    }
+
+    // Configuration checks before anything is touched
+    if (!reader.open_chunk(SNAP_ROM_ID) ||
+        reader.get_u32() != g_cached_rom.size() || reader.get_u32() != cached_rom_hash()) {
+        LOGI("Saved state is for a different ROM");
+        return false;
+    }
+    if (!reader.open_chunk(SNAP_DISKS)) {
+        return false;
+    }
+    for (int i = 0; i < 16; i++) {
+        std::string disk_path = reader.get_string();
+        reader.get_u32();
+        reader.get_u8();
+        std::string mounted = g_disk_images[i] ? g_disk_images[i]->path : std::string();
+        if (!reader.ok() || disk_identity_name(disk_path) != disk_identity_name(mounted)) {
+            LOGI("Saved state has different disks (unit %d)", i);
+            return false;
+        }
+    }
+    // Older snapshots have no sizes; the names have to do
+    if (reader.open_chunk(SNAP_DISK_SIZES)) {
+        for (int i = 0; i < 16; i++) {
+            if (reader.get_u64() != mounted_disk_size(i) || !reader.ok()) {
+                LOGI("Saved state has a different size disk (unit %d)", i);
+                return false;
+            }
+        }
+    }
+
+    if (!snapshot_get_machine(reader, g_emu->cpu, g_emu->memory)) {
+        return false;
+    }
+    get_runtime_chunks(reader);
+    uint32_t epoch = 0;
+    get_journal_epoch(reader, &epoch);
+
+    // Each delta is complete on its own; a bad one ends the chain there
+    size_t deltas = Checkpointer::read_deltas(source, Checkpointer::generation(reader),
+                                              [&epoch](std::vector<uint8_t> delta) {
+        SnapshotReader d;
+        if (!d.load(std::move(delta)) || !Checkpointer::apply_pages(d, g_emu->memory) ||
+            !snapshot_get_cpu(d, g_emu->cpu, g_emu->memory)) {
+            return false;
+        }
+        get_runtime_chunks(d);
+        get_journal_epoch(d, &epoch);
+        return true;
+    });
+
+    // Carry on numbering from the restored state, so writes made before the
+    // next checkpoint are past it if the chain is read again
+    if (epoch > 0) {
+        disk_journal_set_epoch(epoch + 1);
+    }
+
+    g_pacer_resync = true;
+    g_exit_request.store(0, std::memory_order_relaxed);
+
+    long long us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    LOGI("Restored state from %s + %zu checkpoints in %lld us (PC=0x%04X)", source.c_str(),
+         deltas, us, g_emu->cpu->regs.PC.get_pair16());
+    return true;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativeRestoreState(JNIEnv* env, jobject thiz, jstring path) {
+    (void)thiz;
+    if (!g_initialized || !g_emu) {
+        return JNI_FALSE;
+    }
+    std::string source = jstring_to_string(env, path);
+    g_journal_replay_limit = DISK_JOURNAL_ALL;  // Disks are mounted by now
+    bool restored = restore_state(source);
+
+    // Disk writes past the state were held by nativePrepareResume: they go
+    // with a restored state, and are kept if the machine boots instead
+    for (int i = 0; i < 16; i++) {
+        if (g_disk_images[i] && g_disk_images[i]->journal) {
+            disk_journal_settle(g_disk_images[i]->journal, restored);
+        }
+    }
+    return restored ? JNI_TRUE : JNI_FALSE;
+}
+
+//=============================================================================
+// Profiling
+//=============================================================================
+
+JNIEXPORT void JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativeProfileStart(JNIEnv* env, jobject thiz,
+                                                           jint interval, jboolean count_hbios) {
+    (void)env;
+    (void)thiz;
+    g_pc_sampler.start(static_cast<uint32_t>(std::max(interval, 1)), count_hbios == JNI_TRUE);
+    LOGI("PC profiling started (1 per %u instructions)", g_pc_sampler.interval());
+}
+
+JNIEXPORT void JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativeProfileStop(JNIEnv* env, jobject thiz) {
+    (void)env;
+    (void)thiz;
+    g_pc_sampler.stop();
+}
+
+JNIEXPORT jint JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativeProfileLoadSymbols(JNIEnv* env, jobject thiz,
+                                                                 jstring path) {
+    (void)thiz;
+    const char* str = env->GetStringUTFChars(path, nullptr);
+    int count = g_pc_sampler.load_symbols(str ? str : "");
+    env->ReleaseStringUTFChars(path, str);
+    return count;
+}
+
+JNIEXPORT jstring JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativeProfileReport(JNIEnv* env, jobject thiz, jint top) {
+    (void)thiz;
+    std::string report = g_pc_sampler.report(static_cast<size_t>(std::max(top, 1)),
+                                             g_emu ? g_emu->memory : nullptr);
+    return env->NewStringUTF(report.c_str());
+}
+
+//=============================================================================
+// Execution Trace
+//=============================================================================
+
+JNIEXPORT void JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativeTraceStart(JNIEnv* env, jobject thiz,
+                                                         jint records, jstring crashPath) {
+    (void)thiz;
+    size_t capacity = records > 0 ? static_cast<size_t>(records) : TraceRing::DEFAULT_RECORDS;
+    if (!g_trace || g_trace->capacity() < capacity) {
+        if (g_emu) g_emu->set_trace(nullptr);
+        delete g_trace;
+        g_trace = new TraceRing(capacity);
+    }
+    g_trace->clear();
+
+    const char* str = env->GetStringUTFChars(crashPath, nullptr);
+    g_trace_crash_path = str ? str : "";
+    env->ReleaseStringUTFChars(crashPath, str);
+
+    g_trace_active = true;
+    if (g_emu) g_emu->set_trace(g_trace);
+    LOGI("Tracing %zu records", g_trace->capacity());
+}
+
+JNIEXPORT void JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativeTraceStop(JNIEnv* env, jobject thiz) {
+    (void)env;
+    (void)thiz;
+    g_trace_active = false;
+    if (g_emu) g_emu->set_trace(nullptr);
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_awohl_cpmdroid_EmulatorEngine_nativeTraceDump(JNIEnv* env, jobject thiz,
+                                                        jstring path, jint count) {
+    (void)thiz;
+    if (!g_trace) {
+        return -1;
+    }
+    const char* str = env->GetStringUTFChars(path, nullptr);
+    long written = g_trace->dump(str ? str : "", static_cast<size_t>(std::max(count, 0)));
+    env->ReleaseStringUTFChars(path, str);
+    return static_cast<jlong>(written);
 }
 
 } // extern "C"
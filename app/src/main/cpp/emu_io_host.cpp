@@ -0,0 +1,683 @@
+/*
+ * Emulator I/O Implementation - Host (Linux)
+ *
+ * Console on stdin/stdout, disk images memory-mapped from local files,
+ * logging to stderr. Used by the host build to run, script and profile
+ * the emulator core off-device.
+ */
+
+#include "emu_io.h"
+#include "emu_io_host.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <cstring>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <random>
+#include <thread>
+#include <chrono>
+#include <poll.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "hbios_dispatch.h"
+#include "disk_image.h"
+#include "disk_journal.h"
+#include "emu_machine.h"
+
+//=============================================================================
+// I/O State
+//=============================================================================
+
+// Console input: bytes read from stdin or queued by the front end, LF
+// already translated to CR
+static std::deque<uint8_t> g_input;
+static bool g_use_stdin = true;
+static bool g_stdin_closed = false;
+static bool g_exit_key = false;
+
+// Host exit key when stdin is a raw terminal (Ctrl-], as in telnet)
+static const uint8_t HOST_EXIT_KEY = 0x1D;
+
+// Console output, written to stdout in blocks
+static const size_t OUTPUT_FLUSH_SIZE = 4096;
+static std::vector<uint8_t> g_output;
+static bool g_discard_output = false;
+static uint64_t g_output_bytes = 0;
+static std::string g_output_tail;  // Last bytes written while discarding
+static const size_t OUTPUT_TAIL_SIZE = 256;
+static HBIOSDispatch* g_hbios = nullptr;
+
+// Terminal state restored on exit
+static struct termios g_saved_termios;
+static bool g_terminal_raw = false;
+
+// Debug and logging state
+static bool g_debug_enabled = false;
+
+// Ctrl+C tracking
+static int g_consecutive_ctrl_c = 0;
+
+// Random number generator
+static std::mt19937 g_rng(std::random_device{}());
+
+// Video state
+static int g_cursor_row = 0;
+static int g_cursor_col = 0;
+static uint8_t g_text_attr = 0x07;
+
+// Host file transfer state
+static emu_host_file_state g_host_file_state = HOST_FILE_IDLE;
+static std::vector<uint8_t> g_host_read_buffer;
+static size_t g_host_read_pos = 0;
+static std::string g_host_read_filename;
+static std::vector<uint8_t> g_host_write_buffer;
+static std::string g_host_write_filename;
+
+//=============================================================================
+// Platform Utilities
+//=============================================================================
+
+void emu_sleep_ms(int ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+int emu_strcasecmp(const char* s1, const char* s2) {
+    return strcasecmp(s1, s2);
+}
+
+int emu_strncasecmp(const char* s1, const char* s2, size_t n) {
+    return strncasecmp(s1, s2, n);
+}
+
+//=============================================================================
+// Console I/O Implementation
+//=============================================================================
+
+void emu_io_init() {
+}
+
+void emu_io_cleanup() {
+    host_io_flush();
+    host_io_restore_terminal();
+}
+
+// Move whatever stdin has ready into the input queue without blocking
+static void poll_stdin(int timeout_ms) {
+    if (!g_use_stdin || g_stdin_closed) return;
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    if (poll(&pfd, 1, timeout_ms) <= 0) return;
+    uint8_t buf[256];
+    ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+    if (n <= 0) {
+        g_stdin_closed = true;
+        return;
+    }
+    for (ssize_t i = 0; i < n; i++) {
+        if (g_terminal_raw && buf[i] == HOST_EXIT_KEY) {
+            g_exit_key = true;
+            request_exit(EXIT_STOP);
+            continue;
+        }
+        g_input.push_back(buf[i] == '\n' ? '\r' : buf[i]);
+    }
+}
+
+// An empty poll is the only way HBIOSDispatch can decide to wait for
+// input, so it raises EXIT_INPUT_POLL for the run loop to check.
+bool emu_console_has_input() {
+    if (g_input.empty()) poll_stdin(0);
+    if (g_input.empty()) {
+        request_exit(EXIT_INPUT_POLL);
+        return false;
+    }
+    return true;
+}
+
+int emu_console_read_char() {
+    if (!emu_console_has_input()) return -1;
+    uint8_t ch = g_input.front();
+    g_input.pop_front();
+    return ch;
+}
+
+void emu_console_queue_char(int ch) {
+    uint8_t byte = static_cast<uint8_t>(ch);
+    if (byte == '\n') byte = '\r';  // LF -> CR for CP/M
+    g_input.push_back(byte);
+}
+
+void emu_console_clear_queue() {
+    g_input.clear();
+}
+
+static void output_append(const uint8_t* data, size_t count) {
+    g_output_bytes += count;
+    if (g_discard_output) {
+        g_output_tail.append(reinterpret_cast<const char*>(data), count);
+        if (g_output_tail.size() > 2 * OUTPUT_TAIL_SIZE) {
+            g_output_tail.erase(0, g_output_tail.size() - OUTPUT_TAIL_SIZE);
+        }
+        return;
+    }
+    g_output.insert(g_output.end(), data, data + count);
+    if (g_output.size() >= OUTPUT_FLUSH_SIZE) host_io_flush();
+}
+
+// HBIOS queues CIOOUT output internally; take it before any direct write
+// so the two stay in the order the guest produced them
+static void output_sync_hbios() {
+    if (!g_hbios) return;
+    std::vector<uint8_t> hbios_output = g_hbios->getOutputChars();
+    if (!hbios_output.empty()) {
+        output_append(hbios_output.data(), hbios_output.size());
+    }
+}
+
+static void console_write_bytes(const uint8_t* data, size_t count) {
+    output_sync_hbios();
+    output_append(data, count);
+}
+
+void emu_console_write_char(uint8_t ch) {
+    ch &= 0x7F;  // Strip high bit
+    console_write_bytes(&ch, 1);
+}
+
+bool emu_console_check_escape(char escape_char) {
+    if (g_input.empty()) poll_stdin(0);
+    if (!g_input.empty() && g_input.front() == static_cast<uint8_t>(escape_char)) {
+        g_input.pop_front();
+        return true;
+    }
+    return false;
+}
+
+bool emu_console_check_ctrl_c_exit(int ch, int count) {
+    if (ch == 0x03) {
+        g_consecutive_ctrl_c++;
+        if (g_consecutive_ctrl_c >= count) {
+            emu_error("Exit: consecutive ^C received");
+            return true;
+        }
+    } else {
+        g_consecutive_ctrl_c = 0;
+    }
+    return false;
+}
+
+//=============================================================================
+// Host Front-End Hooks
+//=============================================================================
+
+void host_io_attach(HBIOSDispatch* hbios) {
+    if (!hbios) output_sync_hbios();
+    g_hbios = hbios;
+}
+
+void host_io_use_stdin(bool enable) {
+    g_use_stdin = enable;
+}
+
+void host_io_raw_terminal() {
+    if (g_terminal_raw || !isatty(STDIN_FILENO)) return;
+    if (tcgetattr(STDIN_FILENO, &g_saved_termios) != 0) return;
+    struct termios raw = g_saved_termios;
+    // Keys go to the guest unchanged, ^C and ^S included
+    raw.c_iflag &= ~(ICRNL | IXON | ISTRIP | BRKINT);
+    raw.c_lflag &= ~(ECHO | ICANON | ISIG | IEXTEN);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0) {
+        g_terminal_raw = true;
+        atexit(host_io_restore_terminal);
+    }
+}
+
+void host_io_restore_terminal() {
+    if (!g_terminal_raw) return;
+    tcsetattr(STDIN_FILENO, TCSANOW, &g_saved_termios);
+    g_terminal_raw = false;
+}
+
+void host_io_queue_input(const uint8_t* data, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        emu_console_queue_char(data[i]);
+    }
+}
+
+bool host_io_wait_input(int timeout_ms) {
+    host_io_flush();
+    if (g_input.empty()) poll_stdin(timeout_ms);
+    return !g_input.empty();
+}
+
+bool host_io_input_exhausted() {
+    return g_input.empty() && (!g_use_stdin || g_stdin_closed);
+}
+
+bool host_io_exit_requested() {
+    return g_exit_key;
+}
+
+void host_io_discard_output(bool discard) {
+    g_discard_output = discard;
+}
+
+uint64_t host_io_output_bytes() {
+    return g_output_bytes;
+}
+
+std::string host_io_output_tail() {
+    output_sync_hbios();
+    size_t keep = std::min(g_output_tail.size(), OUTPUT_TAIL_SIZE);
+    return g_output_tail.substr(g_output_tail.size() - keep);
+}
+
+void host_io_flush() {
+    output_sync_hbios();
+    if (g_output.empty()) return;
+    fwrite(g_output.data(), 1, g_output.size(), stdout);
+    fflush(stdout);
+    g_output.clear();
+}
+
+//=============================================================================
+// Auxiliary Device I/O
+//=============================================================================
+
+static FILE* g_printer_file = nullptr;
+static FILE* g_aux_in_file = nullptr;
+static FILE* g_aux_out_file = nullptr;
+
+static void reopen(FILE** f, const char* path, const char* mode) {
+    if (*f) fclose(*f);
+    *f = path ? fopen(path, mode) : nullptr;
+    if (path && !*f) emu_error("Cannot open %s", path);
+}
+
+void emu_printer_set_file(const char* path) {
+    reopen(&g_printer_file, path, "ab");
+}
+
+void emu_printer_out(uint8_t ch) {
+    if (g_printer_file) fputc(ch & 0x7F, g_printer_file);
+}
+
+bool emu_printer_ready() {
+    return true;
+}
+
+void emu_aux_set_input_file(const char* path) {
+    reopen(&g_aux_in_file, path, "rb");
+}
+
+void emu_aux_set_output_file(const char* path) {
+    reopen(&g_aux_out_file, path, "ab");
+}
+
+int emu_aux_in() {
+    if (!g_aux_in_file) return 0x1A;  // ^Z (EOF)
+    int ch = fgetc(g_aux_in_file);
+    return ch == EOF ? 0x1A : ch;
+}
+
+void emu_aux_out(uint8_t ch) {
+    if (g_aux_out_file) fputc(ch, g_aux_out_file);
+}
+
+//=============================================================================
+// Debug/Log Output Implementation
+//=============================================================================
+
+// Log lines go to stderr so they never mix with console output on stdout
+static void log_line(const char* prefix, const char* fmt, va_list args) {
+    fputs(prefix, stderr);
+    vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+}
+
+void emu_set_debug(bool enable) {
+    g_debug_enabled = enable;
+}
+
+void emu_log(const char* fmt, ...) {
+    if (!g_debug_enabled) return;
+    va_list args;
+    va_start(args, fmt);
+    log_line("[debug] ", fmt, args);
+    va_end(args);
+}
+
+void emu_error(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    log_line("[error] ", fmt, args);
+    va_end(args);
+}
+
+[[noreturn]] void emu_fatal(const char* fmt, ...) {
+    host_io_restore_terminal();
+    va_list args;
+    va_start(args, fmt);
+    log_line("*** FATAL ERROR *** ", fmt, args);
+    va_end(args);
+    abort();
+}
+
+void emu_status(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    log_line("", fmt, args);
+    va_end(args);
+}
+
+//=============================================================================
+// File I/O Implementation
+//=============================================================================
+
+bool emu_file_load(const std::string& path, std::vector<uint8_t>& data) {
+    data.clear();
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    uint8_t block[65536];
+    size_t n;
+    while ((n = fread(block, 1, sizeof(block), f)) > 0) {
+        data.insert(data.end(), block, block + n);
+    }
+    fclose(f);
+    return true;
+}
+
+size_t emu_file_load_to_mem(const std::string& path, uint8_t* mem,
+                            size_t mem_size, size_t offset) {
+    if (offset >= mem_size) return 0;
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return 0;
+    size_t n = fread(mem + offset, 1, mem_size - offset, f);
+    fclose(f);
+    return n;
+}
+
+bool emu_file_save(const std::string& path, const std::vector<uint8_t>& data) {
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    return fclose(f) == 0 && ok;
+}
+
+bool emu_file_exists(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+size_t emu_file_size(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return 0;
+    return static_cast<size_t>(st.st_size);
+}
+
+//=============================================================================
+// Disk Image I/O (memory-mapped, see disk_image.h)
+//=============================================================================
+
+// Images the front end opened first (e.g. copy-on-write scratch mounts) are
+// already registered with their mode; anything else is mapped according to
+// the fopen mode.
+emu_disk_handle emu_disk_open(const std::string& path, const char* mode) {
+    bool writable = mode && (strchr(mode, '+') || strchr(mode, 'w'));
+    return disk_image_open(path, writable ? DISK_MAP_SHARED : DISK_MAP_READONLY);
+}
+
+void emu_disk_close(emu_disk_handle handle) {
+    disk_image_release(static_cast<disk_image*>(handle));
+}
+
+size_t emu_disk_read(emu_disk_handle handle, size_t offset,
+                     uint8_t* buffer, size_t count) {
+    return disk_image_read(static_cast<disk_image*>(handle), offset, buffer, count);
+}
+
+size_t emu_disk_write(emu_disk_handle handle, size_t offset,
+                      const uint8_t* buffer, size_t count) {
+    disk_image* image = static_cast<disk_image*>(handle);
+    size_t written = disk_image_write(image, offset, buffer, count);
+    if (written && image->journal) {
+        disk_journal_append(image->journal, offset, buffer, written);
+    }
+    return written;
+}
+
+void emu_disk_flush(emu_disk_handle handle) {
+    disk_image_flush(static_cast<disk_image*>(handle));
+}
+
+void emu_disk_flush_all() {
+    disk_image_flush_all();
+}
+
+size_t emu_disk_size(emu_disk_handle handle) {
+    if (!handle) return 0;
+    return static_cast<disk_image*>(handle)->size;
+}
+
+//=============================================================================
+// Time Implementation
+//=============================================================================
+
+void emu_get_time(emu_time* t) {
+    time_t now = time(nullptr);
+    struct tm tm;
+    localtime_r(&now, &tm);
+
+    t->year = tm.tm_year + 1900;
+    t->month = tm.tm_mon + 1;
+    t->day = tm.tm_mday;
+    t->hour = tm.tm_hour;
+    t->minute = tm.tm_min;
+    t->second = tm.tm_sec;
+    t->weekday = tm.tm_wday;
+}
+
+//=============================================================================
+// Random Numbers Implementation
+//=============================================================================
+
+unsigned int emu_random(unsigned int min, unsigned int max) {
+    if (min >= max) return min;
+    std::uniform_int_distribution<unsigned int> dist(min, max);
+    return dist(g_rng);
+}
+
+//=============================================================================
+// Video/Display Implementation
+//=============================================================================
+
+void emu_video_get_caps(emu_video_caps* caps) {
+    caps->has_text_display = true;
+    caps->has_pixel_display = false;
+    caps->has_dsky = false;
+    caps->text_rows = 25;
+    caps->text_cols = 80;
+    caps->pixel_width = 0;
+    caps->pixel_height = 0;
+}
+
+void emu_video_clear() {
+    g_cursor_row = 0;
+    g_cursor_col = 0;
+    static const uint8_t clear_seq[] = {0x1B, '[', '2', 'J', 0x1B, '[', 'H'};
+    console_write_bytes(clear_seq, sizeof(clear_seq));
+}
+
+void emu_video_set_cursor(int row, int col) {
+    g_cursor_row = row;
+    g_cursor_col = col;
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "\x1B[%d;%dH", row + 1, col + 1);
+    if (len > 0 && static_cast<size_t>(len) < sizeof(buf)) {
+        console_write_bytes(reinterpret_cast<const uint8_t*>(buf), static_cast<size_t>(len));
+    }
+}
+
+void emu_video_get_cursor(int* row, int* col) {
+    *row = g_cursor_row;
+    *col = g_cursor_col;
+}
+
+void emu_video_write_char(uint8_t ch) {
+    emu_console_write_char(ch);
+    g_cursor_col++;
+}
+
+void emu_video_write_char_at(int row, int col, uint8_t ch) {
+    emu_video_set_cursor(row, col);
+    emu_video_write_char(ch);
+}
+
+void emu_video_scroll_up(int lines) {
+    (void)lines;
+    // The host terminal scrolls by itself
+}
+
+void emu_video_set_attr(uint8_t attr) {
+    g_text_attr = attr;
+}
+
+uint8_t emu_video_get_attr() {
+    return g_text_attr;
+}
+
+// Dazzler operations (not emulated)
+extern "C" {
+uint8_t dazzler_port_in(uint8_t port) {
+    (void)port;
+    return 0;
+}
+
+void dazzler_port_out(uint8_t port, uint8_t value) {
+    (void)port;
+    (void)value;
+}
+}
+
+// DSKY operations (not emulated)
+void emu_dsky_show_hex(uint8_t position, uint8_t value) {
+    (void)position;
+    (void)value;
+}
+
+void emu_dsky_show_segments(uint8_t position, uint8_t segments) {
+    (void)position;
+    (void)segments;
+}
+
+void emu_dsky_set_leds(uint8_t leds) {
+    (void)leds;
+}
+
+void emu_dsky_beep(int duration_ms) {
+    (void)duration_ms;
+}
+
+int emu_dsky_get_key() {
+    return -1;
+}
+
+//=============================================================================
+// Host File Transfer Implementation
+//=============================================================================
+
+// R8/W8 read and write files in the current directory directly; there is no
+// UI step in between
+
+emu_host_file_state emu_host_file_get_state() {
+    return g_host_file_state;
+}
+
+bool emu_host_file_open_read(const char* filename) {
+    g_host_read_pos = 0;
+    g_host_read_filename = filename ? filename : "";
+    if (!emu_file_load(g_host_read_filename, g_host_read_buffer)) {
+        emu_error("R8: cannot read %s", g_host_read_filename.c_str());
+        g_host_file_state = HOST_FILE_IDLE;
+        return false;
+    }
+    g_host_file_state = HOST_FILE_READING;
+    return true;
+}
+
+bool emu_host_file_open_write(const char* filename) {
+    g_host_write_buffer.clear();
+    g_host_write_filename = filename ? filename : "download.bin";
+    g_host_file_state = HOST_FILE_WRITING;
+    return true;
+}
+
+int emu_host_file_read_byte() {
+    if (g_host_file_state != HOST_FILE_READING) return -1;
+    if (g_host_read_pos >= g_host_read_buffer.size()) return -1;
+    return g_host_read_buffer[g_host_read_pos++];
+}
+
+bool emu_host_file_write_byte(uint8_t byte) {
+    if (g_host_file_state != HOST_FILE_WRITING) return false;
+    g_host_write_buffer.push_back(byte);
+    return true;
+}
+
+void emu_host_file_close_read() {
+    g_host_read_buffer.clear();
+    g_host_read_pos = 0;
+    g_host_file_state = HOST_FILE_IDLE;
+}
+
+void emu_host_file_close_write() {
+    if (g_host_file_state == HOST_FILE_WRITING &&
+        !emu_file_save(g_host_write_filename, g_host_write_buffer)) {
+        emu_error("W8: cannot write %s", g_host_write_filename.c_str());
+    }
+    emu_host_file_write_done();
+}
+
+void emu_host_file_write_done() {
+    g_host_write_buffer.clear();
+    g_host_write_filename.clear();
+    g_host_file_state = HOST_FILE_IDLE;
+}
+
+void emu_host_file_cancel() {
+    g_host_file_state = HOST_FILE_IDLE;
+    g_host_read_buffer.clear();
+    g_host_read_pos = 0;
+    g_host_write_buffer.clear();
+    g_host_write_filename.clear();
+}
+
+const char* emu_host_file_get_read_name() {
+    return g_host_read_filename.c_str();
+}
+
+void emu_host_file_provide_data(const uint8_t* data, size_t size) {
+    g_host_read_buffer.assign(data, data + size);
+    g_host_read_pos = 0;
+    g_host_file_state = HOST_FILE_READING;
+}
+
+const uint8_t* emu_host_file_get_write_data() {
+    return g_host_write_buffer.empty() ? nullptr : g_host_write_buffer.data();
+}
+
+size_t emu_host_file_get_write_size() {
+    return g_host_write_buffer.size();
+}
+
+const char* emu_host_file_get_write_name() {
+    return g_host_write_filename.c_str();
+}
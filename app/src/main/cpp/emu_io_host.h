@@ -0,0 +1,52 @@
+/*
+ * Emulator I/O - Host (Linux) Front-End Hooks
+ *
+ * Extra entry points of emu_io_host.cpp for host programs (the console
+ * front end, benchmarks). The emu_io functions themselves are declared in
+ * emu_io.h.
+ */
+
+#ifndef EMU_IO_HOST_H
+#define EMU_IO_HOST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class HBIOSDispatch;
+
+// HBIOS whose queued console output is written in order with direct
+// console writes. Pass nullptr before destroying it.
+void host_io_attach(HBIOSDispatch* hbios);
+
+// Read console input from stdin (default true). Off, only queued input
+// (emu_console_queue_char, host_io_queue_input) is seen.
+void host_io_use_stdin(bool enable);
+
+// Put a terminal on stdin into raw mode until host_io_restore_terminal or
+// exit. No-op when stdin isn't a terminal.
+void host_io_raw_terminal();
+void host_io_restore_terminal();
+
+// Queue bytes as console input, LF translated to CR
+void host_io_queue_input(const uint8_t* data, size_t count);
+
+// Wait up to timeout_ms for stdin input. True if input is queued.
+bool host_io_wait_input(int timeout_ms);
+
+// True once stdin is closed (or unused) and all queued input is consumed
+bool host_io_input_exhausted();
+
+// True once the user typed the host exit key (Ctrl-]) on the terminal
+bool host_io_exit_requested();
+
+// Console output: write to stdout (default), or discard but count and
+// keep the last few hundred bytes (for matching prompts)
+void host_io_discard_output(bool discard);
+uint64_t host_io_output_bytes();
+std::string host_io_output_tail();
+
+// Write buffered console output to stdout
+void host_io_flush();
+
+#endif // EMU_IO_HOST_H
@@ -0,0 +1,251 @@
+/*
+ * Emulated Machine
+ */
+
+#include "emu_machine.h"
+#include "emu_io.h"
+#include "emu_init.h"
+#include "z80_timing.h"
+
+#include <cstdarg>
+#include <cstdio>
+
+std::atomic<uint32_t> g_exit_request{0};
+
+//=============================================================================
+// Delegate
+//=============================================================================
+
+void MachineDelegate::initializeRamBankIfNeeded(uint8_t bank) {
+    // Use HBIOSDispatch's shared bitmap
+    uint16_t* bitmap = hbios->getInitializedBanksBitmap();
+    if (bitmap) {
+        emu_init_ram_bank(memory, bank, bitmap);
+    }
+}
+
+void MachineDelegate::onHalt() {
+    emu_error("CPU HALT");
+    request_exit(EXIT_HALT);
+}
+
+void MachineDelegate::onUnimplementedOpcode(uint8_t opcode, uint16_t pc) {
+    emu_error("Unimplemented opcode 0x%02X at PC=0x%04X", opcode, pc);
+}
+
+void MachineDelegate::logDebug(const char* fmt, ...) {
+    if (trace) {
+        trace->note(fmt);
+    } else if (debug) {
+        char buf[1024];
+        va_list args;
+        va_start(args, fmt);
+        vsnprintf(buf, sizeof(buf), fmt, args);
+        va_end(args);
+        emu_log("%s", buf);
+    }
+}
+
+//=============================================================================
+// Emulator State
+//=============================================================================
+
+EmulatorState::EmulatorState(bool blocking) {
+    emu_log("EmulatorState: Creating new instance");
+    memory = new paged_mem();
+    hbios = new HBIOSDispatch();
+    delegate = new MachineDelegate(memory, hbios);
+    cpu = new hbios_cpu(memory, delegate);
+    hbios->setCPU(cpu);
+    hbios->setMemory(memory);
+    hbios->setBlockingAllowed(blocking);
+}
+
+void EmulatorState::set_trace(TraceRing* ring) {
+    trace = ring;
+    delegate->setTrace(ring);
+}
+
+EmulatorState::~EmulatorState() {
+    emu_log("EmulatorState: Destroying instance");
+    delete cpu;
+    delete delegate;
+    delete hbios;
+    delete memory;
+}
+
+//=============================================================================
+// Run Loop
+//=============================================================================
+
+// Slow path once an exit request is raised. Returns true if execution
+// must stop.
+static bool handle_exit_request(EmulatorState* emu) {
+    uint32_t reasons = g_exit_request.exchange(0, std::memory_order_acquire);
+    if (reasons & EXIT_STOP) {
+        return true;
+    }
+    bool stop = (reasons & (EXIT_HALT | EXIT_RESET | EXIT_OUTPUT_FULL)) != 0;
+    // Check if CPU is now waiting for input
+    if ((reasons & EXIT_INPUT_POLL) && emu->hbios->isWaitingForInput()) {
+        stop = true;  // Stop executing until input is provided
+    }
+    if (emu->hbios->getState() == HBIOS_HALTED) {
+        stop = true;
+    }
+    return stop;
+}
+
+static inline z80_timing decode_word(uint32_t word) {
+    uint8_t op[4] = {static_cast<uint8_t>(word), static_cast<uint8_t>(word >> 8),
+                     static_cast<uint8_t>(word >> 16), static_cast<uint8_t>(word >> 24)};
+    return z80_decode_timing(op);
+}
+
+// Per-instruction hooks for run_loop. before() runs ahead of each
+// instruction and after() once it has executed; the loop also ends when
+// done() is true. The empty policy leaves the plain loop with nothing but
+// execute and the exit check.
+struct plain_hooks {
+    void before(hbios_cpu*) {}
+    void after(hbios_cpu*) {}
+    bool done() const { return false; }
+};
+
+// PC sampling and HBIOS call counts. Only used with an enabled pc_sampler.
+struct sample_hooks {
+    paged_mem* mem;
+    PcSampler* sampler;
+    uint32_t interval;
+    bool count_hbios;
+
+    explicit sample_hooks(EmulatorState* emu)
+        : mem(emu->memory), sampler(emu->pc_sampler),
+          interval(sampler ? sampler->interval() : 0),
+          count_hbios(sampler && sampler->counting_hbios()) {}
+
+    void before(hbios_cpu* cpu) {
+        uint16_t pc = cpu->regs.PC.get_pair16();
+        if (count_hbios && pc == HBIOS_ENTRY) {
+            sampler->hbios_call(static_cast<uint8_t>(cpu->regs.BC.get_pair16() >> 8));
+        }
+        if (++sampler->ticks >= interval) {
+            sampler->ticks = 0;
+            sampler->sample(mem->physical(pc));
+        }
+    }
+    void after(hbios_cpu*) {}
+    bool done() const { return false; }
+};
+
+// Instructions, HBIOS calls and returns, and port accesses into the trace ring
+struct trace_hooks {
+    paged_mem* mem;
+    TraceRing* trace;
+    uint16_t pc = 0;
+    uint8_t bank = 0;
+    uint32_t word = 0;
+
+    explicit trace_hooks(EmulatorState* emu) : mem(emu->memory), trace(emu->trace) {}
+
+    void before(hbios_cpu* cpu) {
+        uint16_t at = cpu->regs.PC.get_pair16();
+        uint32_t phys;
+        record(cpu, at, mem->fetch_word(at, &phys));
+    }
+    // before() for an instruction already fetched
+    void record(hbios_cpu* cpu, uint16_t at, uint32_t bytes) {
+        pc = at;
+        bank = mem->get_current_bank();
+        word = bytes;
+        trace->record(pc == HBIOS_ENTRY ? TRACE_HBIOS_CALL : TRACE_INSN, bank, pc, word, cpu->regs);
+    }
+    void after(hbios_cpu* cpu) {
+        if (pc == HBIOS_ENTRY) {
+            trace->record(TRACE_HBIOS_RETURN, mem->get_current_bank(), cpu->regs.PC.get_pair16(),
+                          0, cpu->regs);
+        } else if (z80_is_port_io(word)) {
+            trace->record(TRACE_PORT, bank, pc, word, cpu->regs);
+        }
+    }
+    bool done() const { return false; }
+};
+
+// T-state accounting up to a goal for the throttled clock, still sampling
+// or tracing when those are on
+struct timed_hooks {
+    paged_mem* mem;
+    uint64_t* tstates;
+    uint64_t goal;
+    sample_hooks* sampler;  // Optional
+    trace_hooks* trace;     // Optional
+    uint16_t pc = 0;
+    z80_timing timing = {};
+
+    timed_hooks(EmulatorState* emu, uint64_t* count, uint64_t tstate_goal, sample_hooks* s,
+                trace_hooks* t)
+        : mem(emu->memory), tstates(count), goal(tstate_goal), sampler(s), trace(t) {}
+
+    void before(hbios_cpu* cpu) {
+        pc = cpu->regs.PC.get_pair16();
+        uint32_t phys;
+        uint32_t word = mem->fetch_word(pc, &phys);
+        timing = decode_word(word);
+        if (sampler) sampler->before(cpu);
+        if (trace) trace->record(cpu, pc, word);
+    }
+    void after(hbios_cpu* cpu) {
+        if (trace) trace->after(cpu);
+        *tstates += timing.tstates;
+        if (timing.taken_extra &&
+            cpu->regs.PC.get_pair16() != static_cast<uint16_t>(pc + timing.length)) {
+            *tstates += timing.taken_extra;
+        }
+    }
+    bool done() const { return *tstates >= goal; }
+};
+
+template <class Hooks>
+static int64_t run_loop(EmulatorState* emu, int64_t max_instructions, bool* stopped,
+                        Hooks& hooks) {
+    hbios_cpu* cpu = emu->cpu;
+    int64_t i = 0;
+    while (i < max_instructions && !hooks.done()) {
+        hooks.before(cpu);
+        cpu->execute();
+        i++;
+        hooks.after(cpu);
+        if (g_exit_request.load(std::memory_order_relaxed) != 0 && handle_exit_request(emu)) {
+            *stopped = true;
+            return i;
+        }
+    }
+    // Catch a HALT entered without an exit request
+    *stopped = emu->hbios->getState() == HBIOS_HALTED;
+    return i;
+}
+
+int64_t emu_run_instructions(EmulatorState* emu, int64_t max_instructions, bool* stopped) {
+    *stopped = false;
+    if (emu->trace) {
+        trace_hooks hooks(emu);
+        return run_loop(emu, max_instructions, stopped, hooks);
+    }
+    if (emu->pc_sampler && emu->pc_sampler->enabled()) {
+        sample_hooks hooks(emu);
+        return run_loop(emu, max_instructions, stopped, hooks);
+    }
+    plain_hooks hooks;
+    return run_loop(emu, max_instructions, stopped, hooks);
+}
+
+int64_t emu_run_timed(EmulatorState* emu, int64_t max_instructions,
+                      uint64_t* tstates, uint64_t tstate_goal, bool* stopped) {
+    *stopped = false;
+    sample_hooks sampler(emu);
+    trace_hooks trace(emu);
+    timed_hooks hooks(emu, tstates, tstate_goal,
+                      emu->pc_sampler && emu->pc_sampler->enabled() ? &sampler : nullptr,
+                      emu->trace ? &trace : nullptr);
+    return run_loop(emu, max_instructions, stopped, hooks);
+}
@@ -0,0 +1,114 @@
+/*
+ * Emulated Machine
+ *
+ * The RomWBW machine shared by the Android bridge (emu_io_android.cpp) and
+ * the host build (emu_io_host.cpp): banked memory, HBIOS dispatcher and
+ * CPU, the inner run loop, and the exit-request word that ends it early.
+ * Front ends supply the emu_io implementation and decide when to run,
+ * how to pace and where console output goes.
+ */
+
+#ifndef EMU_MACHINE_H
+#define EMU_MACHINE_H
+
+#include <atomic>
+#include <cstdint>
+
+#include "hbios_cpu.h"
+#include "hbios_dispatch.h"
+#include "pc_profile.h"
+#include "trace_ring.h"
+#include "paged_mem.h"
+
+//=============================================================================
+// Run Loop Exit Requests
+//=============================================================================
+
+// Reasons for the run loop to return early. The loop tests the whole word
+// with a single load per instruction and only decodes it when non-zero.
+enum : uint32_t {
+    EXIT_STOP       = 1u << 0,  // Front end stop / reset / destroy
+    EXIT_HALT       = 1u << 1,  // CPU executed HALT
+    EXIT_RESET      = 1u << 2,  // SYSRESET restarted the CPU
+    EXIT_INPUT_POLL = 1u << 3,  // Guest polled console input with nothing queued
+    EXIT_OUTPUT_FULL = 1u << 4, // Console output needs showing before more is taken
+};
+extern std::atomic<uint32_t> g_exit_request;
+
+static inline void request_exit(uint32_t reason) {
+    g_exit_request.fetch_or(reason, std::memory_order_release);
+}
+
+// HB_INVOKE: HBIOS entry in the common bank, function code in B
+static const uint16_t HBIOS_ENTRY = 0xFFF0;
+
+//=============================================================================
+// Machine
+//=============================================================================
+
+class MachineDelegate : public HBIOSCPUDelegate {
+private:
+    banked_mem* memory;
+    HBIOSDispatch* hbios;
+    bool debug;
+    TraceRing* trace;
+
+public:
+    MachineDelegate(banked_mem* mem, HBIOSDispatch* hb)
+        : memory(mem), hbios(hb), debug(false), trace(nullptr) {}
+
+    banked_mem* getMemory() override { return memory; }
+    HBIOSDispatch* getHBIOS() override { return hbios; }
+
+    void initializeRamBankIfNeeded(uint8_t bank) override;
+    void onHalt() override;
+    void onUnimplementedOpcode(uint8_t opcode, uint16_t pc) override;
+    void logDebug(const char* fmt, ...) override;
+
+    void setDebug(bool d) { debug = d; }
+
+    // While set, debug messages go to the trace ring unformatted instead
+    // of the log
+    void setTrace(TraceRing* t) { trace = t; }
+};
+
+// Encapsulates all emulator state for clean reboot
+class EmulatorState {
+public:
+    paged_mem* memory = nullptr;
+    hbios_cpu* cpu = nullptr;
+    HBIOSDispatch* hbios = nullptr;
+    MachineDelegate* delegate = nullptr;
+    PcSampler* pc_sampler = nullptr;  // Optional, used while enabled
+    TraceRing* trace = nullptr;       // Optional, see set_trace
+
+    // blocking: whether HBIOS may block the CPU thread waiting for input
+    explicit EmulatorState(bool blocking);
+
+    // Record execution into ring (nullptr to stop). Takes priority over
+    // the profilers while set.
+    void set_trace(TraceRing* ring);
+    ~EmulatorState();
+
+    // Non-copyable
+    EmulatorState(const EmulatorState&) = delete;
+    EmulatorState& operator=(const EmulatorState&) = delete;
+};
+
+//=============================================================================
+// Run Loop
+//=============================================================================
+
+// Execute up to max_instructions. Returns the number executed and sets
+// *stopped if execution ended early (input wait, HALT, reset or an
+// EXIT_STOP request). With a trace set, every instruction is recorded;
+// else with an enabled pc_sampler, the PC is sampled.
+int64_t emu_run_instructions(EmulatorState* emu, int64_t max_instructions, bool* stopped);
+
+// As emu_run_instructions, but accounts T-states into *tstates and also
+// stops once tstate_goal is reached. Used when the clock is throttled.
+// Samples and traces too.
+int64_t emu_run_timed(EmulatorState* emu, int64_t max_instructions,
+                      uint64_t* tstates, uint64_t tstate_goal, bool* stopped);
+
+#endif // EMU_MACHINE_H
@@ -0,0 +1,73 @@
+/*
+ * Host Machine Setup
+ */
+
+#include "host_machine.h"
+#include "emu_io.h"
+#include "emu_io_host.h"
+#include "emu_init.h"
+#include "disk_image.h"
+
+HostMachine::HostMachine() {
+    emu = new EmulatorState(false);
+    host_io_attach(emu->hbios);
+}
+
+HostMachine::~HostMachine() {
+    disk_image_flush_all();
+    host_io_attach(nullptr);
+    delete emu;
+    for (disk_image* image : scratch_) {
+        disk_image_release(image);
+    }
+}
+
+bool HostMachine::boot(const host_machine_config& config) {
+    std::vector<uint8_t> rom;
+    if (!emu_file_load(config.rom, rom)) {
+        emu_error("Cannot read ROM %s", config.rom.c_str());
+        return false;
+    }
+    if (!emu_load_rom_from_buffer(emu->memory, rom.data(), rom.size())) {
+        emu_error("Failed to load ROM %s", config.rom.c_str());
+        return false;
+    }
+
+    int slices = config.slices;
+    if (slices <= 0) {
+        slices = config.disks.size() <= 1 ? 8 : config.disks.size() == 2 ? 4 : 2;
+    }
+    for (const auto& disk : config.disks) {
+        // Registered copy-on-write first, so HBIOS's own open of the same
+        // path gets this mapping
+        if (config.scratch) {
+            disk_image* image = disk_image_open(disk.second, DISK_MAP_PRIVATE);
+            if (image) scratch_.push_back(image);
+        }
+        if (!emu->hbios->loadDisk(static_cast<uint8_t>(disk.first), disk.second)) {
+            emu_error("Failed to mount %s on unit %d", disk.second.c_str(), disk.first);
+            return false;
+        }
+        emu->hbios->setDiskSliceCount(disk.first, slices);
+    }
+
+    int disk_slices[16];
+    for (int i = 0; i < 16; i++) {
+        disk_slices[i] = emu->hbios->getDisk(i).max_slices;
+    }
+    emu_complete_init(emu->memory, emu->hbios, disk_slices);
+
+    // SYSRESET (ROM reboot command)
+    EmulatorState* machine = emu;
+    emu->hbios->setResetCallback([machine](uint8_t reset_type) {
+        emu_status("[SYSRESET] %s boot - restarting", reset_type == 0x01 ? "Warm" : "Cold");
+        machine->memory->select_bank(0x00);
+        machine->cpu->regs.PC.set_pair16(0x0000);
+        request_exit(EXIT_RESET);
+    });
+
+    emu->cpu->set_cpu_mode(qkz80::MODE_Z80);
+    emu->cpu->regs.PC.set_pair16(0x0000);
+    emu->cpu->regs.SP.set_pair16(0x0000);
+    return true;
+}
@@ -0,0 +1,46 @@
+/*
+ * Host Machine Setup
+ *
+ * Boots an EmulatorState on the host the way the app does across
+ * nativeLoadRom, nativeOpenDisk and nativeCompleteInit: load the ROM,
+ * mount disk images, build the drive map and point the CPU at the reset
+ * vector. Shared by the host console front end and the benchmarks.
+ */
+
+#ifndef HOST_MACHINE_H
+#define HOST_MACHINE_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "emu_machine.h"
+
+struct disk_image;
+
+struct host_machine_config {
+    std::string rom;
+    std::vector<std::pair<int, std::string>> disks;  // Unit, image path
+    int slices = 0;        // Per disk; 0 = as the app does: 8, 4 or 2 by disk count
+    bool scratch = false;  // Copy-on-write mounts: writes stay in memory
+};
+
+class HostMachine {
+public:
+    EmulatorState* emu = nullptr;
+
+    HostMachine();
+    ~HostMachine();
+
+    HostMachine(const HostMachine&) = delete;
+    HostMachine& operator=(const HostMachine&) = delete;
+
+    // Load, mount and initialize. Errors are logged; false leaves the
+    // machine unusable.
+    bool boot(const host_machine_config& config);
+
+private:
+    std::vector<disk_image*> scratch_;
+};
+
+#endif // HOST_MACHINE_H
@@ -0,0 +1,13 @@
+/*
+ * Paged Banked Memory
+ */
+
+#include "paged_mem.h"
+
+paged_mem::paged_mem() : rom_(get_rom()), ram_(get_ram()) {
+}
+
+uint8_t* paged_mem::page(size_t index) {
+    size_t offset = index * PAGE_SIZE;
+    return offset < ROM_SIZE ? get_rom() + offset : get_ram() + (offset - ROM_SIZE);
+}
@@ -0,0 +1,77 @@
+/*
+ * Paged Banked Memory
+ *
+ * banked_mem with access by 4KB physical page, which the checkpointer
+ * compares and copies.
+ *
+ * It also resolves CPU addresses to physical offsets, which the run loop
+ * reads instruction bytes through and the profilers key samples by.
+ *
+ * Physical pages cover ROM first, then RAM. Bank 0x00-0x0F selects a ROM
+ * bank and 0x80-0x8F a RAM bank for the lower 32KB; the upper 32KB is the
+ * common RAM bank.
+ */
+
+#ifndef PAGED_MEM_H
+#define PAGED_MEM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "romwbw_mem.h"
+
+class paged_mem : public banked_mem {
+public:
+    static const size_t PAGE_SIZE = 4096;
+    static const size_t ROM_SIZE = 512 * 1024;
+    static const size_t RAM_SIZE = 512 * 1024;
+    static const size_t PAGE_COUNT = (ROM_SIZE + RAM_SIZE) / PAGE_SIZE;
+    static const size_t FIRST_RAM_PAGE = ROM_SIZE / PAGE_SIZE;
+
+    paged_mem();
+
+    // Physical page contents: ROM pages, then RAM pages
+    uint8_t* page(size_t index);
+
+    // Physical offset (ROM, then RAM) of CPU address addr in the current
+    // mapping. Addresses in the same 32KB half are contiguous.
+    uint32_t physical(qkz80_uint16 addr) const {
+        if (addr & 0x8000) return ROM_SIZE + COMMON_BANK * BANK_SIZE + (addr & 0x7FFF);
+        uint8_t bank = get_current_bank();
+        return ((bank & 0x80) ? ROM_SIZE : 0) + (bank & 0x0F) * BANK_SIZE + addr;
+    }
+
+    // Host pointer for a physical offset
+    const uint8_t* physical_ptr(uint32_t phys) const {
+        return phys < ROM_SIZE ? rom_ + phys : ram_ + (phys - ROM_SIZE);
+    }
+
+    // First 4 bytes at pc, little-endian, with pc's physical offset in
+    // *phys. Read straight from physical memory; bytes crossing the
+    // banked/common boundary (or wrapping) are not contiguous there and go
+    // through fetch_mem.
+    uint32_t fetch_word(qkz80_uint16 pc, uint32_t* phys) {
+        *phys = physical(pc);
+        uint32_t word;
+        if ((pc & 0x7FFF) <= 0x7FFC) {
+            // Little-endian word, as on all Android ABIs
+            memcpy(&word, physical_ptr(*phys), sizeof(word));
+            return word;
+        }
+        word = 0;
+        for (int k = 0; k < 4; k++) {
+            word |= static_cast<uint32_t>(fetch_mem(static_cast<qkz80_uint16>(pc + k))) << (k * 8);
+        }
+        return word;
+    }
+
+private:
+    static const size_t BANK_SIZE = 32 * 1024;
+    static const uint8_t COMMON_BANK = 0x0F;
+
+    const uint8_t* rom_;
+    const uint8_t* ram_;
+};
+
+#endif // PAGED_MEM_H
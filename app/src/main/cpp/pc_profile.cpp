@@ -0,0 +1,315 @@
+/*
+ * Sampling PC Profiler
+ */
+
+#include "pc_profile.h"
+#include "emu_io.h"
+#include "paged_mem.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+static const uint32_t BANK_SIZE = 32 * 1024;
+
+// RomWBW user (TPA) bank on 512KB systems; the common bank is 0x8F
+static const uint8_t TPA_BANK = 0x8E;
+static const uint8_t COMMON_BANK = 0x8F;
+
+// HBIOS proxy and data at the top of common RAM
+static const uint16_t HBIOS_PROXY = 0xFE00;
+
+// Addresses further than this past the nearest label are left unnamed
+static const uint32_t MAX_SYMBOL_SPAN = 0x400;
+
+void PcSampler::start(uint32_t interval, bool count_hbios) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    samples_.clear();
+    sample_count_ = 0;
+    memset(hbios_, 0, sizeof(hbios_));
+    interval_.store(interval ? interval : DEFAULT_INTERVAL, std::memory_order_relaxed);
+    count_hbios_.store(count_hbios, std::memory_order_relaxed);
+    enabled_.store(true, std::memory_order_relaxed);
+}
+
+void PcSampler::sample(uint32_t phys) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    samples_[phys]++;
+    sample_count_++;
+}
+
+void PcSampler::hbios_call(uint8_t function) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    hbios_[function]++;
+}
+
+//=============================================================================
+// Symbols
+//=============================================================================
+
+// 4 hex digits, optionally followed by an M80 relocation mark (' or ")
+static bool parse_address(std::string token, uint16_t* addr) {
+    if (!token.empty() && (token.back() == '\'' || token.back() == '"')) token.pop_back();
+    if (token.size() != 4) return false;
+    for (char c : token) {
+        if (!isxdigit(static_cast<unsigned char>(c))) return false;
+    }
+    *addr = static_cast<uint16_t>(strtoul(token.c_str(), nullptr, 16));
+    return true;
+}
+
+int PcSampler::load_symbols(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        emu_error("Cannot read symbols %s", path.c_str());
+        return -1;
+    }
+    std::string ext = path.size() >= 4 ? path.substr(path.size() - 4) : "";
+    for (char& c : ext) c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+    bool listing = ext == ".PRN" || ext == ".LST";
+
+    std::vector<std::pair<uint16_t, std::string>> symbols;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream tokens(line);
+        std::vector<std::string> words;
+        std::string word;
+        while (tokens >> word) words.push_back(word);
+
+        uint16_t addr;
+        if (listing) {
+            // First address on the line, first "LABEL:" after it
+            size_t i = 0;
+            while (i < words.size() && !parse_address(words[i], &addr)) i++;
+            for (i++; i < words.size(); i++) {
+                const std::string& w = words[i];
+                if (w.size() > 1 && w.back() == ':') {
+                    size_t colons = w[w.size() - 2] == ':' ? 2 : 1;  // LABEL:: is public
+                    symbols.emplace_back(addr, w.substr(0, w.size() - colons));
+                    break;
+                }
+            }
+        } else {
+            for (size_t i = 0; i + 1 < words.size(); i += 2) {
+                if (parse_address(words[i], &addr)) symbols.emplace_back(addr, words[i + 1]);
+            }
+        }
+    }
+
+    std::stable_sort(symbols.begin(), symbols.end(),
+                     [](const std::pair<uint16_t, std::string>& a,
+                        const std::pair<uint16_t, std::string>& b) { return a.first < b.first; });
+    std::lock_guard<std::mutex> lock(mutex_);
+    symbols_.swap(symbols);
+    return static_cast<int>(symbols_.size());
+}
+
+// CPU address of a RAM physical address, as programs see it: the common
+// bank at 8000h, any other bank in the lower 32KB. 0x10000 for ROM.
+static uint32_t cpu_address(uint32_t phys) {
+    if (phys < paged_mem::ROM_SIZE) return 0x10000;
+    uint32_t offset = phys - static_cast<uint32_t>(paged_mem::ROM_SIZE);
+    uint8_t bank = 0x80 | (offset / BANK_SIZE);
+    return (bank == COMMON_BANK ? 0x8000 : 0) + offset % BANK_SIZE;
+}
+
+static uint8_t bank_of(uint32_t phys) {
+    if (phys < paged_mem::ROM_SIZE) return static_cast<uint8_t>(phys / BANK_SIZE);
+    return static_cast<uint8_t>(0x80 | ((phys - paged_mem::ROM_SIZE) / BANK_SIZE));
+}
+
+// Index of the last symbol at or below addr and within MAX_SYMBOL_SPAN,
+// or -1
+static int symbol_index(const std::vector<std::pair<uint16_t, std::string>>& symbols,
+                        uint32_t addr) {
+    if (addr > 0xFFFF) return -1;
+    auto it = std::upper_bound(symbols.begin(), symbols.end(), addr,
+                               [](uint32_t a, const std::pair<uint16_t, std::string>& s) {
+                                   return a < s.first;
+                               });
+    if (it == symbols.begin() || addr - (it - 1)->first > MAX_SYMBOL_SPAN) return -1;
+    return static_cast<int>(it - symbols.begin()) - 1;
+}
+
+std::string PcSampler::symbolize(uint32_t phys) const {
+    uint32_t addr = cpu_address(phys);
+    int i = symbol_index(symbols_, addr);
+    if (i < 0) return "";
+    char buf[80];
+    uint32_t delta = addr - symbols_[i].first;
+    if (delta) {
+        snprintf(buf, sizeof(buf), "%s+%u", symbols_[i].second.c_str(), delta);
+    } else {
+        snprintf(buf, sizeof(buf), "%s", symbols_[i].second.c_str());
+    }
+    return buf;
+}
+
+// Range a sample belongs to: the enclosing symbol when one is loaded,
+// else its 256-byte page
+std::string PcSampler::range_name(uint32_t phys, uint32_t* key) const {
+    char buf[80];
+    int i = symbol_index(symbols_, cpu_address(phys));
+    if (i >= 0) {
+        *key = 0x80000000u | static_cast<uint32_t>(i);
+        snprintf(buf, sizeof(buf), "%s", symbols_[i].second.c_str());
+    } else {
+        *key = phys & ~0xFFu;
+        snprintf(buf, sizeof(buf), "%s %02X:%04X-%04X", phys < paged_mem::ROM_SIZE ? "ROM" : "RAM",
+                 bank_of(phys), *key % BANK_SIZE, *key % BANK_SIZE + 0xFF);
+    }
+    return buf;
+}
+
+//=============================================================================
+// Report
+//=============================================================================
+
+const char* hbios_function_name(uint8_t function) {
+    switch (function) {
+        case 0x00: return "CIOIN";
+        case 0x01: return "CIOOUT";
+        case 0x02: return "CIOIST";
+        case 0x03: return "CIOOST";
+        case 0x04: return "CIOINIT";
+        case 0x05: return "CIOQUERY";
+        case 0x06: return "CIODEVICE";
+        case 0x10: return "DIOSTATUS";
+        case 0x11: return "DIORESET";
+        case 0x12: return "DIOSEEK";
+        case 0x13: return "DIOREAD";
+        case 0x14: return "DIOWRITE";
+        case 0x17: return "DIODEVICE";
+        case 0x18: return "DIOMEDIA";
+        case 0x1A: return "DIOCAP";
+        case 0x1B: return "DIOGEOM";
+        case 0x20: return "RTCGETTIM";
+        case 0x21: return "RTCSETTIM";
+        case 0xF0: return "SYSRESET";
+        case 0xF1: return "SYSVER";
+        case 0xF2: return "SYSSETBNK";
+        case 0xF3: return "SYSGETBNK";
+        case 0xF4: return "SYSSETCPY";
+        case 0xF5: return "SYSBNKCPY";
+        case 0xF8: return "SYSGET";
+        case 0xF9: return "SYSSET";
+        case 0xFA: return "SYSPEEK";
+        case 0xFB: return "SYSPOKE";
+        case 0xFC: return "SYSINT";
+        default: return "";
+    }
+}
+
+// CP/M layout from page zero of the TPA bank: JP BIOS+3 at 0000h and
+// JP BDOS at 0005h, with the CCP 800h below BDOS. Zero if not plausible.
+struct cpm_layout {
+    uint16_t ccp = 0;
+    uint16_t bdos = 0;
+    uint16_t bios = 0;
+};
+
+static cpm_layout find_layout(paged_mem* mem) {
+    cpm_layout layout;
+    if (!mem) return layout;
+    const uint8_t* zero = mem->physical_ptr(
+        static_cast<uint32_t>(paged_mem::ROM_SIZE) + (TPA_BANK & 0x0F) * BANK_SIZE);
+    if (zero[0] != 0xC3 || zero[5] != 0xC3) return layout;
+    uint16_t bios = static_cast<uint16_t>((zero[1] | zero[2] << 8) - 3);
+    uint16_t bdos = static_cast<uint16_t>((zero[6] | zero[7] << 8) & 0xFF00);
+    if (bdos < 0x0900 || bios <= bdos) return layout;
+    layout.ccp = static_cast<uint16_t>(bdos - 0x0800);
+    layout.bdos = bdos;
+    layout.bios = bios;
+    return layout;
+}
+
+static const char* region_of(uint32_t phys, const cpm_layout& layout) {
+    if (phys < paged_mem::ROM_SIZE) return "HBIOS (ROM)";
+    uint8_t bank = bank_of(phys);
+    if (bank != TPA_BANK && bank != COMMON_BANK) return "HBIOS (RAM bank)";
+    uint32_t addr = cpu_address(phys);
+    if (addr >= HBIOS_PROXY) return "HBIOS proxy";
+    if (addr < 0x0100) return "page zero";
+    if (layout.bios == 0) return "TPA/CP/M";
+    if (addr >= layout.bios) return "BIOS";
+    if (addr >= layout.bdos) return "BDOS";
+    if (addr >= layout.ccp) return "CCP";
+    return "TPA";
+}
+
+template <typename K>
+static std::vector<std::pair<K, uint64_t>> top_counts(const std::unordered_map<K, uint64_t>& map,
+                                                      size_t top) {
+    std::vector<std::pair<K, uint64_t>> items(map.begin(), map.end());
+    top = std::min(top, items.size());
+    std::partial_sort(items.begin(), items.begin() + top, items.end(),
+                      [](const std::pair<K, uint64_t>& a, const std::pair<K, uint64_t>& b) {
+                          return a.second > b.second;
+                      });
+    items.resize(top);
+    return items;
+}
+
+std::string PcSampler::report(size_t top, paged_mem* mem) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string out;
+    char line[160];
+    snprintf(line, sizeof(line), "PC profile: %llu samples, 1 per %u instructions\n",
+             static_cast<unsigned long long>(sample_count_), interval());
+    out += line;
+    double total = sample_count_ ? static_cast<double>(sample_count_) : 1.0;
+
+    cpm_layout layout = find_layout(mem);
+    std::unordered_map<std::string, uint64_t> regions;
+    std::unordered_map<uint32_t, uint64_t> ranges;
+    std::unordered_map<uint32_t, std::string> range_names;
+    for (const auto& s : samples_) {
+        regions[region_of(s.first, layout)] += s.second;
+        uint32_t key;
+        std::string name = range_name(s.first, &key);
+        ranges[key] += s.second;
+        range_names.emplace(key, name);
+    }
+
+    out += "\nRegions:\n";
+    for (const auto& r : top_counts(regions, regions.size())) {
+        snprintf(line, sizeof(line), "  %-18s %6.2f%% %10llu\n", r.first.c_str(),
+                 100.0 * r.second / total, static_cast<unsigned long long>(r.second));
+        out += line;
+    }
+
+    out += "\nTop addresses:\n";
+    for (const auto& a : top_counts(samples_, top)) {
+        snprintf(line, sizeof(line), "  %s %02X:%04X %-24s %6.2f%% %10llu\n",
+                 a.first < paged_mem::ROM_SIZE ? "ROM" : "RAM", bank_of(a.first),
+                 a.first % BANK_SIZE, symbolize(a.first).c_str(), 100.0 * a.second / total,
+                 static_cast<unsigned long long>(a.second));
+        out += line;
+    }
+
+    out += "\nTop ranges:\n";
+    for (const auto& r : top_counts(ranges, top)) {
+        snprintf(line, sizeof(line), "  %-28s %6.2f%% %10llu\n", range_names[r.first].c_str(),
+                 100.0 * r.second / total, static_cast<unsigned long long>(r.second));
+        out += line;
+    }
+
+    if (counting_hbios()) {
+        std::unordered_map<uint32_t, uint64_t> calls;
+        for (int f = 0; f < 256; f++) {
+            if (hbios_[f]) calls[f] = hbios_[f];
+        }
+        out += "\nHBIOS functions:\n";
+        for (const auto& c : top_counts(calls, calls.size())) {
+            snprintf(line, sizeof(line), "  %02X %-10s %12llu\n", c.first,
+                     hbios_function_name(static_cast<uint8_t>(c.first)),
+                     static_cast<unsigned long long>(c.second));
+            out += line;
+        }
+    }
+    return out;
+}
@@ -0,0 +1,75 @@
+/*
+ * Sampling PC Profiler
+ *
+ * Records the PC (with the bank mapped at the time) every N instructions,
+ * and optionally the function code of every HBIOS call, so a report can
+ * show whether time goes to the program, the CCP, BDOS, the BIOS or HBIOS.
+ * Addresses can be symbolized from an assembler .SYM or .PRN file.
+ *
+ * The run loop only looks at the profiler while it is enabled; stopped,
+ * it costs one load per run call. Start, stop and report may be called
+ * from any thread.
+ */
+
+#ifndef PC_PROFILE_H
+#define PC_PROFILE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class paged_mem;
+
+// Mnemonic of an HBIOS function code (CIOIN, DIOREAD, ...), "" if unknown
+const char* hbios_function_name(uint8_t function);
+
+class PcSampler {
+public:
+    static const uint32_t DEFAULT_INTERVAL = 1000;
+
+    // Discard earlier samples and sample every interval instructions
+    void start(uint32_t interval, bool count_hbios);
+    void stop() { enabled_.store(false, std::memory_order_relaxed); }
+
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+    bool counting_hbios() const { return count_hbios_.load(std::memory_order_relaxed); }
+    uint32_t interval() const { return interval_.load(std::memory_order_relaxed); }
+
+    // Run loop only: instructions since the last sample
+    uint32_t ticks = 0;
+
+    // Run loop: record one sample / one HBIOS call
+    void sample(uint32_t phys);
+    void hbios_call(uint8_t function);
+
+    // Load labels from an assembler symbol file (.SYM: "HHHH NAME" pairs)
+    // or listing (.PRN/.LST: address column plus "NAME:"). Replaces any
+    // earlier symbols. Returns the number loaded, or -1 if unreadable.
+    int load_symbols(const std::string& path);
+
+    // Text report: CP/M regions, the top hot addresses and ranges, and
+    // HBIOS functions. mem supplies page zero of the TPA bank to find the
+    // CCP, BDOS and BIOS.
+    std::string report(size_t top, paged_mem* mem);
+
+private:
+    std::string symbolize(uint32_t phys) const;
+    std::string range_name(uint32_t phys, uint32_t* key) const;
+
+    std::atomic<bool> enabled_{false};
+    std::atomic<bool> count_hbios_{false};
+    std::atomic<uint32_t> interval_{DEFAULT_INTERVAL};
+
+    mutable std::mutex mutex_;
+    std::unordered_map<uint32_t, uint64_t> samples_;  // Physical address -> count
+    uint64_t sample_count_ = 0;
+    uint64_t hbios_[256] = {};
+    std::vector<std::pair<uint16_t, std::string>> symbols_;  // Sorted by address
+};
+
+#endif // PC_PROFILE_H
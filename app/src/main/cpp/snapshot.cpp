@@ -0,0 +1,312 @@
+/*
+ * Machine Snapshots
+ */
+
+#include "snapshot.h"
+#include "emu_io.h"
+#include "qkz80.h"
+#include "romwbw_mem.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <unistd.h>
+#include <zlib.h>
+
+static const uint32_t TAG_CPU = snapshot_tag('C', 'P', 'U', ' ');
+static const uint32_t TAG_ROM = snapshot_tag('R', 'O', 'M', ' ');
+static const uint32_t TAG_RAM = snapshot_tag('R', 'A', 'M', ' ');
+
+//=============================================================================
+// Writer
+//=============================================================================
+
+SnapshotWriter::SnapshotWriter() {
+    put_u32(SNAPSHOT_MAGIC);
+    put_u16(SNAPSHOT_VERSION);
+    put_u16(0);  // Reserved
+}
+
+void SnapshotWriter::begin_chunk(uint32_t tag) {
+    put_u32(tag);
+    chunk_start_ = buffer_.size();
+    put_u32(0);  // Length, patched by end_chunk
+}
+
+void SnapshotWriter::end_chunk() {
+    uint32_t length = static_cast<uint32_t>(buffer_.size() - chunk_start_ - 4);
+    for (int i = 0; i < 4; i++) {
+        buffer_[chunk_start_ + i] = static_cast<uint8_t>(length >> (8 * i));
+    }
+}
+
+void SnapshotWriter::put_u8(uint8_t v) {
+    buffer_.push_back(v);
+}
+
+void SnapshotWriter::put_u16(uint16_t v) {
+    put_u8(static_cast<uint8_t>(v));
+    put_u8(static_cast<uint8_t>(v >> 8));
+}
+
+void SnapshotWriter::put_u32(uint32_t v) {
+    put_u16(static_cast<uint16_t>(v));
+    put_u16(static_cast<uint16_t>(v >> 16));
+}
+
+void SnapshotWriter::put_u64(uint64_t v) {
+    put_u32(static_cast<uint32_t>(v));
+    put_u32(static_cast<uint32_t>(v >> 32));
+}
+
+void SnapshotWriter::put_bytes(const uint8_t* data, size_t count) {
+    buffer_.insert(buffer_.end(), data, data + count);
+}
+
+void SnapshotWriter::put_string(const std::string& s) {
+    put_u32(static_cast<uint32_t>(s.size()));
+    put_bytes(reinterpret_cast<const uint8_t*>(s.data()), s.size());
+}
+
+void SnapshotWriter::put_compressed(const uint8_t* data, size_t count) {
+    uLongf packed_size = compressBound(static_cast<uLong>(count));
+    std::vector<uint8_t> packed(packed_size);
+    // Level 1: RAM is mostly fill patterns and this keeps saves fast
+    if (compress2(packed.data(), &packed_size, data, static_cast<uLong>(count), 1) != Z_OK) {
+        packed_size = 0;
+    }
+    put_u32(static_cast<uint32_t>(count));
+    put_u32(static_cast<uint32_t>(packed_size));
+    put_bytes(packed.data(), packed_size);
+}
+
+bool SnapshotWriter::write_file(const std::string& path) const {
+    std::string temp = path + ".tmp";
+    FILE* f = fopen(temp.c_str(), "wb");
+    if (!f) {
+        emu_error("snapshot: cannot create %s", temp.c_str());
+        return false;
+    }
+    bool ok = fwrite(buffer_.data(), 1, buffer_.size(), f) == buffer_.size();
+    ok = fflush(f) == 0 && ok;
+    ok = fsync(fileno(f)) == 0 && ok;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(temp.c_str(), path.c_str()) != 0) {
+        emu_error("snapshot: cannot write %s", path.c_str());
+        unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+//=============================================================================
+// Reader
+//=============================================================================
+
+bool SnapshotReader::load_file(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    std::vector<uint8_t> data;
+    uint8_t block[65536];
+    size_t n;
+    while ((n = fread(block, 1, sizeof(block), f)) > 0) {
+        data.insert(data.end(), block, block + n);
+    }
+    fclose(f);
+    return load(std::move(data));
+}
+
+bool SnapshotReader::load(std::vector<uint8_t> data) {
+    buffer_ = std::move(data);
+    chunks_.clear();
+    ok_ = true;
+    pos_ = 0;
+    end_ = buffer_.size();
+
+    if (get_u32() != SNAPSHOT_MAGIC) {
+        emu_error("snapshot: bad magic");
+        return ok_ = false;
+    }
+    version_ = get_u16();
+    get_u16();  // Reserved
+    if (!ok_ || version_ == 0 || version_ > SNAPSHOT_VERSION) {
+        emu_error("snapshot: unsupported version %u", version_);
+        return ok_ = false;
+    }
+
+    while (ok_ && pos_ < buffer_.size()) {
+        uint32_t tag = get_u32();
+        uint32_t length = get_u32();
+        if (!ok_ || length > buffer_.size() - pos_) {
+            emu_error("snapshot: truncated chunk");
+            return ok_ = false;
+        }
+        chunks_.push_back({tag, pos_, length});
+        pos_ += length;
+    }
+    return ok_;
+}
+
+bool SnapshotReader::open_chunk(uint32_t tag) {
+    for (const chunk& c : chunks_) {
+        if (c.tag == tag) {
+            pos_ = c.offset;
+            end_ = c.offset + c.length;
+            ok_ = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SnapshotReader::take(size_t count) {
+    if (!ok_ || count > end_ - pos_) {
+        ok_ = false;
+        return false;
+    }
+    return true;
+}
+
+uint8_t SnapshotReader::get_u8() {
+    if (!take(1)) return 0;
+    return buffer_[pos_++];
+}
+
+uint16_t SnapshotReader::get_u16() {
+    uint16_t lo = get_u8();
+    return static_cast<uint16_t>(lo | get_u8() << 8);
+}
+
+uint32_t SnapshotReader::get_u32() {
+    uint32_t lo = get_u16();
+    return lo | static_cast<uint32_t>(get_u16()) << 16;
+}
+
+uint64_t SnapshotReader::get_u64() {
+    uint64_t lo = get_u32();
+    return lo | static_cast<uint64_t>(get_u32()) << 32;
+}
+
+bool SnapshotReader::get_bytes(uint8_t* out, size_t count) {
+    if (!take(count)) return false;
+    memcpy(out, buffer_.data() + pos_, count);
+    pos_ += count;
+    return true;
+}
+
+std::string SnapshotReader::get_string() {
+    uint32_t length = get_u32();
+    if (!take(length)) return std::string();
+    std::string s(reinterpret_cast<const char*>(buffer_.data() + pos_), length);
+    pos_ += length;
+    return s;
+}
+
+bool SnapshotReader::get_compressed(uint8_t* out, size_t count) {
+    uint32_t raw_size = get_u32();
+    uint32_t packed_size = get_u32();
+    if (!ok_ || raw_size != count || !take(packed_size)) {
+        ok_ = false;
+        return false;
+    }
+    uLongf out_size = static_cast<uLongf>(count);
+    if (uncompress(out, &out_size, buffer_.data() + pos_, packed_size) != Z_OK ||
+        out_size != count) {
+        ok_ = false;
+        return false;
+    }
+    pos_ += packed_size;
+    return true;
+}
+
+//=============================================================================
+// CPU and Memory
+//=============================================================================
+
+static void put_pair(SnapshotWriter& w, const qkz80_reg_pair& pair) {
+    w.put_u16(pair.get_pair16());
+}
+
+static void get_pair(SnapshotReader& r, qkz80_reg_pair& pair) {
+    pair.set_pair16(r.get_u16());
+}
+
+void snapshot_put_cpu(SnapshotWriter& writer, qkz80* cpu, banked_mem* memory) {
+    qkz80_reg_set& regs = cpu->regs;
+
+    writer.begin_chunk(TAG_CPU);
+    put_pair(writer, regs.AF);
+    put_pair(writer, regs.BC);
+    put_pair(writer, regs.DE);
+    put_pair(writer, regs.HL);
+    put_pair(writer, regs.SP);
+    put_pair(writer, regs.PC);
+    put_pair(writer, regs.IX);
+    put_pair(writer, regs.IY);
+    put_pair(writer, regs.AF_);
+    put_pair(writer, regs.BC_);
+    put_pair(writer, regs.DE_);
+    put_pair(writer, regs.HL_);
+    writer.put_u8(regs.I);
+    writer.put_u8(regs.R);
+    writer.put_u8(regs.IFF1);
+    writer.put_u8(regs.IFF2);
+    writer.put_u8(regs.IM);
+    writer.put_u8(cpu->get_cpu_mode() == qkz80::MODE_Z80 ? 1 : 0);
+    writer.put_u8(memory->get_current_bank());
+    writer.end_chunk();
+}
+
+void snapshot_put_machine(SnapshotWriter& writer, qkz80* cpu, banked_mem* memory) {
+    snapshot_put_cpu(writer, cpu, memory);
+
+    writer.begin_chunk(TAG_ROM);
+    writer.put_compressed(memory->get_rom(), SNAPSHOT_ROM_SIZE);
+    writer.end_chunk();
+
+    writer.begin_chunk(TAG_RAM);
+    writer.put_compressed(memory->get_ram(), SNAPSHOT_RAM_SIZE);
+    writer.end_chunk();
+}
+
+bool snapshot_get_machine(SnapshotReader& reader, qkz80* cpu, banked_mem* memory) {
+    // Memory first: a failed inflate leaves the CPU untouched
+    if (!reader.open_chunk(TAG_ROM) || !reader.get_compressed(memory->get_rom(), SNAPSHOT_ROM_SIZE)) {
+        emu_error("snapshot: missing or bad ROM chunk");
+        return false;
+    }
+    if (!reader.open_chunk(TAG_RAM) || !reader.get_compressed(memory->get_ram(), SNAPSHOT_RAM_SIZE)) {
+        emu_error("snapshot: missing or bad RAM chunk");
+        return false;
+    }
+    return snapshot_get_cpu(reader, cpu, memory);
+}
+
+bool snapshot_get_cpu(SnapshotReader& reader, qkz80* cpu, banked_mem* memory) {
+    if (!reader.open_chunk(TAG_CPU)) {
+        emu_error("snapshot: missing CPU chunk");
+        return false;
+    }
+
+    qkz80_reg_set& regs = cpu->regs;
+    get_pair(reader, regs.AF);
+    get_pair(reader, regs.BC);
+    get_pair(reader, regs.DE);
+    get_pair(reader, regs.HL);
+    get_pair(reader, regs.SP);
+    get_pair(reader, regs.PC);
+    get_pair(reader, regs.IX);
+    get_pair(reader, regs.IY);
+    get_pair(reader, regs.AF_);
+    get_pair(reader, regs.BC_);
+    get_pair(reader, regs.DE_);
+    get_pair(reader, regs.HL_);
+    regs.I = reader.get_u8();
+    regs.R = reader.get_u8();
+    regs.IFF1 = reader.get_u8();
+    regs.IFF2 = reader.get_u8();
+    regs.IM = reader.get_u8();
+    cpu->set_cpu_mode(reader.get_u8() ? qkz80::MODE_Z80 : qkz80::MODE_8080);
+    memory->select_bank(reader.get_u8());
+    return reader.ok();
+}
@@ -0,0 +1,117 @@
+/*
+ * Machine Snapshots
+ *
+ * Versioned binary save-state format. A snapshot is a header followed by
+ * tagged chunks (tag, length, payload), all little-endian. Readers skip
+ * tags they don't know, so chunks can be added without breaking older
+ * snapshots; a chunk whose layout changes gets a new tag or bumps
+ * SNAPSHOT_VERSION. Memory is stored zlib-compressed.
+ *
+ * The CPU and memory chunks are written here; front ends add their own
+ * chunks (console queues, mounted disks) with the same writer.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class qkz80;
+class banked_mem;
+
+static const uint32_t SNAPSHOT_MAGIC = 0x53504D43;  // "CMPS"
+static const uint16_t SNAPSHOT_VERSION = 1;
+
+// RomWBW memory layout: 512KB ROM + 512KB RAM in 32KB banks
+static const size_t SNAPSHOT_ROM_SIZE = 512 * 1024;
+static const size_t SNAPSHOT_RAM_SIZE = 512 * 1024;
+
+constexpr uint32_t snapshot_tag(char a, char b, char c, char d) {
+    return static_cast<uint32_t>(static_cast<uint8_t>(a)) |
+           static_cast<uint32_t>(static_cast<uint8_t>(b)) << 8 |
+           static_cast<uint32_t>(static_cast<uint8_t>(c)) << 16 |
+           static_cast<uint32_t>(static_cast<uint8_t>(d)) << 24;
+}
+
+class SnapshotWriter {
+public:
+    SnapshotWriter();
+
+    void begin_chunk(uint32_t tag);
+    void end_chunk();
+
+    void put_u8(uint8_t v);
+    void put_u16(uint16_t v);
+    void put_u32(uint32_t v);
+    void put_u64(uint64_t v);
+    void put_bytes(const uint8_t* data, size_t count);
+    void put_string(const std::string& s);
+    // Raw size, compressed size, then the zlib stream
+    void put_compressed(const uint8_t* data, size_t count);
+
+    const std::vector<uint8_t>& data() const { return buffer_; }
+
+    // Write to path via a temporary file and rename
+    bool write_file(const std::string& path) const;
+
+private:
+    std::vector<uint8_t> buffer_;
+    size_t chunk_start_ = 0;
+};
+
+class SnapshotReader {
+public:
+    // Read and validate the header and chunk table. False if the file is
+    // missing, truncated or from a newer version.
+    bool load_file(const std::string& path);
+    bool load(std::vector<uint8_t> data);
+
+    uint16_t version() const { return version_; }
+
+    // Position at the payload of chunk tag; false if absent
+    bool open_chunk(uint32_t tag);
+
+    uint8_t get_u8();
+    uint16_t get_u16();
+    uint32_t get_u32();
+    uint64_t get_u64();
+    bool get_bytes(uint8_t* out, size_t count);
+    std::string get_string();
+    // Inflate into out, which must be exactly the stored raw size
+    bool get_compressed(uint8_t* out, size_t count);
+
+    // False once any read ran past the current chunk
+    bool ok() const { return ok_; }
+
+    // Bytes left in the current chunk; bounds lengths read from the file
+    size_t remaining() const { return ok_ ? end_ - pos_ : 0; }
+
+private:
+    struct chunk {
+        uint32_t tag;
+        size_t offset;
+        size_t length;
+    };
+
+    std::vector<uint8_t> buffer_;
+    std::vector<chunk> chunks_;
+    uint16_t version_ = 0;
+    size_t pos_ = 0;
+    size_t end_ = 0;
+    bool ok_ = false;
+
+    bool take(size_t count);
+};
+
+// CPU registers and mode, current bank and all ROM/RAM banks
+void snapshot_put_machine(SnapshotWriter& writer, qkz80* cpu, banked_mem* memory);
+bool snapshot_get_machine(SnapshotReader& reader, qkz80* cpu, banked_mem* memory);
+
+// CPU registers, mode and current bank only (incremental checkpoints)
+void snapshot_put_cpu(SnapshotWriter& writer, qkz80* cpu, banked_mem* memory);
+bool snapshot_get_cpu(SnapshotReader& reader, qkz80* cpu, banked_mem* memory);
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,508 @@
+/*
+ * Sparse Block-Compressed Disk Images
+ */
+
+#include "sparse_disk.h"
+#include "block_store.h"
+#include "emu_io.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+static const uint32_t SPARSE_VERSION = 1;
+
+// Inflated blocks kept per disk (1MB at the default block size)
+static const size_t CACHE_BLOCKS = 64;
+
+// Fast deflate for blocks written while running; packing uses the best
+static const int WRITE_LEVEL = 1;
+static const int PACK_LEVEL = 9;
+
+enum : uint32_t {
+    BLOCK_ZERO,     // All 0x00, no payload
+    BLOCK_E5,       // All 0xE5, no payload
+    BLOCK_DEFLATE,  // zlib stream
+    BLOCK_STORED,   // Raw, when deflate doesn't help
+};
+
+// On-disk structures, written as-is (little-endian hosts)
+struct sparse_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint32_t block_count;
+    uint64_t image_size;
+    uint32_t index_crc;
+    uint32_t reserved;
+};
+
+struct sparse_entry {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t kind;
+};
+
+static_assert(sizeof(sparse_header) == 32, "sparse_header layout");
+static_assert(sizeof(sparse_entry) == 16, "sparse_entry layout");
+
+// Clean blocks are interned, so identical blocks of any open disk share one
+// copy; a written block gets a private copy until it is stored again
+struct cache_slot {
+    uint32_t block;
+    shared_block data;
+    std::unique_ptr<std::vector<uint8_t>> written;
+
+    const std::vector<uint8_t>& bytes() const { return written ? *written : *data; }
+};
+
+struct sparse_disk {
+    std::string path;
+    std::mutex mutex;  // Reads and writes come from the CPU thread, saves from any
+
+    const uint8_t* map = nullptr;
+    size_t map_size = 0;
+    uint32_t block_size = 0;
+    uint64_t image_size = 0;
+    std::vector<sparse_entry> index;
+
+    // Payloads of blocks changed since the file was mapped
+    std::unordered_map<uint32_t, std::vector<uint8_t>> changed;
+    size_t changed_bytes = 0;
+
+    // Most recently used first
+    std::list<cache_slot> cache;
+    std::unordered_map<uint32_t, std::list<cache_slot>::iterator> cache_index;
+};
+
+//=============================================================================
+// Container File
+//=============================================================================
+
+bool sparse_disk_detect(int fd) {
+    uint32_t magic = 0;
+    return pread(fd, &magic, sizeof(magic), 0) == sizeof(magic) && magic == SPARSE_MAGIC;
+}
+
+// Map fd and load its index into disk. Returns false if malformed.
+static bool map_container(sparse_disk* disk, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(sparse_header)) {
+        return false;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        emu_error("sparse_disk: mmap of %s failed: %s", disk->path.c_str(), strerror(errno));
+        return false;
+    }
+    const uint8_t* map = static_cast<const uint8_t*>(addr);
+
+    sparse_header header;
+    memcpy(&header, map, sizeof(header));
+    uint64_t index_bytes = static_cast<uint64_t>(header.block_count) * sizeof(sparse_entry);
+    bool ok = header.magic == SPARSE_MAGIC && header.version == SPARSE_VERSION &&
+              header.block_size >= 512 && header.block_size <= (1u << 20) &&
+              (header.image_size + header.block_size - 1) / header.block_size == header.block_count &&
+              sizeof(header) + index_bytes <= size &&
+              crc32(0, map + sizeof(header), static_cast<uInt>(index_bytes)) == header.index_crc;
+
+    std::vector<sparse_entry> index;
+    if (ok) {
+        index.resize(header.block_count);
+        memcpy(index.data(), map + sizeof(header), index_bytes);
+        for (const sparse_entry& e : index) {
+            bool has_payload = e.kind == BLOCK_DEFLATE || e.kind == BLOCK_STORED;
+            if (e.kind > BLOCK_STORED || (has_payload && e.offset + e.length > size)) {
+                ok = false;
+                break;
+            }
+        }
+    }
+    if (!ok) {
+        emu_error("sparse_disk: %s is not a valid container", disk->path.c_str());
+        munmap(addr, size);
+        return false;
+    }
+
+    if (disk->map) munmap(const_cast<uint8_t*>(disk->map), disk->map_size);
+    disk->map = map;
+    disk->map_size = size;
+    disk->block_size = header.block_size;
+    disk->image_size = header.image_size;
+    disk->index.swap(index);
+    disk->changed.clear();
+    disk->changed_bytes = 0;
+    madvise(addr, size, MADV_RANDOM);
+    return true;
+}
+
+sparse_disk* sparse_disk_open(int fd, const std::string& path) {
+    sparse_disk* disk = new sparse_disk();
+    disk->path = path;
+    if (!map_container(disk, fd)) {
+        delete disk;
+        return nullptr;
+    }
+    return disk;
+}
+
+void sparse_disk_close(sparse_disk* disk) {
+    if (!disk) return;
+    if (disk->map) munmap(const_cast<uint8_t*>(disk->map), disk->map_size);
+    delete disk;
+}
+
+size_t sparse_disk_size(sparse_disk* disk) {
+    return disk ? static_cast<size_t>(disk->image_size) : 0;
+}
+
+size_t sparse_disk_memory(sparse_disk* disk) {
+    if (!disk) return 0;
+    std::lock_guard<std::mutex> lock(disk->mutex);
+    return disk->cache.size() * disk->block_size + disk->changed_bytes;
+}
+
+//=============================================================================
+// Blocks
+//=============================================================================
+
+static size_t block_bytes(const sparse_disk* disk, uint32_t block) {
+    uint64_t start = static_cast<uint64_t>(block) * disk->block_size;
+    return static_cast<size_t>(std::min<uint64_t>(disk->block_size, disk->image_size - start));
+}
+
+static const uint8_t* payload(const sparse_disk* disk, uint32_t block) {
+    auto it = disk->changed.find(block);
+    return it != disk->changed.end() ? it->second.data() : disk->map + disk->index[block].offset;
+}
+
+static bool inflate_block(const sparse_disk* disk, uint32_t block, uint8_t* out, size_t size) {
+    const sparse_entry& e = disk->index[block];
+    switch (e.kind) {
+        case BLOCK_ZERO:
+            memset(out, 0x00, size);
+            return true;
+        case BLOCK_E5:
+            memset(out, 0xE5, size);
+            return true;
+        case BLOCK_STORED:
+            if (e.length != size) return false;
+            memcpy(out, payload(disk, block), size);
+            return true;
+        case BLOCK_DEFLATE: {
+            uLongf out_size = static_cast<uLongf>(size);
+            return uncompress(out, &out_size, payload(disk, block), e.length) == Z_OK &&
+                   out_size == size;
+        }
+    }
+    return false;
+}
+
+static bool all_bytes(const uint8_t* data, size_t size, uint8_t value) {
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] != value) return false;
+    }
+    return true;
+}
+
+// Classify and compress one block. Returns the kind; payload is filled for
+// DEFLATE and STORED.
+static uint32_t encode_block(const uint8_t* data, size_t size, int level,
+                             std::vector<uint8_t>* payload) {
+    payload->clear();
+    if (all_bytes(data, size, 0x00)) return BLOCK_ZERO;
+    if (all_bytes(data, size, 0xE5)) return BLOCK_E5;
+    uLongf packed = compressBound(static_cast<uLong>(size));
+    payload->resize(packed);
+    if (compress2(payload->data(), &packed, data, static_cast<uLong>(size), level) == Z_OK &&
+        packed < size) {
+        payload->resize(packed);
+        return BLOCK_DEFLATE;
+    }
+    payload->assign(data, data + size);
+    return BLOCK_STORED;
+}
+
+// Re-encode a written cached block into the changed set
+static void store_block(sparse_disk* disk, cache_slot& slot) {
+    std::vector<uint8_t> data;
+    uint32_t kind = encode_block(slot.written->data(), slot.written->size(), WRITE_LEVEL, &data);
+
+    auto it = disk->changed.find(slot.block);
+    if (it != disk->changed.end()) {
+        disk->changed_bytes -= it->second.size();
+        disk->changed.erase(it);
+    }
+    sparse_entry& e = disk->index[slot.block];
+    e.kind = kind;
+    e.length = static_cast<uint32_t>(data.size());
+    e.offset = 0;
+    if (!data.empty()) {
+        disk->changed_bytes += data.size();
+        disk->changed.emplace(slot.block, std::move(data));
+    }
+    slot.data = block_store_intern(std::move(*slot.written));
+    slot.written.reset();
+}
+
+// The cached, inflated block, loading (and evicting) as needed
+static cache_slot* load_block(sparse_disk* disk, uint32_t block) {
+    auto found = disk->cache_index.find(block);
+    if (found != disk->cache_index.end()) {
+        disk->cache.splice(disk->cache.begin(), disk->cache, found->second);
+        return &disk->cache.front();
+    }
+
+    std::vector<uint8_t> data(block_bytes(disk, block));
+    if (!inflate_block(disk, block, data.data(), data.size())) {
+        emu_error("sparse_disk: block %u of %s is corrupt", block, disk->path.c_str());
+        return nullptr;
+    }
+    if (disk->cache.size() >= CACHE_BLOCKS) {
+        cache_slot& victim = disk->cache.back();
+        if (victim.written) store_block(disk, victim);
+        disk->cache_index.erase(victim.block);
+        disk->cache.pop_back();
+    }
+    disk->cache.push_front(cache_slot{block, block_store_intern(std::move(data)), nullptr});
+    disk->cache_index[block] = disk->cache.begin();
+    return &disk->cache.front();
+}
+
+size_t sparse_disk_read(sparse_disk* disk, size_t offset, uint8_t* buffer, size_t count) {
+    if (!disk || offset >= disk->image_size) return 0;
+    std::lock_guard<std::mutex> lock(disk->mutex);
+    count = static_cast<size_t>(std::min<uint64_t>(count, disk->image_size - offset));
+    size_t done = 0;
+    while (done < count) {
+        uint32_t block = static_cast<uint32_t>((offset + done) / disk->block_size);
+        size_t within = (offset + done) % disk->block_size;
+        cache_slot* slot = load_block(disk, block);
+        if (!slot) break;
+        const std::vector<uint8_t>& data = slot->bytes();
+        size_t n = std::min(count - done, data.size() - within);
+        memcpy(buffer + done, data.data() + within, n);
+        done += n;
+    }
+    return done;
+}
+
+size_t sparse_disk_write(sparse_disk* disk, size_t offset, const uint8_t* buffer, size_t count) {
+    if (!disk || offset >= disk->image_size) return 0;
+    std::lock_guard<std::mutex> lock(disk->mutex);
+    count = static_cast<size_t>(std::min<uint64_t>(count, disk->image_size - offset));
+    size_t done = 0;
+    while (done < count) {
+        uint32_t block = static_cast<uint32_t>((offset + done) / disk->block_size);
+        size_t within = (offset + done) % disk->block_size;
+        cache_slot* slot = load_block(disk, block);
+        if (!slot) break;
+        if (!slot->written) {
+            slot->written.reset(new std::vector<uint8_t>(*slot->data));
+            slot->data.reset();
+        }
+        size_t n = std::min(count - done, slot->written->size() - within);
+        memcpy(slot->written->data() + within, buffer + done, n);
+        done += n;
+    }
+    return done;
+}
+
+//=============================================================================
+// Saving and Packing
+//=============================================================================
+
+static bool write_fully(int fd, const void* data, size_t length, off_t offset) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    while (length > 0) {
+        ssize_t n = pwrite(fd, p, length, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        length -= static_cast<size_t>(n);
+        offset += n;
+    }
+    return true;
+}
+
+// Write header and index at the start of fd, payloads already in place
+static bool write_index(int fd, uint32_t block_size, uint64_t image_size,
+                        const std::vector<sparse_entry>& index) {
+    sparse_header header;
+    header.magic = SPARSE_MAGIC;
+    header.version = SPARSE_VERSION;
+    header.block_size = block_size;
+    header.block_count = static_cast<uint32_t>(index.size());
+    header.image_size = image_size;
+    header.index_crc = crc32(0, reinterpret_cast<const Bytef*>(index.data()),
+                             static_cast<uInt>(index.size() * sizeof(sparse_entry)));
+    header.reserved = 0;
+    return write_fully(fd, &header, sizeof(header), 0) &&
+           write_fully(fd, index.data(), index.size() * sizeof(sparse_entry), sizeof(header));
+}
+
+long long sparse_disk_save(sparse_disk* disk, const std::string& target) {
+    if (!disk) return -1;
+    std::lock_guard<std::mutex> lock(disk->mutex);
+    for (cache_slot& slot : disk->cache) {
+        if (slot.written) store_block(disk, slot);
+    }
+
+    std::string temp = target + ".tmp";
+    int fd = open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0;
+    std::vector<sparse_entry> index = disk->index;
+    uint64_t pos = sizeof(sparse_header) + index.size() * sizeof(sparse_entry);
+    for (uint32_t block = 0; ok && block < index.size(); block++) {
+        sparse_entry& e = index[block];
+        if (e.kind != BLOCK_DEFLATE && e.kind != BLOCK_STORED) {
+            e.offset = 0;
+            e.length = 0;
+            continue;
+        }
+        ok = write_fully(fd, payload(disk, block), e.length, static_cast<off_t>(pos));
+        e.offset = pos;
+        pos += e.length;
+    }
+    ok = ok && write_index(fd, disk->block_size, disk->image_size, index) && fsync(fd) == 0;
+    if (ok && rename(temp.c_str(), target.c_str()) != 0) ok = false;
+    if (!ok) {
+        emu_error("sparse_disk: cannot write %s: %s", target.c_str(), strerror(errno));
+        if (fd >= 0) close(fd);
+        unlink(temp.c_str());
+        return -1;
+    }
+
+    // Saved over our own file: map the new one and drop the changed blocks
+    if (target == disk->path && !map_container(disk, fd)) {
+        emu_error("sparse_disk: cannot remap %s", target.c_str());
+    }
+    close(fd);
+    return static_cast<long long>(pos);
+}
+
+long long sparse_disk_pack(const std::string& input, const std::string& output,
+                           uint32_t block_size) {
+    int in = open(input.c_str(), O_RDONLY);
+    struct stat st;
+    if (in < 0 || fstat(in, &st) != 0 || st.st_size <= 0) {
+        emu_error("sparse_disk: cannot read %s", input.c_str());
+        if (in >= 0) close(in);
+        return -1;
+    }
+    uint64_t image_size = static_cast<uint64_t>(st.st_size);
+    void* addr = mmap(nullptr, static_cast<size_t>(image_size), PROT_READ, MAP_PRIVATE, in, 0);
+    close(in);
+    if (addr == MAP_FAILED) {
+        emu_error("sparse_disk: mmap of %s failed: %s", input.c_str(), strerror(errno));
+        return -1;
+    }
+    madvise(addr, static_cast<size_t>(image_size), MADV_SEQUENTIAL);
+    const uint8_t* image = static_cast<const uint8_t*>(addr);
+
+    std::string temp = output + ".tmp";
+    int fd = open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0;
+    std::vector<sparse_entry> index((image_size + block_size - 1) / block_size);
+    uint64_t pos = sizeof(sparse_header) + index.size() * sizeof(sparse_entry);
+    std::vector<uint8_t> data;
+    for (size_t block = 0; ok && block < index.size(); block++) {
+        uint64_t start = static_cast<uint64_t>(block) * block_size;
+        size_t size = static_cast<size_t>(std::min<uint64_t>(block_size, image_size - start));
+        sparse_entry& e = index[block];
+        e.kind = encode_block(image + start, size, PACK_LEVEL, &data);
+        e.length = static_cast<uint32_t>(data.size());
+        e.offset = data.empty() ? 0 : pos;
+        if (!data.empty()) {
+            ok = write_fully(fd, data.data(), data.size(), static_cast<off_t>(pos));
+            pos += data.size();
+        }
+    }
+    munmap(addr, static_cast<size_t>(image_size));
+
+    ok = ok && write_index(fd, block_size, image_size, index) && fsync(fd) == 0;
+    if (fd >= 0) close(fd);
+    if (ok && rename(temp.c_str(), output.c_str()) != 0) ok = false;
+    if (!ok) {
+        emu_error("sparse_disk: cannot write %s: %s", output.c_str(), strerror(errno));
+        unlink(temp.c_str());
+        return -1;
+    }
+    emu_status("sparse_disk: packed %s (%llu bytes) to %llu bytes", input.c_str(),
+               static_cast<unsigned long long>(image_size), static_cast<unsigned long long>(pos));
+    return static_cast<long long>(pos);
+}
+
+long long sparse_disk_unpack(const std::string& input, const std::string& output) {
+    int in = open(input.c_str(), O_RDONLY);
+    if (in < 0) {
+        emu_error("sparse_disk: cannot read %s: %s", input.c_str(), strerror(errno));
+        return -1;
+    }
+
+    sparse_disk* disk = nullptr;
+    if (sparse_disk_detect(in)) {
+        disk = sparse_disk_open(in, input);
+        if (!disk) {
+            close(in);
+            return -1;
+        }
+    }
+
+    std::string temp = output + ".tmp";
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0;
+    uint64_t size = 0;
+    if (disk) {
+        // Straight from the index; the LRU and block sharing aren't needed
+        // for one sequential pass
+        std::vector<uint8_t> block(disk->block_size);
+        for (uint32_t i = 0; ok && i < disk->index.size(); i++) {
+            size_t bytes = block_bytes(disk, i);
+            ok = inflate_block(disk, i, block.data(), bytes) &&
+                 write_fully(fd, block.data(), bytes, static_cast<off_t>(size));
+            size += bytes;
+        }
+        sparse_disk_close(disk);
+    } else {
+        std::vector<uint8_t> buffer(1024 * 1024);
+        for (;;) {
+            ssize_t n = pread(in, buffer.data(), buffer.size(), static_cast<off_t>(size));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                ok = ok && n == 0;
+                break;
+            }
+            ok = ok && write_fully(fd, buffer.data(), static_cast<size_t>(n), static_cast<off_t>(size));
+            size += static_cast<uint64_t>(n);
+        }
+    }
+    close(in);
+
+    ok = ok && fsync(fd) == 0;
+    if (fd >= 0) close(fd);
+    if (ok && rename(temp.c_str(), output.c_str()) != 0) ok = false;
+    if (!ok) {
+        emu_error("sparse_disk: cannot unpack %s to %s: %s", input.c_str(), output.c_str(),
+                  strerror(errno));
+        unlink(temp.c_str());
+        return -1;
+    }
+    emu_status("sparse_disk: unpacked %s to %s (%llu bytes)", input.c_str(), output.c_str(),
+               static_cast<unsigned long long>(size));
+    return static_cast<long long>(size);
+}
@@ -0,0 +1,69 @@
+/*
+ * Sparse Block-Compressed Disk Images
+ *
+ * Container for disk images that are mostly empty: the image is split into
+ * fixed-size blocks, each stored deflated, stored raw, or not at all when
+ * it is entirely 0x00 or 0xE5 (CP/M's fill byte). An hd1k slice with a few
+ * hundred KB of files packs to a few hundred KB.
+ *
+ *   header  32 bytes: 'CPMZ', version, block size, block count,
+ *           image size (u64), CRC-32 of the index, reserved
+ *   index   block count x 16 bytes: data offset (u64), length, kind
+ *   data    block payloads
+ *
+ * All little-endian. The file is mapped read-only; blocks are inflated on
+ * access into a small LRU, sharing identical blocks with other disks
+ * (block_store.h), and changed blocks are deflated again when evicted and
+ * kept in memory until saved. disk_image uses this backend for
+ * any file starting with the magic, so mounts, journaling and saves work
+ * unchanged.
+ */
+
+#ifndef SPARSE_DISK_H
+#define SPARSE_DISK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+static const uint32_t SPARSE_MAGIC = 0x5A4D5043;  // "CPMZ"
+static const uint32_t SPARSE_DEFAULT_BLOCK = 16 * 1024;
+
+struct sparse_disk;
+
+// True if the file behind fd starts with SPARSE_MAGIC
+bool sparse_disk_detect(int fd);
+
+// Open the container behind fd (not taken over; keep it open while the
+// disk is). Returns nullptr if it is malformed.
+sparse_disk* sparse_disk_open(int fd, const std::string& path);
+void sparse_disk_close(sparse_disk* disk);
+
+// Expanded image size
+size_t sparse_disk_size(sparse_disk* disk);
+
+size_t sparse_disk_read(sparse_disk* disk, size_t offset, uint8_t* buffer, size_t count);
+size_t sparse_disk_write(sparse_disk* disk, size_t offset, const uint8_t* buffer, size_t count);
+
+// Write the current contents as a new container at target (temporary file
+// and rename). Saving to the disk's own path also remaps it, releasing the
+// memory held by changed blocks. Returns bytes written, or -1.
+long long sparse_disk_save(sparse_disk* disk, const std::string& target);
+
+// Bytes of heap in use: cached blocks plus changed blocks not yet saved.
+// Cached blocks are shared through block_store.h and counted by each disk
+// using them; block_store_report() has the deduplicated total.
+size_t sparse_disk_memory(sparse_disk* disk);
+
+// Convert a raw image file to a container. Returns the container size, or
+// -1 on error (nothing is left at output).
+long long sparse_disk_pack(const std::string& input, const std::string& output,
+                           uint32_t block_size = SPARSE_DEFAULT_BLOCK);
+
+// The inverse: write the raw image held by the container at input to
+// output, for tools that expect a plain disk image. A raw input is copied
+// as it is. Returns the image size, or -1 on error (nothing is left at
+// output).
+long long sparse_disk_unpack(const std::string& input, const std::string& output);
+
+#endif // SPARSE_DISK_H
@@ -0,0 +1,120 @@
+/*
+ * Single-Producer/Single-Consumer Byte Ring
+ *
+ * Fixed-capacity lock-free ring used for console I/O between the CPU
+ * thread and the UI. One thread may write and one (possibly different)
+ * thread may read concurrently without locks. Indices increase
+ * monotonically and are masked on access, so Capacity must be a power
+ * of two.
+ */
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+template <size_t Capacity>
+class SpscRing {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                  "SpscRing capacity must be a power of two");
+
+public:
+    static constexpr size_t capacity() { return Capacity; }
+
+    // Producer side: append up to count bytes, returns the number written
+    size_t write(const uint8_t* data, size_t count) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t tail = tail_.load(std::memory_order_acquire);
+        size_t space = Capacity - (head - tail);
+        if (count > space) count = space;
+        if (count == 0) return 0;
+
+        size_t pos = head & (Capacity - 1);
+        size_t first = Capacity - pos;
+        if (first > count) first = count;
+        memcpy(buffer_ + pos, data, first);
+        memcpy(buffer_, data + first, count - first);
+
+        head_.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+    // Producer side: append one byte, returns false if the ring is full
+    bool push(uint8_t byte) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) == Capacity) return false;
+        buffer_[head & (Capacity - 1)] = byte;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side: remove up to max bytes into out, returns the number read
+    size_t read(uint8_t* out, size_t max) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t head = head_.load(std::memory_order_acquire);
+        size_t count = head - tail;
+        if (count > max) count = max;
+        if (count == 0) return 0;
+
+        size_t pos = tail & (Capacity - 1);
+        size_t first = Capacity - pos;
+        if (first > count) first = count;
+        memcpy(out, buffer_ + pos, first);
+        memcpy(out + first, buffer_, count - first);
+
+        tail_.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    // Consumer side: copy up to max queued bytes into out without removing them
+    size_t copy(uint8_t* out, size_t max) const {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t count = head_.load(std::memory_order_acquire) - tail;
+        if (count > max) count = max;
+        size_t pos = tail & (Capacity - 1);
+        size_t first = Capacity - pos;
+        if (first > count) first = count;
+        memcpy(out, buffer_ + pos, first);
+        memcpy(out + first, buffer_, count - first);
+        return count;
+    }
+
+    // Consumer side: look at the next byte without removing it
+    bool peek(uint8_t* byte) const {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (head_.load(std::memory_order_acquire) == tail) return false;
+        *byte = buffer_[tail & (Capacity - 1)];
+        return true;
+    }
+
+    // Consumer side: remove one byte, returns false if the ring is empty
+    bool pop(uint8_t* byte) {
+        if (!peek(byte)) return false;
+        tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side: discard everything currently queued
+    void clear() {
+        tail_.store(head_.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    // Approximate when called from the other side; exact from either owner
+    size_t size() const {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+    size_t free_space() const { return Capacity - size(); }
+    bool empty() const { return size() == 0; }
+
+private:
+    // Keep the indices on separate cache lines so producer and consumer
+    // don't invalidate each other on every access
+    alignas(64) std::atomic<size_t> head_{0};  // Next write position
+    alignas(64) std::atomic<size_t> tail_{0};  // Next read position
+    alignas(64) uint8_t buffer_[Capacity];
+};
+
+#endif // SPSC_RING_H
@@ -0,0 +1,535 @@
+/*
+ * VT100/ANSI Terminal
+ */
+
+#include "terminal.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+//=============================================================================
+// Parser Table
+//=============================================================================
+
+enum : uint8_t { GROUND, ESCAPE, CSI_PARAM, CSI_IGNORE, STATE_COUNT };
+
+enum : uint8_t {
+    ACT_NONE,
+    ACT_PRINT,
+    ACT_EXECUTE,      // C0 control
+    ACT_ESCAPE,       // Start an escape sequence
+    ACT_ESC_DISPATCH,
+    ACT_CSI_START,
+    ACT_PARAM,        // Digit or ';'
+    ACT_PRIVATE,      // '<', '=', '>' or '?' before the parameters
+    ACT_CSI_DISPATCH,
+};
+
+struct transition {
+    uint8_t action;
+    uint8_t next;
+};
+
+// One row per parser state, indexed by input byte. Controls are executed
+// in every state without disturbing the sequence, as on a VT100.
+struct parser_table {
+    transition t[STATE_COUNT][256];
+
+    parser_table() {
+        for (int s = 0; s < STATE_COUNT; s++) {
+            for (int c = 0; c < 256; c++) {
+                transition& e = t[s][c];
+                if (c == 0x1B) {
+                    e = {ACT_ESCAPE, ESCAPE};
+                } else if (c < 0x20) {
+                    e = {ACT_EXECUTE, static_cast<uint8_t>(s)};
+                } else if (s == GROUND) {
+                    e = {c == 0x7F ? ACT_NONE : ACT_PRINT, GROUND};
+                } else if (s == ESCAPE) {
+                    e = c == '[' ? transition{ACT_CSI_START, CSI_PARAM}
+                                 : transition{ACT_ESC_DISPATCH, GROUND};
+                } else if (c >= 0x40 && c <= 0x7E) {
+                    e = {s == CSI_PARAM ? ACT_CSI_DISPATCH : ACT_NONE, GROUND};
+                } else if (s == CSI_IGNORE || c == 0x7F) {
+                    e = {ACT_NONE, static_cast<uint8_t>(s)};
+                } else if ((c >= '0' && c <= '9') || c == ';') {
+                    e = {ACT_PARAM, CSI_PARAM};
+                } else if (c >= '<' && c <= '?') {
+                    e = {ACT_PRIVATE, CSI_PARAM};
+                } else if (c >= 0x80) {
+                    e = {ACT_NONE, GROUND};  // Abandon the sequence
+                } else {
+                    e = {ACT_NONE, CSI_IGNORE};  // Intermediates, ':'
+                }
+            }
+        }
+    }
+};
+
+static const parser_table g_parser;
+
+// SGR 30-37 are in ANSI order (black, red, green, yellow, ...); CGA's
+// palette has blue and red swapped relative to it
+static const uint8_t ANSI_TO_CGA[8] = {0, 4, 2, 6, 1, 5, 3, 7};
+
+//=============================================================================
+// Screen
+//=============================================================================
+
+Terminal::Terminal() {
+    cells_.assign(static_cast<size_t>(rows_) * cols_, term_cell(' ', attr_));
+    scrollback_.resize(static_cast<size_t>(SCROLLBACK_DELTA) * cols_);
+    damage_all();
+}
+
+void Terminal::resize(int rows, int cols, int wrap_cols) {
+    rows = std::max(1, std::min(rows, MAX_ROWS));
+    cols = std::max(1, std::min(cols, MAX_COLS));
+    wrap_cols_ = std::max(0, std::min(wrap_cols, cols));
+    if (rows == rows_ && cols == cols_) return;
+
+    std::vector<uint16_t> old;
+    old.swap(cells_);
+    int old_rows = rows_;
+    int old_cols = cols_;
+    rows_ = rows;
+    cols_ = cols;
+    cells_.assign(static_cast<size_t>(rows_) * cols_, term_cell(' ', attr_));
+    load_cells(old_rows, old_cols, old.data());
+
+    // Saved lines are the old width; drop them
+    scrollback_.assign(static_cast<size_t>(SCROLLBACK_DELTA) * cols_, 0);
+    scrollback_count_ = 0;
+
+    row_ = std::min(row_, rows_ - 1);
+    col_ = std::min(col_, cols_ - 1);
+    damage_all();
+}
+
+void Terminal::reset() {
+    attr_ = TERM_FG_DEFAULT;
+    std::fill(cells_.begin(), cells_.end(), term_cell(' ', attr_));
+    row_ = col_ = saved_row_ = saved_col_ = 0;
+    cursor_visible_ = true;
+    jump_scroll_ = true;
+    state_ = GROUND;
+    damage_all();
+}
+
+void Terminal::load_cells(int rows, int cols, const uint16_t* cells) {
+    int copy_rows = std::min(rows, rows_);
+    int copy_cols = std::min(cols, cols_);
+    for (int r = 0; r < copy_rows; r++) {
+        memcpy(&cells_[static_cast<size_t>(r) * cols_], cells + static_cast<size_t>(r) * cols,
+               copy_cols * sizeof(uint16_t));
+    }
+    damage_all();
+}
+
+void Terminal::clear() {
+    erase_rows(0, rows_);
+    row_ = col_ = 0;
+    changed_ = true;
+}
+
+void Terminal::move_cursor(int row, int col) {
+    row_ = std::max(0, std::min(row, rows_ - 1));
+    col_ = std::max(0, std::min(col, cols_ - 1));
+    changed_ = true;
+}
+
+void Terminal::scroll_up(int lines) {
+    if (lines > 0) scroll(lines);
+}
+
+void Terminal::erase(int row, int from, int to) {
+    std::fill(cells_.begin() + static_cast<size_t>(row) * cols_ + from,
+              cells_.begin() + static_cast<size_t>(row) * cols_ + to, term_cell(' ', attr_));
+    damage(row, from, to);
+}
+
+void Terminal::erase_rows(int from, int to) {
+    std::fill(cells_.begin() + static_cast<size_t>(from) * cols_,
+              cells_.begin() + static_cast<size_t>(to) * cols_, term_cell(' ', attr_));
+    for (int row = from; row < to; row++) {
+        damage(row, 0, cols_);
+    }
+}
+
+// Move everything up lines rows, blanking the bottom
+void Terminal::scroll(int lines) {
+    lines = std::min(lines, rows_);
+    save_scrollback(lines);
+    size_t shift = static_cast<size_t>(lines) * cols_;
+    std::copy(cells_.begin() + shift, cells_.end(), cells_.begin());
+    scroll_damage(lines);
+    erase_rows(rows_ - lines, rows_);
+}
+
+void Terminal::new_line() {
+    if (++row_ >= rows_) {
+        scroll(1);
+        row_ = rows_ - 1;
+    }
+    changed_ = true;
+}
+
+void Terminal::reverse_index() {
+    if (row_ > 0) {
+        row_--;
+    } else {
+        std::copy_backward(cells_.begin(), cells_.end() - cols_, cells_.end());
+        scroll_damage(-1);
+        erase_rows(0, 1);
+    }
+    changed_ = true;
+}
+
+//=============================================================================
+// Damage
+//=============================================================================
+
+// Keep the top lines rows, about to scroll off, for the next frame
+void Terminal::save_scrollback(int lines) {
+    for (int row = 0; row < lines; row++) {
+        std::copy(cells_.begin() + static_cast<size_t>(row) * cols_,
+                  cells_.begin() + static_cast<size_t>(row + 1) * cols_,
+                  scrollback_.begin() + static_cast<size_t>(scrollback_next_) * cols_);
+        scrollback_next_ = (scrollback_next_ + 1) % SCROLLBACK_DELTA;
+    }
+    scrollback_count_ = std::min(scrollback_count_ + lines, SCROLLBACK_DELTA);
+    scrolled_off_ += lines;
+}
+
+void Terminal::damage(int row, int from, int to) {
+    changed_ = true;
+    if (full_ || from >= to) return;
+    uint64_t& word = dirty_rows_[row / 64];
+    uint64_t bit = 1ull << (row % 64);
+    if (word & bit) {
+        dirty_from_[row] = std::min<int>(dirty_from_[row], from);
+        dirty_to_[row] = std::max<int>(dirty_to_[row], to);
+    } else {
+        word |= bit;
+        dirty_from_[row] = static_cast<uint8_t>(from);
+        dirty_to_[row] = static_cast<uint8_t>(to);
+    }
+}
+
+void Terminal::damage_all() {
+    dirty_rows_.assign((rows_ + 63) / 64, 0);
+    dirty_from_.assign(rows_, 0);
+    dirty_to_.assign(rows_, 0);
+    scrolled_ = 0;
+    full_ = true;
+    changed_ = true;
+}
+
+// The screen moved up lines rows (down if negative): carry the damage so
+// far along with it. The caller damages the rows uncovered. Scrolls both
+// ways, or by a screen or more, in one frame just repaint everything.
+void Terminal::scroll_damage(int lines) {
+    changed_ = true;
+    if (full_) return;
+    if ((scrolled_ > 0 && lines < 0) || (scrolled_ < 0 && lines > 0) ||
+        std::abs(scrolled_ + lines) >= rows_) {
+        damage_all();
+        return;
+    }
+    scrolled_ += lines;
+
+    std::vector<uint64_t> moved(dirty_rows_.size(), 0);
+    for (size_t word = 0; word < dirty_rows_.size(); word++) {
+        uint64_t bits = dirty_rows_[word];
+        while (bits) {
+            int row = static_cast<int>(word * 64) + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            int to = row - lines;
+            if (to < 0 || to >= rows_) continue;
+            moved[to / 64] |= 1ull << (to % 64);
+            // Rows move in the scroll direction, so walking against it
+            // never overwrites a span not yet moved
+            if (lines < 0) continue;
+            dirty_from_[to] = dirty_from_[row];
+            dirty_to_[to] = dirty_to_[row];
+        }
+    }
+    if (lines < 0) {
+        for (int row = rows_ - 1; row + lines >= 0; row--) {
+            dirty_from_[row] = dirty_from_[row + lines];
+            dirty_to_[row] = dirty_to_[row + lines];
+        }
+    }
+    dirty_rows_.swap(moved);
+}
+
+size_t Terminal::publish(uint8_t* out) {
+    uint8_t* p = out + TERM_FRAME_HEADER;
+    int32_t spans = 0;
+    auto put_span = [&](int row, int from, int to) {
+        uint16_t span[3] = {static_cast<uint16_t>(row), static_cast<uint16_t>(from),
+                            static_cast<uint16_t>(to - from)};
+        memcpy(p, span, sizeof(span));
+        p += sizeof(span);
+        size_t bytes = static_cast<size_t>(to - from) * sizeof(uint16_t);
+        memcpy(p, &cells_[static_cast<size_t>(row) * cols_ + from], bytes);
+        p += bytes;
+        spans++;
+    };
+    if (full_) {
+        for (int row = 0; row < rows_; row++) {
+            put_span(row, 0, cols_);
+        }
+    } else {
+        for (size_t word = 0; word < dirty_rows_.size(); word++) {
+            uint64_t bits = dirty_rows_[word];
+            while (bits) {
+                int row = static_cast<int>(word * 64) + __builtin_ctzll(bits);
+                bits &= bits - 1;
+                put_span(row, dirty_from_[row], dirty_to_[row]);
+            }
+        }
+    }
+
+    // Saved lines, oldest first, in at most two pieces of the ring
+    int first = (scrollback_next_ - scrollback_count_ + SCROLLBACK_DELTA) % SCROLLBACK_DELTA;
+    for (int done = 0; done < scrollback_count_;) {
+        int line = (first + done) % SCROLLBACK_DELTA;
+        int n = std::min(scrollback_count_ - done, SCROLLBACK_DELTA - line);
+        size_t bytes = static_cast<size_t>(n) * cols_ * sizeof(uint16_t);
+        memcpy(p, &scrollback_[static_cast<size_t>(line) * cols_], bytes);
+        p += bytes;
+        done += n;
+    }
+
+    int32_t header[TERM_FRAME_FIELDS] = {};
+    header[TERM_FRAME_ROWS] = rows_;
+    header[TERM_FRAME_COLS] = cols_;
+    header[TERM_FRAME_CURSOR_ROW] = row_;
+    header[TERM_FRAME_CURSOR_COL] = col_;
+    header[TERM_FRAME_FLAGS] = (cursor_visible_ ? TERM_FLAG_CURSOR_VISIBLE : 0) |
+                               (full_ ? TERM_FLAG_FULL : 0);
+    header[TERM_FRAME_BELLS] = static_cast<int32_t>(bells_);
+    header[TERM_FRAME_SCROLL] = scrolled_;
+    header[TERM_FRAME_SPANS] = spans;
+    header[TERM_FRAME_SCROLLBACK] = scrollback_count_;
+    header[TERM_FRAME_SCROLLED_OFF] = scrolled_off_;
+    memcpy(out, header, sizeof(header));
+
+    scrollback_count_ = 0;
+    scrolled_off_ = 0;
+    std::fill(dirty_rows_.begin(), dirty_rows_.end(), 0);
+    scrolled_ = 0;
+    full_ = false;
+    changed_ = false;
+    bells_ = 0;
+    return static_cast<size_t>(p - out);
+}
+
+//=============================================================================
+// Parser
+//=============================================================================
+
+void Terminal::write(const uint8_t* data, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint8_t ch = data[i];
+        const transition& t = g_parser.t[state_][ch];
+        state_ = t.next;
+        switch (t.action) {
+            case ACT_PRINT:
+                print(ch);
+                break;
+            case ACT_EXECUTE:
+                execute(ch);
+                break;
+            case ACT_ESCAPE:
+                break;
+            case ACT_ESC_DISPATCH:
+                escape_dispatch(ch);
+                break;
+            case ACT_CSI_START:
+                private_ = false;
+                param_count_ = 0;
+                params_[0] = -1;
+                break;
+            case ACT_PARAM:
+                if (ch == ';') {
+                    if (param_count_ < MAX_PARAMS - 1) params_[++param_count_] = -1;
+                } else {
+                    int& p = params_[param_count_];
+                    p = std::min((p < 0 ? 0 : p) * 10 + (ch - '0'), 9999);
+                }
+                break;
+            case ACT_PRIVATE:
+                private_ = true;
+                break;
+            case ACT_CSI_DISPATCH:
+                param_count_++;
+                csi_dispatch(ch);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void Terminal::print(uint8_t ch) {
+    int wrap_at = wrap_cols_ ? wrap_cols_ : cols_;
+    if (col_ >= wrap_at) {
+        if (!wrap_cols_) return;  // Truncate at the edge
+        col_ = 0;
+        new_line();
+    }
+    cells_[static_cast<size_t>(row_) * cols_ + col_] = term_cell(ch, attr_);
+    damage(row_, col_, col_ + 1);
+    col_++;
+}
+
+void Terminal::execute(uint8_t ch) {
+    switch (ch) {
+        case 0x07:  // BEL
+            bells_++;
+            changed_ = true;
+            return;
+        case 0x08:  // BS
+            if (col_ > 0) col_--;
+            break;
+        case 0x09:  // HT, stops every 8 columns
+            col_ = std::min((col_ / 8 + 1) * 8, cols_ - 1);
+            break;
+        case 0x0A:  // LF
+            new_line();
+            return;
+        case 0x0D:  // CR
+            col_ = 0;
+            break;
+        default:
+            return;
+    }
+    changed_ = true;
+}
+
+// Parameter index, or fallback when it is missing or zero
+int Terminal::param(int index, int fallback) const {
+    if (index >= param_count_ || params_[index] <= 0) return fallback;
+    return params_[index];
+}
+
+void Terminal::escape_dispatch(uint8_t ch) {
+    switch (ch) {
+        case '7':
+            saved_row_ = row_;
+            saved_col_ = col_;
+            break;
+        case '8':
+            move_cursor(saved_row_, saved_col_);
+            break;
+        case 'D':
+            new_line();
+            break;
+        case 'E':
+            col_ = 0;
+            new_line();
+            break;
+        case 'M':
+            reverse_index();
+            break;
+        case 'c':
+            reset();
+            break;
+        default:
+            break;
+    }
+}
+
+void Terminal::csi_dispatch(uint8_t ch) {
+    if (private_) {
+        // Only DECSCLM (smooth scroll) and DECTCEM (cursor visibility)
+        // among the private modes
+        if (ch == 'h' || ch == 'l') {
+            if (params_[0] == 4) {
+                jump_scroll_ = ch == 'l';
+            } else if (params_[0] == 25) {
+                cursor_visible_ = ch == 'h';
+                changed_ = true;
+            }
+        }
+        return;
+    }
+
+    int n = param(0, 1);
+    switch (ch) {
+        case 'A':
+            move_cursor(row_ - n, col_);
+            break;
+        case 'B':
+            move_cursor(row_ + n, col_);
+            break;
+        case 'C':
+            move_cursor(row_, col_ + n);
+            break;
+        case 'D':
+            move_cursor(row_, col_ - n);
+            break;
+        case 'G':
+            move_cursor(row_, n - 1);
+            break;
+        case 'd':
+            move_cursor(n - 1, col_);
+            break;
+        case 'H':
+        case 'f':
+            move_cursor(n - 1, param(1, 1) - 1);
+            break;
+        case 'J': {
+            // 2 also homes the cursor, as the Kotlin terminal did and some
+            // CP/M programs expect
+            int mode = param(0, 0);
+            int col = std::min(col_, cols_ - 1);
+            if (mode == 0) {
+                erase(row_, col, cols_);
+                erase_rows(row_ + 1, rows_);
+            } else if (mode == 1) {
+                erase(row_, 0, col + 1);
+                erase_rows(0, row_);
+            } else if (mode == 2) {
+                clear();
+            }
+            break;
+        }
+        case 'K': {
+            int mode = param(0, 0);
+            int col = std::min(col_, cols_ - 1);
+            if (mode == 0) {
+                erase(row_, col, cols_);
+            } else if (mode == 1) {
+                erase(row_, 0, col + 1);
+            } else if (mode == 2) {
+                erase(row_, 0, cols_);
+            }
+            break;
+        }
+        case 'm':
+            for (int i = 0; i < std::max(param_count_, 1); i++) {
+                int p = i < param_count_ ? std::max(params_[i], 0) : 0;
+                if (p == 0 || p == 39) {
+                    attr_ = TERM_FG_DEFAULT;
+                } else if (p >= 30 && p <= 37) {
+                    attr_ = ANSI_TO_CGA[p - 30];
+                } else if (p >= 90 && p <= 97) {
+                    attr_ = ANSI_TO_CGA[p - 90] + 8;
+                }
+            }
+            break;
+        case 's':
+            saved_row_ = row_;
+            saved_col_ = col_;
+            break;
+        case 'u':
+            move_cursor(saved_row_, saved_col_);
+            break;
+        default:
+            break;
+    }
+}
@@ -0,0 +1,182 @@
+/*
+ * VT100/ANSI Terminal
+ *
+ * Screen model for the console: a table-driven parser for the VT100/ANSI
+ * subset CP/M software uses, drawing into a grid of packed cells (character
+ * in the low byte, attribute in the high byte). Guest output is parsed on
+ * the CPU thread as it is written and emu_video_* draw into the same grid,
+ * so the cursor and screen contents have a single owner. The UI only
+ * renders what publish() reports changed: whole-screen scrolls as a row
+ * count, then a column span per damaged row.
+ *
+ * Jump scroll (the default): however much output arrives between frames,
+ * it is all applied here and the frame carries only the final screen plus
+ * the last SCROLLBACK_DELTA lines that scrolled off the top, so bulk
+ * output never waits on the display. Smooth scroll (DECSCLM, CSI ?4h)
+ * instead has the JNI layer end the run batch once a screenful has
+ * scrolled, pacing the guest to one screenful per frame.
+ *
+ * Supported: CR, LF, BS, HT, BEL; ESC 7/8 (save/restore cursor), ESC D/E/M
+ * (index, next line, reverse index), ESC c (reset); CSI A B C D G H d f
+ * (cursor), J K (erase), m (colours 30-37, 90-97, 39, 0), s u, ?4 h/l
+ * (smooth/jump scroll) and ?25 h/l (cursor visibility). Anything else is
+ * parsed and ignored.
+ *
+ * Not thread safe; the JNI layer uses it from the CPU thread only.
+ */
+
+#ifndef TERMINAL_H
+#define TERMINAL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Cell attribute: a CGA colour index 0-15, or the terminal's own default
+static const uint8_t TERM_FG_DEFAULT = 16;
+
+static inline uint16_t term_cell(uint8_t ch, uint8_t attr) {
+    return static_cast<uint16_t>(ch | attr << 8);
+}
+
+// Published frame, all in host byte order: TERM_FRAME_HEADER bytes of
+// int32 fields, then TERM_FRAME_SPANS spans, each a uint16 row, first
+// column and count followed by that many cells, then TERM_FRAME_SCROLLBACK
+// lines of cols cells, oldest first. To update a copy of the previous
+// frame, move its rows up by TERM_FRAME_SCROLL (down if negative, blanking
+// the rows uncovered) and then copy in the spans. A frame with
+// TERM_FLAG_FULL has a span for every row and replaces the copy outright.
+// The scrollback lines are the most recent of the TERM_FRAME_SCROLLED_OFF
+// lines that left the top of the screen since the previous frame.
+enum {
+    TERM_FRAME_ROWS,
+    TERM_FRAME_COLS,
+    TERM_FRAME_CURSOR_ROW,
+    TERM_FRAME_CURSOR_COL,   // May equal cols after the last column is written
+    TERM_FRAME_FLAGS,
+    TERM_FRAME_BELLS,        // BEL characters since the previous frame
+    TERM_FRAME_SCROLL,
+    TERM_FRAME_SPANS,
+    TERM_FRAME_SCROLLBACK,
+    TERM_FRAME_SCROLLED_OFF,
+    TERM_FRAME_FIELDS,
+};
+static const size_t TERM_FRAME_HEADER = TERM_FRAME_FIELDS * sizeof(int32_t);
+static const size_t TERM_SPAN_HEADER = 3 * sizeof(uint16_t);
+static const int32_t TERM_FLAG_CURSOR_VISIBLE = 1;
+static const int32_t TERM_FLAG_FULL = 2;
+
+class Terminal {
+public:
+    static constexpr int MIN_ROWS = 24;
+    static constexpr int MIN_COLS = 80;
+    static constexpr int MAX_ROWS = 255;
+    static constexpr int MAX_COLS = 255;
+
+    // Scrolled-off lines kept for the next frame
+    static constexpr int SCROLLBACK_DELTA = 256;
+
+    // Largest frame publish() can produce
+    static constexpr size_t MAX_FRAME =
+        TERM_FRAME_HEADER + MAX_ROWS * (TERM_SPAN_HEADER + MAX_COLS * sizeof(uint16_t)) +
+        SCROLLBACK_DELTA * MAX_COLS * sizeof(uint16_t);
+
+    Terminal();
+
+    // Keeps the top-left of the screen. wrap_cols is the column printing
+    // wraps at (the visible width), or 0 to drop characters past the edge.
+    void resize(int rows, int cols, int wrap_cols);
+
+    // Blank screen, cursor home and visible, default colour, parser idle
+    void reset();
+
+    void write(const uint8_t* data, size_t count);
+
+    // emu_video_* operations
+    void clear();
+    void move_cursor(int row, int col);
+    void scroll_up(int lines);
+
+    int rows() const { return rows_; }
+    int cols() const { return cols_; }
+    int cursor_row() const { return row_; }
+    int cursor_col() const { return col_; }
+    uint8_t attr() const { return attr_; }
+    void set_attr(uint8_t attr) { attr_ = attr; }
+    const uint16_t* cells() const { return cells_.data(); }
+
+    // Copy a saved grid over the top-left of the screen
+    void load_cells(int rows, int cols, const uint16_t* cells);
+
+    // True if anything visible changed since the last publish()
+    bool changed() const { return changed_; }
+
+    // Lines scrolled off the top since the last publish()
+    int scrolled_off() const { return scrolled_off_; }
+    bool jump_scroll() const { return jump_scroll_; }
+
+    // Make the next publish() a full frame, e.g. for a new viewer
+    void invalidate() { damage_all(); }
+
+    // Write the changes since the last publish() to out (MAX_FRAME bytes)
+    // and start tracking afresh. Returns the bytes written.
+    size_t publish(uint8_t* out);
+
+private:
+    static const int MAX_PARAMS = 16;
+
+    void execute(uint8_t ch);
+    void print(uint8_t ch);
+    void escape_dispatch(uint8_t ch);
+    void csi_dispatch(uint8_t ch);
+    int param(int index, int fallback) const;
+
+    void new_line();
+    void reverse_index();
+    void scroll(int lines);
+    void erase(int row, int from, int to);
+    void erase_rows(int from, int to);
+
+    void save_scrollback(int lines);
+    void damage(int row, int from, int to);
+    void damage_all();
+    void scroll_damage(int lines);
+
+    std::vector<uint16_t> cells_;
+    int rows_ = MIN_ROWS;
+    int cols_ = MIN_COLS;
+    int wrap_cols_ = 0;
+    int row_ = 0;
+    int col_ = 0;
+    int saved_row_ = 0;
+    int saved_col_ = 0;
+    uint8_t attr_ = TERM_FG_DEFAULT;
+    bool cursor_visible_ = true;
+
+    uint8_t state_ = 0;  // Parser state, see terminal.cpp
+    bool private_ = false;
+    int params_[MAX_PARAMS];
+    int param_count_ = 0;
+
+    // Damage since the last publish(): a bitmap of changed rows with the
+    // changed columns of each, and the rows scrolled up (negative: down)
+    // before those changes. full_ stands for every row and no scroll.
+    std::vector<uint64_t> dirty_rows_;
+    std::vector<uint8_t> dirty_from_;
+    std::vector<uint8_t> dirty_to_;
+    int scrolled_ = 0;
+    bool full_ = true;
+
+    // Ring of SCROLLBACK_DELTA lines, the last scrollback_count_ of them
+    // ending before scrollback_next_ scrolled off since the last publish()
+    std::vector<uint16_t> scrollback_;
+    int scrollback_next_ = 0;
+    int scrollback_count_ = 0;
+    int scrolled_off_ = 0;
+    bool jump_scroll_ = true;
+
+    bool changed_ = true;
+    uint32_t bells_ = 0;
+};
+
+#endif // TERMINAL_H
@@ -0,0 +1,97 @@
+/*
+ * Execution Trace Ring
+ */
+
+#include "trace_ring.h"
+#include "emu_io.h"
+#include "pc_profile.h"
+#include "z80_timing.h"
+
+#include <cstdio>
+
+TraceRing::TraceRing(size_t records) {
+    size_t capacity = 1;
+    while (capacity < records) capacity <<= 1;
+    records_.resize(capacity);
+    mask_ = capacity - 1;
+}
+
+static void format_record(const trace_record& r, std::string* out) {
+    char what[32];
+    switch (r.kind) {
+        case TRACE_INSN: {
+            uint8_t op[4] = {static_cast<uint8_t>(r.data), static_cast<uint8_t>(r.data >> 8),
+                             static_cast<uint8_t>(r.data >> 16), static_cast<uint8_t>(r.data >> 24)};
+            int length = z80_decode_timing(op).length;
+            int n = 0;
+            for (int i = 0; i < length && i < 4; i++) {
+                n += snprintf(what + n, sizeof(what) - n, i ? " %02X" : "%02X", op[i]);
+            }
+            break;
+        }
+        case TRACE_HBIOS_CALL:
+            snprintf(what, sizeof(what), "HBIOS %s",
+                     hbios_function_name(static_cast<uint8_t>(r.bc >> 8)));
+            break;
+        case TRACE_HBIOS_RETURN:
+            snprintf(what, sizeof(what), "HBIOS ret A=%02X", r.af >> 8);
+            break;
+        case TRACE_PORT: {
+            // IN is DB, or ED with bit 0 clear (IN r,(C), INI, IND and repeats)
+            uint8_t op = r.data & 0xFF;
+            bool in = op == 0xDB || (op == 0xED && ((r.data >> 8) & 0x01) == 0);
+            snprintf(what, sizeof(what), "port %s", in ? "in" : "out");
+            break;
+        }
+        case TRACE_NOTE: {
+            const char* fmt;
+            memcpy(&fmt, &r.af, sizeof(fmt));
+            char line[300];
+            snprintf(line, sizeof(line), "%02X:%04X  ; %.256s\n", r.bank, r.pc, fmt);
+            *out += line;
+            return;
+        }
+        default:
+            snprintf(what, sizeof(what), "?");
+            break;
+    }
+    char line[128];
+    snprintf(line, sizeof(line), "%02X:%04X  %-16s AF=%04X BC=%04X DE=%04X HL=%04X\n",
+             r.bank, r.pc, what, r.af, r.bc, r.de, r.hl);
+    *out += line;
+}
+
+std::string TraceRing::format(size_t count) const {
+    size_t kept = size();
+    if (count == 0 || count > kept) count = kept;
+    std::string out;
+    out.reserve(count * 64);
+    for (uint64_t i = written_ - count; i < written_; i++) {
+        format_record(records_[i & mask_], &out);
+    }
+    return out;
+}
+
+long TraceRing::dump(const std::string& path, size_t count) const {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) {
+        emu_error("Cannot write trace %s", path.c_str());
+        return -1;
+    }
+    size_t kept = size();
+    if (count == 0 || count > kept) count = kept;
+    fprintf(f, "; %zu of %llu records, oldest first\n", count,
+            static_cast<unsigned long long>(written_));
+    // In chunks, so a full ring doesn't need its whole text in memory
+    std::string text;
+    for (uint64_t i = written_ - count; i < written_; i++) {
+        format_record(records_[i & mask_], &text);
+        if (text.size() >= 65536) {
+            fwrite(text.data(), 1, text.size(), f);
+            text.clear();
+        }
+    }
+    fwrite(text.data(), 1, text.size(), f);
+    bool ok = fclose(f) == 0;
+    return ok ? static_cast<long>(count) : -1;
+}
@@ -0,0 +1,96 @@
+/*
+ * Execution Trace Ring
+ *
+ * Fixed-size ring of 16-byte binary records written by the run loop: each
+ * instruction (PC, bank, opcode bytes, AF/BC/DE/HL), HBIOS calls and
+ * returns, and port I/O. Nothing is formatted while running; dump() turns
+ * the last N records into text afterwards, so a million-instruction
+ * history before a crash or hang costs a store per instruction.
+ *
+ * Written and dumped on the emulator thread only.
+ */
+
+#ifndef TRACE_RING_H
+#define TRACE_RING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "qkz80.h"
+
+enum : uint8_t {
+    TRACE_INSN,          // Before execution; data = first 4 opcode bytes
+    TRACE_HBIOS_CALL,    // At HB_INVOKE; B = function, C = unit
+    TRACE_HBIOS_RETURN,  // After the call; A = status, PC = return address
+    TRACE_PORT,          // After IN/OUT; data = opcode bytes, registers after
+    TRACE_NOTE,          // Debug log format string (arguments not kept)
+};
+
+struct trace_record {
+    uint8_t kind;
+    uint8_t bank;
+    uint16_t pc;
+    uint32_t data;
+    uint16_t af, bc, de, hl;
+};
+
+class TraceRing {
+public:
+    static const size_t DEFAULT_RECORDS = 1 << 20;
+
+    // Capacity is rounded up to a power of two
+    explicit TraceRing(size_t records = DEFAULT_RECORDS);
+
+    void record(uint8_t kind, uint8_t bank, uint16_t pc, uint32_t data,
+                const qkz80_reg_set& regs) {
+        trace_record& r = records_[written_++ & mask_];
+        r.kind = kind;
+        r.bank = bank;
+        r.pc = pc;
+        r.data = data;
+        r.af = regs.AF.get_pair16();
+        r.bc = regs.BC.get_pair16();
+        r.de = regs.DE.get_pair16();
+        r.hl = regs.HL.get_pair16();
+        last_pc_ = pc;
+        last_bank_ = bank;
+    }
+
+    // Log message at the last recorded PC. fmt must be a string literal
+    // (or otherwise outlive the ring); only the pointer is stored.
+    void note(const char* fmt) {
+        trace_record& r = records_[written_++ & mask_];
+        r.kind = TRACE_NOTE;
+        r.bank = last_bank_;
+        r.pc = last_pc_;
+        r.data = 0;
+        memcpy(&r.af, &fmt, sizeof(fmt));
+    }
+
+    size_t capacity() const { return records_.size(); }
+    size_t size() const { return written_ < records_.size() ? written_ : records_.size(); }
+    uint64_t written() const { return written_; }
+    void clear() { written_ = 0; }
+
+    // Format the last count records (0 = all kept), oldest first
+    std::string format(size_t count) const;
+
+    // Write format(count) to path. Returns the number of records written,
+    // or -1 if the file can't be created.
+    long dump(const std::string& path, size_t count) const;
+
+private:
+    static_assert(sizeof(trace_record) == 16, "trace_record must stay 16 bytes");
+    static_assert(sizeof(const char*) <= 8, "note pointer must fit AF..HL");
+
+    std::vector<trace_record> records_;
+    size_t mask_;
+    uint64_t written_ = 0;
+    uint16_t last_pc_ = 0;
+    uint8_t last_bank_ = 0;
+};
+
+#endif // TRACE_RING_H
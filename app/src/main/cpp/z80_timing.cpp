@@ -0,0 +1,150 @@
+/*
+ * Z80 Instruction Timing
+ *
+ * Timings follow the Zilog Z80 CPU User Manual. Conditional instructions
+ * are listed with their not-taken time; the run loop adds taken_extra when
+ * the PC after execution is not the next sequential instruction.
+ */
+
+#include "z80_timing.h"
+
+//=============================================================================
+// Unprefixed Opcode Tables
+//=============================================================================
+
+// T-states (not-taken time for conditionals, 0 for prefix bytes)
+static const uint8_t base_tstates[256] = {
+    //  0   1   2   3   4   5   6   7   8   9   A   B   C   D   E   F
+        4, 10,  7,  6,  4,  4,  7,  4,  4, 11,  7,  6,  4,  4,  7,  4,  // 0x
+        8, 10,  7,  6,  4,  4,  7,  4, 12, 11,  7,  6,  4,  4,  7,  4,  // 1x
+        7, 10, 16,  6,  4,  4,  7,  4,  7, 11, 16,  6,  4,  4,  7,  4,  // 2x
+        7, 10, 13,  6, 11, 11, 10,  4,  7, 11, 13,  6,  4,  4,  7,  4,  // 3x
+        4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // 4x
+        4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // 5x
+        4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // 6x
+        7,  7,  7,  7,  7,  7,  4,  7,  4,  4,  4,  4,  4,  4,  7,  4,  // 7x
+        4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // 8x
+        4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // 9x
+        4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // Ax
+        4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // Bx
+        5, 10, 10, 10, 10, 11,  7, 11,  5, 10, 10,  0, 10, 17,  7, 11,  // Cx
+        5, 10, 10, 11, 10, 11,  7, 11,  5,  4, 10, 11, 10,  0,  7, 11,  // Dx
+        5, 10, 10, 19, 10, 11,  7, 11,  5,  4, 10,  4, 10,  0,  7, 11,  // Ex
+        5, 10, 10,  4, 10, 11,  7, 11,  5,  6, 10,  4, 10,  0,  7, 11,  // Fx
+};
+
+// Instruction length in bytes
+static const uint8_t base_length[256] = {
+    //  0   1   2   3   4   5   6   7   8   9   A   B   C   D   E   F
+        1,  3,  1,  1,  1,  1,  2,  1,  1,  1,  1,  1,  1,  1,  2,  1,  // 0x
+        2,  3,  1,  1,  1,  1,  2,  1,  2,  1,  1,  1,  1,  1,  2,  1,  // 1x
+        2,  3,  3,  1,  1,  1,  2,  1,  2,  1,  3,  1,  1,  1,  2,  1,  // 2x
+        2,  3,  3,  1,  1,  1,  2,  1,  2,  1,  3,  1,  1,  1,  2,  1,  // 3x
+        1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  // 4x
+        1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  // 5x
+        1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  // 6x
+        1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  // 7x
+        1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  // 8x
+        1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  // 9x
+        1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  // Ax
+        1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  // Bx
+        1,  1,  3,  3,  3,  1,  2,  1,  1,  1,  3,  2,  3,  3,  2,  1,  // Cx
+        1,  1,  3,  2,  3,  1,  2,  1,  1,  1,  3,  2,  3,  1,  2,  1,  // Dx
+        1,  1,  3,  1,  3,  1,  2,  1,  1,  1,  3,  1,  3,  1,  2,  1,  // Ex
+        1,  1,  3,  1,  3,  1,  2,  1,  1,  1,  3,  1,  3,  1,  2,  1,  // Fx
+};
+
+static uint8_t base_taken_extra(uint8_t op) {
+    if (op == 0x10) return 5;                                  // DJNZ
+    if (op == 0x20 || op == 0x28 || op == 0x30 || op == 0x38)  // JR cc
+        return 5;
+    if ((op & 0xC7) == 0xC0) return 6;                         // RET cc
+    if ((op & 0xC7) == 0xC4) return 7;                         // CALL cc
+    return 0;
+}
+
+static z80_timing decode_unprefixed(uint8_t op) {
+    z80_timing t;
+    t.length = base_length[op];
+    t.tstates = base_tstates[op];
+    t.taken_extra = base_taken_extra(op);
+    return t;
+}
+
+// (HL) memory forms, which take a displacement byte under DD/FD
+static bool is_hl_memory_op(uint8_t op) {
+    if (op == 0x34 || op == 0x35 || op == 0x36) return true;
+    if (op == 0x76) return false;                              // HALT
+    if (op >= 0x40 && op <= 0x7F) return (op & 0x07) == 6 || (op & 0xF8) == 0x70;
+    if (op >= 0x80 && op <= 0xBF) return (op & 0x07) == 6;
+    return false;
+}
+
+//=============================================================================
+// Prefixed Opcodes
+//=============================================================================
+
+static z80_timing decode_cb(uint8_t op) {
+    if ((op & 0x07) != 6) return {2, 8, 0};
+    bool bit = (op & 0xC0) == 0x40;
+    return {2, static_cast<uint8_t>(bit ? 12 : 15), 0};
+}
+
+static z80_timing decode_ed(uint8_t op) {
+    if (op >= 0x40 && op <= 0x7F) {
+        switch (op & 0x07) {
+            case 0: case 1: return {2, 12, 0};             // IN r,(C) / OUT (C),r
+            case 2: return {2, 15, 0};                     // SBC/ADC HL,rr
+            case 3: return {4, 20, 0};                     // LD (nn),rr / LD rr,(nn)
+            case 5: return {2, 14, 0};                     // RETN / RETI
+            case 7:
+                if (op == 0x47 || op == 0x4F || op == 0x57 || op == 0x5F) return {2, 9, 0};
+                if (op == 0x67 || op == 0x6F) return {2, 18, 0};  // RRD / RLD
+                return {2, 8, 0};
+            default: return {2, 8, 0};                     // NEG / IM n
+        }
+    }
+    // LDI/CPI/INI/OUTI and friends; the B0-BB forms repeat
+    if ((op & 0xE4) == 0xA0) {
+        return {2, 16, static_cast<uint8_t>(op >= 0xB0 ? 5 : 0)};
+    }
+    return {2, 8, 0};  // Undefined ED opcodes act as two NOPs
+}
+
+// DD/FD: HL becomes IX/IY (+4 T-states), (HL) becomes (IX+d) (+12 and a
+// displacement byte), anything else runs as the unprefixed opcode plus 4.
+static z80_timing decode_index(const uint8_t* op) {
+    uint8_t code = op[1];
+    if (code == 0xCB) {
+        bool bit = (op[3] & 0xC0) == 0x40;
+        return {4, static_cast<uint8_t>(bit ? 20 : 23), 0};
+    }
+    if (code == 0xDD || code == 0xED || code == 0xFD) {
+        return {1, 4, 0};  // Prefix is discarded; the next one is decoded on its own
+    }
+    z80_timing t = decode_unprefixed(code);
+    if (is_hl_memory_op(code)) {
+        if (code == 0x36) return {4, 19, 0};  // LD (IX+d),n
+        return {static_cast<uint8_t>(t.length + 2), static_cast<uint8_t>(t.tstates + 12), 0};
+    }
+    return {static_cast<uint8_t>(t.length + 1), static_cast<uint8_t>(t.tstates + 4), t.taken_extra};
+}
+
+z80_timing z80_decode_timing(const uint8_t* op) {
+    switch (op[0]) {
+        case 0xCB: return decode_cb(op[1]);
+        case 0xED: return decode_ed(op[1]);
+        case 0xDD:
+        case 0xFD: return decode_index(op);
+        default:   return decode_unprefixed(op[0]);
+    }
+}
+
+bool z80_is_port_io(uint32_t word) {
+    uint8_t op = word & 0xFF;
+    if (op == 0xD3 || op == 0xDB) return true;  // OUT (n),A / IN A,(n)
+    if (op != 0xED) return false;
+    uint8_t ed = (word >> 8) & 0xFF;
+    if (ed >= 0x40 && ed <= 0x7F) return (ed & 0x07) <= 1;  // IN r,(C) / OUT (C),r
+    return (ed & 0xE6) == 0xA2;                             // INI/OUTI and repeats
+}
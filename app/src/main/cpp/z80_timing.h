@@ -0,0 +1,29 @@
+/*
+ * Z80 Instruction Timing
+ *
+ * T-state and length tables for the documented Z80 instruction set,
+ * including CB/ED/DD/FD/DDCB/FDCB prefixes. qkz80 executes instructions
+ * but does not report cycles, so the run loop decodes the opcode bytes
+ * at PC to account emulated time.
+ */
+
+#ifndef Z80_TIMING_H
+#define Z80_TIMING_H
+
+#include <cstdint>
+
+struct z80_timing {
+    uint8_t length;       // Instruction length in bytes
+    uint8_t tstates;      // T-states when not taken / not repeating
+    uint8_t taken_extra;  // Added when a conditional branch is taken or a block op repeats
+};
+
+// Decode timing for the instruction starting at op[0]. op must hold at
+// least 4 bytes (the longest prefixed form).
+z80_timing z80_decode_timing(const uint8_t* op);
+
+// True for port I/O (IN/OUT, INI/OUTI and repeats). word holds the first
+// 4 instruction bytes, little-endian.
+bool z80_is_port_io(uint32_t word);
+
+#endif // Z80_TIMING_H
@@ -1,12 +1,17 @@
 package com.awohl.cpmdroid
 
+import android.os.ParcelFileDescriptor
 import android.util.Log
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
 import java.util.concurrent.atomic.AtomicBoolean
+import java.util.concurrent.atomic.AtomicInteger
 
 class EmulatorEngine {
     companion object {
         private const val TAG = "EmulatorEngine"
-        private const val INSTRUCTIONS_PER_BATCH = 50000
+        // Wall-clock budget per batch, leaving the rest of the 16ms frame to the UI
+        private const val FRAME_BUDGET_US = 12000
 
         // Host file state constants (must match emu_io.h)
         const val HOST_FILE_IDLE = 0
@@ -18,23 +23,88 @@ class EmulatorEngine {
         init {
             System.loadLibrary("cpmdroid")
         }
+
+        /**
+         * Convert a raw disk image to the sparse block-compressed container.
+         * Returns the container size, or -1 on failure (output is not created).
+         */
+        fun packDisk(input: String, output: String): Long = nativePackDisk(input, output)
+
+        /**
+         * Write the raw image held by a packed disk to output, for use outside
+         * the app; a raw input is copied as it is. Returns the image size, or
+         * -1 on failure (output is not created).
+         */
+        fun unpackDisk(input: String, output: String): Long = nativeUnpackDisk(input, output)
+
+        @JvmStatic private external fun nativePackDisk(input: String, output: String): Long
+        @JvmStatic private external fun nativeUnpackDisk(input: String, output: String): Long
     }
 
     private val running = AtomicBoolean(false)
-    private var outputListener: ((ByteArray) -> Unit)? = null
+
+    // All input producers (keys, paste top-ups) hold this lock, keeping the
+    // native input ring single-producer
+    private val inputLock = Any()
+    // Pasted text the native ring could not take yet
+    private var pendingPaste: ByteArray? = null
+    private var pendingPasteOffset = 0
+
+    // When set, pasted text is released one line at a time, each only after
+    // the guest has read everything before it
+    @Volatile var pastePacing = false
+
+    // Screen frame shared with native code, which runs the terminal. At the
+    // end of a batch native publishes a new frame only once drainScreen() has
+    // copied out the last one (the displayed frame number goes back with each
+    // batch), so the buffer is never written while it is being read.
+    private var screenBuffer: ByteBuffer? = null
+    private val publishedFrame = AtomicInteger(0)
+    private val displayedFrame = AtomicInteger(0)
+
+    // Filled by nativeRunTimed: [0] instructions executed, [1] elapsed microseconds,
+    // [2] T-states executed (only counted when the clock is throttled),
+    // [3] latest screen frame number
+    private val runStats = LongArray(4)
 
     // Native methods
     private external fun nativeInit()
     private external fun nativeDestroy()
     private external fun nativeLoadRom(romData: ByteArray): Boolean
-    private external fun nativeLoadDisk(unit: Int, diskData: ByteArray): Boolean
+    private external fun nativeOpenDisk(unit: Int, path: String, shared: Boolean,
+                                        persistPath: String): Boolean
+    private external fun nativeOpenDiskFd(unit: Int, fd: Int, name: String, shared: Boolean,
+                                          persistPath: String): Boolean
+    private external fun nativeSaveDisk(unit: Int, path: String): Long
+    private external fun nativeDiskStoreReport(): String
+    private external fun nativeGetRssKb(): Long
     private external fun nativeCompleteInit()
-    private external fun nativeRun(instructionCount: Int)
+    private external fun nativeRun(instructionCount: Int, displayedFrame: Int): Int
+    private external fun nativeRunTimed(budgetMicros: Int, stats: LongArray, displayedFrame: Int)
+    private external fun nativeGetScreenBuffer(): ByteBuffer?
+    private external fun nativeSetTerminalSize(rows: Int, cols: Int, wrapCols: Int)
+    private external fun nativeTerminalWrite(data: ByteArray)
+    private external fun nativeSetClockHz(hz: Int)
+    private external fun nativeGetAchievedMHz(): Double
     private external fun nativeStop()
     private external fun nativeIsWaitingForInput(): Boolean
     private external fun nativeQueueInput(ch: Int)
     private external fun nativeQueueInputString(str: String)
+    private external fun nativeQueueInputBytes(data: ByteArray, offset: Int, length: Int): Int
+    private external fun nativeGetInputPending(): Int
     private external fun nativeReset()
+    private external fun nativeSaveState(path: String): Boolean
+    private external fun nativeRestoreState(path: String): Boolean
+    private external fun nativeCheckpoint(): Int
+    private external fun nativeStopCheckpoints()
+    private external fun nativePrepareResume(path: String)
+    private external fun nativeProfileStart(interval: Int, countHbios: Boolean)
+    private external fun nativeProfileStop()
+    private external fun nativeProfileLoadSymbols(path: String): Int
+    private external fun nativeProfileReport(top: Int): String
+    private external fun nativeTraceStart(records: Int, crashPath: String)
+    private external fun nativeTraceStop()
+    private external fun nativeTraceDump(path: String, count: Int): Long
     private external fun nativeSetDiskSliceCount(unit: Int, slices: Int)
     private external fun nativeIsDiskLoaded(unit: Int): Boolean
 
@@ -61,16 +131,20 @@ class EmulatorEngine {
     // Disk persistence native methods
     private external fun nativeIsDiskDirty(unit: Int): Boolean
     private external fun nativeClearDiskDirty(unit: Int)
-    private external fun nativeGetDiskData(unit: Int): ByteArray?
 
     fun init() {
         Log.i(TAG, "Initializing emulator engine")
         nativeInit()
+        screenBuffer = nativeGetScreenBuffer()?.order(ByteOrder.nativeOrder())
+        publishedFrame.set(0)
+        displayedFrame.set(0)
     }
 
     fun destroy() {
         Log.i(TAG, "Destroying emulator engine")
         stop()
+        // The buffer is freed by nativeDestroy
+        screenBuffer = null
         nativeDestroy()
     }
 
@@ -79,9 +153,28 @@ class EmulatorEngine {
         return nativeLoadRom(romData)
     }
 
-    fun loadDisk(unit: Int, diskData: ByteArray): Boolean {
-        Log.i(TAG, "Loading disk unit $unit: ${diskData.size} bytes")
-        return nativeLoadDisk(unit, diskData)
+    /**
+     * Mount an image file on unit. The file is memory-mapped rather than read:
+     * with shared = true writes go straight to the file, otherwise they stay
+     * in a private copy until saved via saveDisk(). Every write is also
+     * journaled next to persistPath within milliseconds, and a journal left by
+     * a killed process is replayed into the disk here.
+     */
+    fun openDisk(unit: Int, path: String, shared: Boolean, persistPath: String): Boolean {
+        Log.i(TAG, "Opening disk unit $unit: $path (shared=$shared)")
+        return nativeOpenDisk(unit, path, shared, persistPath)
+    }
+
+    /**
+     * Mount an image reached through a descriptor, e.g. a document from the
+     * storage framework. Paged in like openDisk(); the descriptor is
+     * duplicated, so the caller may close pfd afterwards. name identifies
+     * the image (remounting the same name reuses the mapping).
+     */
+    fun openDisk(unit: Int, pfd: ParcelFileDescriptor, name: String, shared: Boolean,
+                 persistPath: String): Boolean {
+        Log.i(TAG, "Opening disk unit $unit: $name via fd (shared=$shared)")
+        return nativeOpenDiskFd(unit, pfd.fd, name, shared, persistPath)
     }
 
     fun completeInit() {
@@ -89,30 +182,103 @@ class EmulatorEngine {
         nativeCompleteInit()
     }
 
-    fun setOutputListener(listener: (ByteArray) -> Unit) {
-        outputListener = listener
+    /** True if the last batch published a frame that drainScreen() hasn't consumed */
+    fun hasScreenUpdate(): Boolean = publishedFrame.get() != displayedFrame.get()
+
+    /**
+     * Pass the latest screen frame (see terminal.h for the layout) to
+     * consumer, if there is a new one. The buffer is only valid during the
+     * call. Call from a single consumer thread (the UI thread).
+     */
+    fun drainScreen(consumer: (ByteBuffer) -> Unit) {
+        val buffer = screenBuffer ?: return
+        val frame = publishedFrame.get()
+        if (frame == displayedFrame.get()) return
+        consumer(buffer)
+        displayedFrame.set(frame)
+    }
+
+    /**
+     * Size the native terminal to what the view shows. wrapCols is the
+     * column output wraps at, or 0 to truncate long lines at cols.
+     * Takes effect at the next batch.
+     */
+    fun setTerminalSize(rows: Int, cols: Int, wrapCols: Int) {
+        nativeSetTerminalSize(rows, cols, wrapCols)
     }
 
-    // Called from native code
-    @Suppress("unused")
-    fun onOutput(data: ByteArray) {
-        outputListener?.invoke(data)
+    /** Show text on the terminal as if the guest had written it */
+    fun writeTerminal(data: ByteArray) {
+        nativeTerminalWrite(data)
     }
 
     fun queueInput(ch: Int) {
-        nativeQueueInput(ch)
+        synchronized(inputLock) { nativeQueueInput(ch) }
     }
 
     fun queueInputString(str: String) {
-        nativeQueueInputString(str)
+        synchronized(inputLock) { nativeQueueInputString(str) }
+    }
+
+    /**
+     * Queue a block of pasted text. Whatever does not fit in the native
+     * input ring is held here and fed in as the guest reads, so nothing is
+     * dropped however large the paste.
+     */
+    fun queuePaste(data: ByteArray) {
+        synchronized(inputLock) {
+            val pending = pendingPaste
+            pendingPaste = pending?.copyOfRange(pendingPasteOffset, pending.size)?.plus(data) ?: data
+            pendingPasteOffset = 0
+            feedPaste()
+        }
     }
 
+    fun hasPendingPaste(): Boolean = synchronized(inputLock) { pendingPaste != null }
+
+    // Caller holds inputLock
+    private fun feedPaste() {
+        val data = pendingPaste ?: return
+        var end = data.size
+        if (pastePacing) {
+            if (nativeGetInputPending() > 0) return
+            // Release through the next line ending
+            var i = pendingPasteOffset
+            while (i < data.size && data[i] != '\r'.code.toByte() && data[i] != '\n'.code.toByte()) i++
+            end = minOf(i + 1, data.size)
+        }
+        pendingPasteOffset += nativeQueueInputBytes(data, pendingPasteOffset, end - pendingPasteOffset)
+        if (pendingPasteOffset >= data.size) {
+            pendingPaste = null
+            pendingPasteOffset = 0
+        }
+    }
+
+    /** Run for one frame's time budget; see lastBatchInstructions/lastBatchMicros */
     fun runBatch(): Boolean {
         if (!running.get()) return false
-        nativeRun(INSTRUCTIONS_PER_BATCH)
+        synchronized(inputLock) { feedPaste() }
+        nativeRunTimed(FRAME_BUDGET_US, runStats, displayedFrame.get())
+        publishedFrame.set(runStats[3].toInt())
         return running.get()
     }
 
+    /** Run a fixed number of instructions regardless of elapsed time */
+    fun runInstructions(instructionCount: Int): Boolean {
+        if (!running.get()) return false
+        publishedFrame.set(nativeRun(instructionCount, displayedFrame.get()))
+        return running.get()
+    }
+
+    val lastBatchInstructions: Long get() = runStats[0]
+    val lastBatchMicros: Long get() = runStats[1]
+    val lastBatchTStates: Long get() = runStats[2]
+
+    // Emulated Z80 clock: 0 = unlimited (full host speed), otherwise Hz to pace to
+    fun setClockHz(hz: Int) = nativeSetClockHz(hz)
+    // Clock actually achieved over the last second, 0 when unlimited
+    fun getAchievedMHz(): Double = nativeGetAchievedMHz()
+
     fun start() {
         running.set(true)
     }
@@ -123,9 +289,98 @@ class EmulatorEngine {
     }
 
     fun reset() {
+        synchronized(inputLock) {
+            pendingPaste = null
+            pendingPasteOffset = 0
+        }
         nativeReset()
     }
 
+    /**
+     * Snapshot the whole machine (CPU, memory, HBIOS and console state) to
+     * path and start a new checkpoint chain there. Call on the emulator
+     * thread between batches. Disk contents are not part of the snapshot;
+     * disk journals are compacted once it is written, and from then on
+     * only at checkpoints.
+     */
+    fun saveState(path: String): Boolean = nativeSaveState(path)
+
+    /**
+     * Append the memory pages changed since the last checkpoint to the chain
+     * started by saveState(); restoreState() replays them. Cheap enough to
+     * call every second from the emulator thread between batches. Returns
+     * the number of pages written, or -1 if no chain is active.
+     */
+    fun checkpoint(): Int = nativeCheckpoint()
+
+    /**
+     * Stop the checkpoint chain, e.g. when resume is turned off. Disk
+     * journals are then compacted by saveDisk() again rather than at
+     * checkpoints. Call on the emulator thread.
+     */
+    fun stopCheckpoints() = nativeStopCheckpoints()
+
+    /**
+     * Before mounting disks for a restoreState() of path: limit journal
+     * replay to the writes that state covers, so the disks are not ahead
+     * of the restored memory. Later writes are held in the journals until
+     * restoreState(), which drops them only if the restore succeeds.
+     */
+    fun prepareResume(path: String) = nativePrepareResume(path)
+
+    /**
+     * Sample the PC every interval instructions until stopProfile(),
+     * optionally counting HBIOS calls by function. Restarting discards
+     * the previous samples.
+     */
+    fun startProfile(interval: Int = 1000, countHbios: Boolean = false) =
+        nativeProfileStart(interval, countHbios)
+
+    fun stopProfile() = nativeProfileStop()
+
+    /**
+     * Load labels from a .SYM or .PRN/.LST file for profile reports.
+     * Returns the number of symbols, or -1 if the file can't be read.
+     */
+    fun loadProfileSymbols(path: String): Int = nativeProfileLoadSymbols(path)
+
+    /**
+     * Text report of the samples so far: time per CP/M region, the top
+     * addresses and ranges, and HBIOS functions. Call on the emulator
+     * thread, as it reads page zero to locate the CCP, BDOS and BIOS.
+     */
+    fun profileReport(top: Int = 20): String = nativeProfileReport(top)
+
+    /**
+     * Record every instruction, HBIOS call and port access into a native
+     * ring of the given size (16 bytes each; 0 = a million), written as
+     * text to crashPath ("" for none) if the core aborts. Call on the
+     * emulator thread between batches, like the other trace calls.
+     */
+    fun startTrace(records: Int = 0, crashPath: String = "") = nativeTraceStart(records, crashPath)
+
+    /** Stop recording; the ring is kept for dumpTrace() */
+    fun stopTrace() = nativeTraceStop()
+
+    /**
+     * Write the last count trace records (0 = all) to path as text, oldest
+     * first. Returns the number written, or -1 on failure.
+     */
+    fun dumpTrace(path: String, count: Int = 0): Long = nativeTraceDump(path, count)
+
+    /**
+     * Continue from a snapshot saved by saveState(). The same ROM must be
+     * loaded and the same disks mounted, after completeInit(). On false the
+     * machine should be reset.
+     */
+    fun restoreState(path: String): Boolean {
+        synchronized(inputLock) {
+            pendingPaste = null
+            pendingPasteOffset = 0
+            return nativeRestoreState(path)
+        }
+    }
+
     fun setDiskSliceCount(unit: Int, slices: Int) {
         nativeSetDiskSliceCount(unit, slices)
     }
@@ -163,10 +418,22 @@ class EmulatorEngine {
     fun checkManifestWriteWarning(): Boolean = nativeCheckManifestWriteWarning()
 
     // Disk persistence methods - for saving modified disks
-    // Check if disk has been modified since loading
+    // Check if disk has been modified since it was last saved successfully
     fun isDiskDirty(unit: Int): Boolean = nativeIsDiskDirty(unit)
-    // Clear dirty flag after saving disk
+    // Clear the guest-write flag before saving disk
     fun clearDiskDirty(unit: Int) = nativeClearDiskDirty(unit)
-    // Get disk data for saving (returns null if not an in-memory disk)
-    fun getDiskData(unit: Int): ByteArray? = nativeGetDiskData(unit)
+    /**
+     * Write the pages of unit changed since the last save to path, in place.
+     * Returns the number of bytes written, or -1 on failure.
+     */
+    fun saveDisk(unit: Int, path: String): Long = nativeSaveDisk(unit, path)
+
+    /**
+     * Blocks of packed disks held in memory, shared across units by content:
+     * bytes held, bytes referenced and the deduplication ratio.
+     */
+    fun diskStoreReport(): String = nativeDiskStoreReport()
+
+    /** Process resident set size in KB, or -1 if unavailable */
+    fun getRssKb(): Long = nativeGetRssKb()
 }
@@ -30,7 +30,9 @@ import com.awohl.cpmdroid.data.SettingsRepository
 import kotlinx.coroutines.launch
 import java.io.File
 import java.io.IOException
+import java.nio.ByteBuffer
 import java.util.concurrent.Executors
+import java.util.concurrent.TimeUnit
 
 class MainActivity : AppCompatActivity() {
 
@@ -83,6 +85,16 @@ class MainActivity : AppCompatActivity() {
     private var runLoopCount = 0
     private var lastNvramSaveCount = 0
     private var lastDiskSaveCount = 0
+    private var lastClockStatusCount = 0
+    private var lastCheckpointCount = 0
+    @Volatile private var checkpointsEnabled = false
+    private var clockHz = 0
+    // Allocated once so delivering screen frames creates no garbage
+    private val screenConsumer: (ByteBuffer) -> Unit = { buffer ->
+        terminalView.updateScreen(buffer)
+    }
+    private val drainScreen = Runnable { emulator.drainScreen(screenConsumer) }
+
     private val runLoop: Runnable = object : Runnable {
         override fun run() {
             if (running && romLoaded) {
@@ -92,8 +104,12 @@ class MainActivity : AppCompatActivity() {
                 }
                 executor.execute {
                     val shouldContinue = emulator.runBatch()
+                    if (emulator.hasScreenUpdate()) {
+                        mainHandler.post(drainScreen)
+                    }
                     if (runLoopCount <= 5) {
-                        Log.i(TAG, "runLoop #$runLoopCount: batch returned $shouldContinue")
+                        Log.i(TAG, "runLoop #$runLoopCount: batch returned $shouldContinue " +
+                            "(${emulator.lastBatchInstructions} instructions in ${emulator.lastBatchMicros}us)")
                     }
 
                     // Check host file state for R8/W8 transfers
@@ -105,6 +121,21 @@ class MainActivity : AppCompatActivity() {
                         saveNvramIfNeeded()
                     }
 
+                    // Show the achieved clock when throttled (~1 second = 60 iterations at 16ms)
+                    if (clockHz != 0 && runLoopCount - lastClockStatusCount >= 60) {
+                        lastClockStatusCount = runLoopCount
+                        val mhz = emulator.getAchievedMHz()
+                        if (mhz > 0.0) {
+                            mainHandler.post { updateStatus(mhz) }
+                        }
+                    }
+
+                    // Checkpoint changed memory for resume (~1 second = 60 iterations at 16ms)
+                    if (checkpointsEnabled && runLoopCount - lastCheckpointCount >= 60) {
+                        lastCheckpointCount = runLoopCount
+                        emulator.checkpoint()
+                    }
+
                     // Periodically save dirty disks (~20 seconds = 1250 iterations at 16ms)
                     if (runLoopCount - lastDiskSaveCount >= 1250) {
                         lastDiskSaveCount = runLoopCount
@@ -112,7 +143,12 @@ class MainActivity : AppCompatActivity() {
                     }
 
                     if (shouldContinue) {
-                        val delay = if (emulator.isWaitingForInput()) IDLE_DELAY_MS else FRAME_DELAY_MS
+                        // The batch already used part of the frame; only wait out the remainder
+                        val delay = if (emulator.isWaitingForInput() && !emulator.hasPendingPaste()) {
+                            IDLE_DELAY_MS
+                        } else {
+                            (FRAME_DELAY_MS - emulator.lastBatchMicros / 1000).coerceAtLeast(1L)
+                        }
                         mainHandler.postDelayed(self, delay)
                     } else {
                         Log.w(TAG, "runLoop: batch returned false, stopping")
@@ -262,11 +298,6 @@ class MainActivity : AppCompatActivity() {
 
     private fun setupEmulator() {
         emulator.init()
-        emulator.setOutputListener { data ->
-            mainHandler.post {
-                terminalView.processOutput(data)
-            }
-        }
         // Set up terminal input - characters typed go to emulator
         // with controlify conversion if Ctrl mode is active
         terminalView.setInputListener { ch ->
@@ -288,6 +319,15 @@ class MainActivity : AppCompatActivity() {
             emulator.queueInput(charToSend)
             wakeRunLoop()
         }
+        // Pasted text goes in as one block, fed to the guest as it reads
+        terminalView.setPasteListener { data ->
+            emulator.queuePaste(data)
+            wakeRunLoop()
+        }
+        // The native terminal follows the view's size
+        terminalView.setSizeListener { rows, cols, wrapCols ->
+            emulator.setTerminalSize(rows, cols, wrapCols)
+        }
     }
 
     private fun setupControlStrip() {
@@ -539,6 +579,8 @@ class MainActivity : AppCompatActivity() {
         terminalView.customFontSize = settings.fontSize.toFloat()
         terminalView.wrapLines = settings.wrapLines
         terminalView.soundEnabled = settingsRepo.isSoundEnabled()
+        applyClockSetting(settings.cpuClockHz)
+        emulator.pastePacing = settingsRepo.isPastePacingEnabled()
 
         // Log current settings for debugging
         Log.i(TAG, "Settings: ROM=${settings.romName}")
@@ -554,17 +596,27 @@ class MainActivity : AppCompatActivity() {
                 Log.i(TAG, "ROM loaded from assets: $romName (${romData.size} bytes)")
 
                 if (emulator.loadRom(romData)) {
+                    // Disks replay their journals only as far as the state resumed below
+                    if (settingsRepo.isResumeStateEnabled() && stateFile().exists()) {
+                        emulator.prepareResume(stateFile().path)
+                    }
+
                     // Load disks from external storage (prefer persisted versions over catalog)
+                    // All are mapped copy-on-write: writes reach the persisted copy through
+                    // the journal, which is compacted in step with the resume checkpoints
                     var diskCount = 0
+                    val rssBefore = emulator.getRssKb()
                     settings.diskSlots.forEachIndexed { index, filename ->
                         if (filename != null) {
-                            val (diskData, isPersisted) = downloadManager.loadDiskDataWithPersistence(filename)
-                            if (diskData != null) {
-                                if (emulator.loadDisk(index, diskData)) {
+                            val (diskFile, isPersisted) = downloadManager.resolveDiskFile(filename)
+                            if (diskFile != null) {
+                                val persistPath = downloadManager.getPersistedDiskFile(filename).path
+                                if (emulator.openDisk(index, diskFile.path, shared = false,
+                                        persistPath = persistPath)) {
                                     if (isPersisted) {
-                                        Log.i(TAG, "Disk $index loaded from persisted: $filename (${diskData.size} bytes)")
+                                        Log.i(TAG, "Disk $index mapped from persisted: $filename (${diskFile.length()} bytes)")
                                     } else {
-                                        Log.i(TAG, "Disk $index loaded from catalog: $filename (${diskData.size} bytes)")
+                                        Log.i(TAG, "Disk $index mapped from catalog: $filename (${diskFile.length()} bytes)")
                                     }
                                     // Mark all downloaded disks as manifest (warn once per session on write)
                                     emulator.setDiskIsManifest(index, true)
@@ -592,7 +644,8 @@ class MainActivity : AppCompatActivity() {
                         diskCount == 2 -> 4
                         else -> 2
                     }
-                    Log.i(TAG, "Disk count: $diskCount, auto slices: $autoSlices")
+                    Log.i(TAG, "Disk count: $diskCount, auto slices: $autoSlices, " +
+                        "RSS ${rssBefore}KB -> ${emulator.getRssKb()}KB")
 
                     for (i in 0 until 16) {
                         if (emulator.isDiskLoaded(i)) {
@@ -602,6 +655,10 @@ class MainActivity : AppCompatActivity() {
 
                     emulator.completeInit()
 
+                    // Continue from the state saved when the app was last closed
+                    val resumed = resumeSavedState()
+                    startCheckpoints()
+
                     // Restore NVRAM from saved preferences (for boot config persistence)
                     val savedNvramSetting = settingsRepo.getSavedNvramSetting()
                     if (!savedNvramSetting.isNullOrEmpty()) {
@@ -614,7 +671,9 @@ class MainActivity : AppCompatActivity() {
                     mainHandler.post {
                         // Display version string on terminal before ROM output
                         val versionBanner = "CPMDroid v${getVersionString()} (${BuildConfig.BUILD_TIME})\r\n"
-                        terminalView.processOutput(versionBanner.toByteArray())
+                        if (!resumed) {
+                            emulator.writeTerminal(versionBanner.toByteArray())
+                        }
 
                         updateStatus()
                         startEmulation()
@@ -629,9 +688,11 @@ class MainActivity : AppCompatActivity() {
 
                         // Send CR immediately to trigger ROM prompt display
                         // (ROM may be waiting for input before showing boot menu)
-                        mainHandler.postDelayed({
-                            emulator.queueInput(0x0D)
-                        }, 500)
+                        if (!resumed) {
+                            mainHandler.postDelayed({
+                                emulator.queueInput(0x0D)
+                            }, 500)
+                        }
                     }
                 } else {
                     mainHandler.post {
@@ -689,10 +750,12 @@ class MainActivity : AppCompatActivity() {
         terminalView.customFontSize = settings.fontSize.toFloat()
         terminalView.wrapLines = settings.wrapLines
         terminalView.soundEnabled = settingsRepo.isSoundEnabled()
+        applyClockSetting(settings.cpuClockHz)
+        emulator.pastePacing = settingsRepo.isPastePacingEnabled()
 
         // Display version string on terminal before ROM output
         val versionBanner = "CPMDroid v${getVersionString()} (${BuildConfig.BUILD_TIME})\r\n"
-        terminalView.processOutput(versionBanner.toByteArray())
+        emulator.writeTerminal(versionBanner.toByteArray())
 
         startEmulation()
 
@@ -799,9 +862,18 @@ class MainActivity : AppCompatActivity() {
         emulator.hostFileWriteDone()
     }
 
-    private fun updateStatus() {
+    private fun applyClockSetting(hz: Int) {
+        clockHz = hz
+        emulator.setClockHz(hz)
+    }
+
+    private fun updateStatus(achievedMHz: Double = 0.0) {
         if (running) {
-            statusText.text = "Running"
+            statusText.text = if (achievedMHz > 0.0) {
+                String.format("Running %.2f MHz", achievedMHz)
+            } else {
+                "Running"
+            }
             statusText.setTextColor(0xFF00FF00.toInt())
             playPauseButton.setImageResource(android.R.drawable.ic_media_pause)
         } else {
@@ -821,6 +893,9 @@ class MainActivity : AppCompatActivity() {
             terminalView.customFontSize = settings.fontSize.toFloat()
             terminalView.wrapLines = settings.wrapLines
             terminalView.soundEnabled = settingsRepo.isSoundEnabled()
+            applyClockSetting(settings.cpuClockHz)
+            emulator.pastePacing = settingsRepo.isPastePacingEnabled()
+            checkpointsEnabled = settingsRepo.isResumeStateEnabled()
 
             // Check if disk settings changed while in Settings
             val diskSettingsChanged = lastDiskSlots.isNotEmpty() && settings.diskSlots != lastDiskSlots
@@ -847,13 +922,83 @@ class MainActivity : AppCompatActivity() {
         // Save current disk slots to detect changes on resume
         lastDiskSlots = settingsRepo.getSettings().diskSlots
         stopEmulation()
+        saveMachineState()
+    }
+
+    private fun stateFile(): File = File(filesDir, "machine.state")
+
+    private fun deleteMachineState() {
+        stateFile().delete()
+        File(filesDir, "machine.state.delta").delete()
+    }
+
+    /**
+     * Snapshot the machine so the next start can continue from here if the
+     * process is killed in the background. Queued behind any running batch.
+     */
+    private fun saveMachineState() {
+        if (!romLoaded) return
+        if (!settingsRepo.isResumeStateEnabled()) {
+            checkpointsEnabled = false
+            executor.execute { emulator.stopCheckpoints() }
+            deleteMachineState()
+            return
+        }
+        val path = stateFile().path
+        executor.execute {
+            if (!emulator.saveState(path)) {
+                Log.e(TAG, "Failed to save machine state")
+            }
+        }
+    }
+
+    /**
+     * Restore the saved snapshot after a cold init. Runs on the executor.
+     * Returns true if the machine now continues from the snapshot; a
+     * snapshot that doesn't match the ROM or disks is discarded.
+     */
+    private fun resumeSavedState(): Boolean {
+        val file = stateFile()
+        if (!settingsRepo.isResumeStateEnabled() || !file.exists()) return false
+        if (emulator.restoreState(file.path)) {
+            Log.i(TAG, "Resumed from saved state")
+            return true
+        }
+        // A partial restore may have overwritten memory; boot clean
+        Log.i(TAG, "Saved state not usable, booting")
+        deleteMachineState()
+        emulator.reset()
+        return false
+    }
+
+    /**
+     * Start a fresh checkpoint chain from the machine as it is now, so a
+     * process killed without onPause resumes within about a second of where
+     * it was. Disk journals are tagged with the checkpoint they belong to and
+     * replayed only that far, so disks are neither behind nor ahead of the
+     * restored memory. Runs on the executor.
+     */
+    private fun startCheckpoints() {
+        checkpointsEnabled = settingsRepo.isResumeStateEnabled()
+        if (!checkpointsEnabled) return
+        if (!emulator.saveState(stateFile().path)) {
+            Log.e(TAG, "Failed to start checkpoints")
+            checkpointsEnabled = false
+        }
     }
 
     override fun onDestroy() {
         super.onDestroy()
         saveDirtyDisks()  // Final save before destroying emulator
         stopEmulation()
+        // Let queued work (the state save from onPause, a batch in flight)
+        // finish before the native side is freed under it
         executor.shutdown()
+        if (!executor.awaitTermination(5, TimeUnit.SECONDS)) {
+            Log.e(TAG, "Emulator thread still busy, not destroying native state")
+            return
+        }
+        mainHandler.removeCallbacksAndMessages(null)
         emulator.destroy()
     }
 
@@ -867,13 +1012,15 @@ class MainActivity : AppCompatActivity() {
             var diskCount = 0
             settings.diskSlots.forEachIndexed { index, filename ->
                 if (filename != null) {
-                    val (diskData, isPersisted) = downloadManager.loadDiskDataWithPersistence(filename)
-                    if (diskData != null) {
-                        if (emulator.loadDisk(index, diskData)) {
+                    val (diskFile, isPersisted) = downloadManager.resolveDiskFile(filename)
+                    if (diskFile != null) {
+                        val persistPath = downloadManager.getPersistedDiskFile(filename).path
+                        if (emulator.openDisk(index, diskFile.path, shared = false,
+                                persistPath = persistPath)) {
                             if (isPersisted) {
-                                Log.i(TAG, "Disk $index reloaded from persisted: $filename (${diskData.size} bytes)")
+                                Log.i(TAG, "Disk $index remapped from persisted: $filename (${diskFile.length()} bytes)")
                             } else {
-                                Log.i(TAG, "Disk $index reloaded from catalog: $filename (${diskData.size} bytes)")
+                                Log.i(TAG, "Disk $index remapped from catalog: $filename (${diskFile.length()} bytes)")
                             }
                             // Mark all downloaded disks as manifest (warn once per session on write)
                             emulator.setDiskIsManifest(index, true)
@@ -950,14 +1097,16 @@ class MainActivity : AppCompatActivity() {
         val settings = settingsRepo.getSettings()
         settings.diskSlots.forEachIndexed { index, filename ->
             if (filename != null && emulator.isDiskDirty(index)) {
-                val diskData = emulator.getDiskData(index)
-                if (diskData != null) {
-                    if (downloadManager.savePersistedDisk(filename, diskData)) {
-                        emulator.clearDiskDirty(index)
-                        Log.i(TAG, "Disk $index saved: $filename (${diskData.size} bytes)")
-                    } else {
-                        Log.e(TAG, "Failed to save disk $index: $filename")
-                    }
+                // Clear first so a write racing with the save sets it again.
+                // isDiskDirty also reports the image's page bits, which only a
+                // successful save clears, so a failed save is retried next time.
+                emulator.clearDiskDirty(index)
+                val target = downloadManager.getPersistedDiskFile(filename)
+                val written = emulator.saveDisk(index, target.path)
+                if (written >= 0) {
+                    Log.i(TAG, "Disk $index saved: $filename ($written bytes)")
+                } else {
+                    Log.e(TAG, "Failed to save disk $index: $filename")
                 }
             }
         }
@@ -4,6 +4,7 @@ import android.app.ProgressDialog
 import android.os.Bundle
 import android.view.MenuItem
 import android.view.View
+import android.widget.ArrayAdapter
 import android.widget.ImageButton
 import android.widget.ProgressBar
 import android.widget.SeekBar
@@ -24,6 +25,19 @@ import kotlinx.coroutines.launch
 
 class SettingsActivity : AppCompatActivity() {
 
+    companion object {
+        // Selectable Z80 clock speeds (Hz, 0 = unlimited) and their labels
+        private val CPU_CLOCK_OPTIONS = listOf(
+            0 to "Unlimited",
+            4_000_000 to "4 MHz",
+            7_372_800 to "7.3728 MHz",
+            8_000_000 to "8 MHz",
+            10_000_000 to "10 MHz",
+            18_432_000 to "18.432 MHz",
+            20_000_000 to "20 MHz"
+        )
+    }
+
     private lateinit var binding: ActivitySettingsBinding
     private lateinit var settingsRepo: SettingsRepository
     private lateinit var catalogRepo: DiskCatalogRepository
@@ -77,6 +91,14 @@ class SettingsActivity : AppCompatActivity() {
         setupDiskSlotButtons(2, binding.selectDisk2, binding.clearDisk2)
         setupDiskSlotButtons(3, binding.selectDisk3, binding.clearDisk3)
 
+        // Long-press a slot to export its disk as a raw image
+        diskNameViews.forEachIndexed { slot, view ->
+            view.setOnLongClickListener {
+                exportDiskSlot(slot)
+                true
+            }
+        }
+
         // Font size
         binding.fontSizeSeekBar.progress = currentSettings.fontSize
         binding.fontSizeText.text = "${currentSettings.fontSize}pt"
@@ -88,6 +110,14 @@ class SettingsActivity : AppCompatActivity() {
             override fun onStopTrackingTouch(seekBar: SeekBar?) {}
         })
 
+        // CPU clock speed
+        val clockAdapter = ArrayAdapter(this, android.R.layout.simple_spinner_item,
+            CPU_CLOCK_OPTIONS.map { it.second })
+        clockAdapter.setDropDownViewResource(android.R.layout.simple_spinner_dropdown_item)
+        binding.cpuClockSpinner.adapter = clockAdapter
+        binding.cpuClockSpinner.setSelection(
+            CPU_CLOCK_OPTIONS.indexOfFirst { it.first == currentSettings.cpuClockHz }.coerceAtLeast(0))
+
         // Wrap lines checkbox
         binding.wrapLinesCheckbox.isChecked = currentSettings.wrapLines
 
@@ -97,6 +127,12 @@ class SettingsActivity : AppCompatActivity() {
         // Sound enabled checkbox
         binding.soundEnabledCheckbox.isChecked = settingsRepo.isSoundEnabled()
 
+        // Paste pacing checkbox
+        binding.pastePacingCheckbox.isChecked = settingsRepo.isPastePacingEnabled()
+
+        // Resume state checkbox
+        binding.resumeStateCheckbox.isChecked = settingsRepo.isResumeStateEnabled()
+
         // Browse catalog button
         binding.browseCatalogButton.setOnClickListener {
             showDiskCatalogDialog(slotToAssign = null)
@@ -136,6 +172,16 @@ class SettingsActivity : AppCompatActivity() {
         }
     }
 
+    private fun exportDiskSlot(slot: Int) {
+        val filename = currentSettings.diskSlots.getOrNull(slot) ?: return
+        lifecycleScope.launch {
+            val exported = downloadManager.exportDisk(filename)
+            val message = if (exported != null) "Exported $filename to the Exports folder"
+                          else "Failed to export $filename"
+            Toast.makeText(this@SettingsActivity, message, Toast.LENGTH_SHORT).show()
+        }
+    }
+
     private fun clearDiskSlot(slot: Int) {
         val newSlots = currentSettings.diskSlots.toMutableList()
         newSlots[slot] = null
@@ -271,13 +317,18 @@ class SettingsActivity : AppCompatActivity() {
     private fun saveSettings() {
         currentSettings = currentSettings.copy(
             fontSize = binding.fontSizeSeekBar.progress,
-            wrapLines = binding.wrapLinesCheckbox.isChecked
+            wrapLines = binding.wrapLinesCheckbox.isChecked,
+            cpuClockHz = CPU_CLOCK_OPTIONS[binding.cpuClockSpinner.selectedItemPosition].first
         )
         settingsRepo.saveSettings(currentSettings)
         // Save warn manifest writes setting separately
         settingsRepo.setWarnManifestWritesEnabled(binding.warnManifestWritesCheckbox.isChecked)
         // Save sound enabled setting separately
         settingsRepo.setSoundEnabled(binding.soundEnabledCheckbox.isChecked)
+        // Save paste pacing setting separately
+        settingsRepo.setPastePacingEnabled(binding.pastePacingCheckbox.isChecked)
+        // Save resume state setting separately
+        settingsRepo.setResumeStateEnabled(binding.resumeStateCheckbox.isChecked)
     }
 
     override fun onOptionsItemSelected(item: MenuItem): Boolean {
@@ -3,9 +3,11 @@ package com.awohl.cpmdroid
 import android.content.ClipData
 import android.content.ClipboardManager
 import android.content.Context
+import android.graphics.Bitmap
 import android.graphics.Canvas
 import android.graphics.Color
 import android.graphics.Paint
+import android.graphics.Rect
 import android.graphics.Typeface
 import android.media.ToneGenerator
 import android.media.AudioManager
@@ -14,10 +16,12 @@ import android.util.AttributeSet
 import android.view.KeyEvent
 import android.view.MotionEvent
 import android.view.View
+import android.view.ViewConfiguration
 import android.view.inputmethod.BaseInputConnection
 import android.view.inputmethod.EditorInfo
 import android.view.inputmethod.InputConnection
 import android.view.inputmethod.InputMethodManager
+import java.nio.ByteBuffer
 
 class TerminalView @JvmOverloads constructor(
     context: Context,
@@ -28,6 +32,16 @@ class TerminalView @JvmOverloads constructor(
     companion object {
         private const val MIN_ROWS = 24
         private const val MIN_COLS = 80
+
+        // Frame layout, see terminal.h
+        private const val FRAME_HEADER = 40
+        private const val FLAG_CURSOR_VISIBLE = 1
+        private const val FLAG_FULL = 2
+        private const val DEFAULT_ATTR = 16
+        private const val BLANK_CELL: Short = (' '.code or (DEFAULT_ATTR shl 8)).toShort()
+
+        // Lines kept above the screen for dragging back through
+        private const val HISTORY_LINES = 1000
     }
 
     // Dynamic terminal dimensions based on screen size
@@ -37,8 +51,32 @@ class TerminalView @JvmOverloads constructor(
     // How many columns actually fit on screen (may be less than cols with larger fonts)
     private var visibleCols = MIN_COLS
 
-    private var screenBuffer = Array(rows) { CharArray(cols) { ' ' } }
-    private var colorBuffer = Array(rows) { IntArray(cols) { Color.GREEN } }
+    // Last frame from the native terminal, which may lag a resize by a batch
+    private var screenRows = rows
+    private var screenCols = cols
+    private var cells = ShortArray(rows * cols) { BLANK_CELL }
+
+    // The cells rendered once, a band of charHeight pixels per row, so a
+    // frame only costs the spans it changed. Scrolling rotates topBand
+    // instead of moving pixels: row r is in band (topBand + r) % screenRows.
+    private var screenBitmap: Bitmap? = null
+    private var screenCanvas: Canvas? = null
+    private var topBand = 0
+    private var rowChars = CharArray(cols)
+    private val srcRect = Rect()
+    private val dstRect = Rect()
+
+    // Lines that scrolled off the top, oldest first, from each frame's
+    // scrollback delta. Under jump scroll a frame carries only the last
+    // few hundred lines, so bulk output leaves gaps here.
+    private val history = ArrayDeque<ShortArray>()
+
+    // Lines of history shown above the screen while dragged back
+    private var historyOffset = 0
+    private var dragStartY = 0f
+    private var dragStartOffset = 0
+    private var dragging = false
+    private val touchSlop = ViewConfiguration.get(context).scaledTouchSlop
 
     private var cursorRow = 0
     private var cursorCol = 0
@@ -46,6 +84,7 @@ class TerminalView @JvmOverloads constructor(
 
     private var charWidth = 0f
     private var charHeight = 0f
+    private var baseline = 0f
 
     private val textPaint = Paint().apply {
         color = Color.GREEN
@@ -76,6 +115,7 @@ class TerminalView @JvmOverloads constructor(
         set(value) {
             field = value
             android.util.Log.i("TerminalView", "wrapLines set to: $value")
+            reportSize()
         }
 
     private val bgPaint = Paint().apply {
@@ -88,11 +128,6 @@ class TerminalView @JvmOverloads constructor(
         style = Paint.Style.FILL
     }
 
-    // VT100 escape sequence parsing state
-    private var escapeState = 0
-    private val escapeParams = StringBuilder()
-    private var currentFgColor = Color.GREEN
-
     // Bell sound generator
     private var toneGenerator: ToneGenerator? = null
     var soundEnabled: Boolean = false
@@ -117,13 +152,38 @@ class TerminalView @JvmOverloads constructor(
         Color.WHITE            // 15 - White
     )
 
+    // Indexed by cell attribute: the CGA colours, then the default foreground
+    private val palette = cgaColors + Color.GREEN
+
     // Input handling
     private var inputListener: ((Int) -> Unit)? = null
+    private var pasteListener: ((ByteArray) -> Unit)? = null
 
     fun setInputListener(listener: (Int) -> Unit) {
         inputListener = listener
     }
 
+    /** Receives pasted text as one ASCII block instead of per-character input */
+    fun setPasteListener(listener: (ByteArray) -> Unit) {
+        pasteListener = listener
+    }
+
+    /**
+     * Receives the terminal size as (rows, cols, wrapCols) whenever it
+     * changes: wrapCols is the column output should wrap at, or 0 to
+     * truncate at cols. Called once straight away.
+     */
+    fun setSizeListener(listener: (Int, Int, Int) -> Unit) {
+        sizeListener = listener
+        reportSize()
+    }
+
+    private var sizeListener: ((Int, Int, Int) -> Unit)? = null
+
+    private fun reportSize() {
+        sizeListener?.invoke(rows, cols, if (wrapLines) visibleCols else 0)
+    }
+
     /** Play bell sound (0x07 BEL character) */
     private fun playBell() {
         if (!soundEnabled) return
@@ -140,10 +200,10 @@ class TerminalView @JvmOverloads constructor(
     /** Copy entire screen content to clipboard */
     fun copyScreenToClipboard(): Boolean {
         val text = StringBuilder()
-        for (row in 0 until rows) {
-            val line = String(screenBuffer[row]).trimEnd()
-            text.append(line)
-            if (row < rows - 1) text.append("\n")
+        for (row in 0 until screenRows) {
+            val line = CharArray(screenCols) { cellChar(cells[row * screenCols + it].toInt()) }
+            text.append(String(line).trimEnd())
+            if (row < screenRows - 1) text.append("\n")
         }
         // Remove trailing empty lines
         val content = text.toString().trimEnd('\n')
@@ -163,6 +223,17 @@ class TerminalView @JvmOverloads constructor(
         val text = clip.getItemAt(0).coerceToText(context)?.toString() ?: return false
         if (text.isEmpty()) return false
 
+        pasteListener?.let { listener ->
+            // ASCII only; the native input ring translates LF to CR
+            val bytes = ByteArray(text.length)
+            var count = 0
+            for (ch in text) {
+                if (ch.code in 0..127) bytes[count++] = ch.code.toByte()
+            }
+            if (count > 0) listener(bytes.copyOf(count))
+            return true
+        }
+
         // Send each character as input (converting newlines to CR)
         for (ch in text) {
             when (ch) {
@@ -176,16 +247,40 @@ class TerminalView @JvmOverloads constructor(
     private fun sendChar(ch: Int) {
         // Only send ASCII characters (0-127)
         if (ch in 0..127) {
+            // Typing returns to the live screen
+            if (historyOffset != 0) {
+                historyOffset = 0
+                invalidate()
+            }
             inputListener?.invoke(ch)
         }
     }
 
     override fun onTouchEvent(event: MotionEvent): Boolean {
-        if (event.action == MotionEvent.ACTION_UP) {
-            // Request focus and show keyboard
-            requestFocus()
-            val imm = context.getSystemService(Context.INPUT_METHOD_SERVICE) as InputMethodManager
-            imm.showSoftInput(this, InputMethodManager.SHOW_IMPLICIT)
+        when (event.actionMasked) {
+            MotionEvent.ACTION_DOWN -> {
+                dragStartY = event.y
+                dragStartOffset = historyOffset
+                dragging = false
+            }
+            MotionEvent.ACTION_MOVE -> {
+                // Dragging down reveals history
+                val dy = event.y - dragStartY
+                if (!dragging && Math.abs(dy) > touchSlop) dragging = true
+                if (dragging && charHeight > 0f) {
+                    val offset = (dragStartOffset + (dy / charHeight).toInt()).coerceIn(0, history.size)
+                    if (offset != historyOffset) {
+                        historyOffset = offset
+                        invalidate()
+                    }
+                }
+            }
+            MotionEvent.ACTION_UP -> if (!dragging) {
+                // Request focus and show keyboard
+                requestFocus()
+                val imm = context.getSystemService(Context.INPUT_METHOD_SERVICE) as InputMethodManager
+                imm.showSoftInput(this, InputMethodManager.SHOW_IMPLICIT)
+            }
         }
         return true
     }
@@ -364,7 +459,10 @@ class TerminalView @JvmOverloads constructor(
         val finalFontSize = baseFontSize * scaleFactor
         textPaint.textSize = finalFontSize
         charWidth = textPaint.measureText("M")
-        charHeight = textPaint.fontMetrics.descent - textPaint.fontMetrics.ascent
+        // Whole pixels, so row bands in the screen bitmap tile exactly
+        val metrics = textPaint.fontMetrics
+        charHeight = Math.ceil((metrics.descent - metrics.ascent).toDouble()).toFloat()
+        baseline = -metrics.ascent
 
         // Calculate how many columns actually fit on screen at this font size
         visibleCols = maxOf(1, (availableWidth / charWidth).toInt())
@@ -377,35 +475,18 @@ class TerminalView @JvmOverloads constructor(
         if (newCols != cols || newRows != rows) {
             resizeBuffers(newRows, newCols)
         }
+        reportSize()
+        renderAll()
 
         android.util.Log.i("TerminalView", "calculateFontSize: baseFontSize=$baseFontSize, scaleFactor=$scaleFactor, finalFontSize=$finalFontSize, charWidth=$charWidth, rows=$rows, cols=$cols, visibleCols=$visibleCols")
     }
 
+    // The native terminal keeps the contents; it resizes at its next batch
     private fun resizeBuffers(newRows: Int, newCols: Int) {
         val oldRows = rows
         val oldCols = cols
-        val oldScreenBuffer = screenBuffer
-        val oldColorBuffer = colorBuffer
-
         rows = newRows
         cols = newCols
-
-        // Create new buffers
-        screenBuffer = Array(rows) { CharArray(cols) { ' ' } }
-        colorBuffer = Array(rows) { IntArray(cols) { Color.GREEN } }
-
-        // Copy old content (as much as fits)
-        for (r in 0 until minOf(oldRows, rows)) {
-            for (c in 0 until minOf(oldCols, cols)) {
-                screenBuffer[r][c] = oldScreenBuffer[r][c]
-                colorBuffer[r][c] = oldColorBuffer[r][c]
-            }
-        }
-
-        // Adjust cursor position if needed
-        cursorRow = cursorRow.coerceIn(0, rows - 1)
-        cursorCol = cursorCol.coerceIn(0, cols - 1)
-
         android.util.Log.i("TerminalView", "resizeBuffers: $oldRows x $oldCols -> $rows x $cols")
     }
 
@@ -415,212 +496,198 @@ class TerminalView @JvmOverloads constructor(
         // Draw background
         canvas.drawRect(0f, 0f, width.toFloat(), height.toFloat(), bgPaint)
 
-        val metrics = textPaint.fontMetrics
-        val baseline = -metrics.ascent
-
         // Account for padding when drawing
-        val offsetX = paddingLeft.toFloat()
-        val offsetY = paddingTop.toFloat()
-
-        // Draw characters (no scaling - dynamic rows/cols fill the screen)
-        for (row in 0 until rows) {
-            for (col in 0 until cols) {
-                val ch = screenBuffer[row][col]
-                if (ch != ' ') {
-                    textPaint.color = colorBuffer[row][col]
-                    canvas.drawText(
-                        ch.toString(),
-                        offsetX + col * charWidth,
-                        offsetY + row * charHeight + baseline,
-                        textPaint
-                    )
-                }
+        val offsetX = paddingLeft
+        val offsetY = paddingTop
+
+        // History dragged into view pushes the screen down
+        val band = charHeight.toInt()
+        val shown = historyOffset.coerceAtMost(history.size)
+        for (i in 0 until shown) {
+            drawLine(canvas, history[history.size - shown + i], offsetX.toFloat(), offsetY + i * charHeight)
+        }
+        val screenY = offsetY + shown * band
+
+        // Rendered rows, in two pieces when the bands have rotated
+        screenBitmap?.let { bitmap ->
+            val split = (screenRows - topBand) * band
+            srcRect.set(0, topBand * band, bitmap.width, bitmap.height)
+            dstRect.set(offsetX, screenY, offsetX + bitmap.width, screenY + split)
+            canvas.drawBitmap(bitmap, srcRect, dstRect, null)
+            if (topBand > 0) {
+                srcRect.set(0, 0, bitmap.width, topBand * band)
+                dstRect.set(offsetX, screenY + split, offsetX + bitmap.width, screenY + bitmap.height)
+                canvas.drawBitmap(bitmap, srcRect, dstRect, null)
             }
         }
 
         // Draw cursor
-        if (cursorVisible && cursorRow < rows && cursorCol < cols) {
+        if (cursorVisible && cursorRow < screenRows && cursorCol < screenCols) {
             val cursorX = offsetX + cursorCol * charWidth
-            val cursorY = offsetY + cursorRow * charHeight + charHeight - 4f
+            val cursorY = screenY + cursorRow * charHeight + charHeight - 4f
             canvas.drawRect(cursorX, cursorY, cursorX + charWidth, cursorY + 3f, cursorPaint)
         }
     }
 
-    private var processOutputCount = 0
-    fun processOutput(data: ByteArray) {
-        if (processOutputCount++ < 3) {
-            android.util.Log.i("TerminalView", "processOutput: ${data.size} bytes, charWidth=$charWidth, charHeight=$charHeight")
-        }
-        for (b in data) {
-            processChar(b.toInt() and 0xFF)
-        }
-        invalidate()
-    }
-
-    private fun processChar(ch: Int) {
-        when (escapeState) {
-            0 -> { // Normal state
-                when (ch) {
-                    0x1B -> escapeState = 1 // ESC
-                    0x0D -> cursorCol = 0   // CR
-                    0x0A -> newLine()       // LF
-                    0x08 -> if (cursorCol > 0) cursorCol-- // BS
-                    0x07 -> playBell() // BEL - beep
-                    else -> {
-                        if (ch >= 0x20) {
-                            putChar(ch.toChar())
-                        }
-                    }
-                }
-            }
-            1 -> { // After ESC
-                when (ch) {
-                    '['.code -> {
-                        escapeState = 2
-                        escapeParams.clear()
-                    }
-                    else -> escapeState = 0
-                }
-            }
-            2 -> { // CSI sequence
-                when {
-                    ch in 0x30..0x3F -> {
-                        escapeParams.append(ch.toChar())
-                    }
-                    ch in 0x40..0x7E -> {
-                        processCSI(ch.toChar())
-                        escapeState = 0
-                    }
-                    else -> escapeState = 0
-                }
+    /**
+     * Apply a screen frame published by the native terminal (layout in
+     * terminal.h): scroll the rows already shown, then copy in and render
+     * the changed spans. A full frame replaces everything.
+     */
+    fun updateScreen(buffer: ByteBuffer) {
+        val frameRows = buffer.getInt(0)
+        val frameCols = buffer.getInt(4)
+        if (frameRows <= 0 || frameCols <= 0) return
+        val flags = buffer.getInt(16)
+        val full = (flags and FLAG_FULL) != 0
+        if (!full && (frameRows != screenRows || frameCols != screenCols)) return
+        cursorRow = buffer.getInt(8)
+        cursorCol = buffer.getInt(12)
+        cursorVisible = (flags and FLAG_CURSOR_VISIBLE) != 0
+        val bells = buffer.getInt(20)
+        val scroll = buffer.getInt(24)
+        val spans = buffer.getInt(28)
+
+        if (full) {
+            if (frameRows * frameCols != cells.size) {
+                cells = ShortArray(frameRows * frameCols)
             }
+            screenRows = frameRows
+            screenCols = frameCols
+            topBand = 0
+            ensureBitmap()
+        } else if (scroll != 0) {
+            scrollRows(scroll)
         }
-    }
 
-    private fun processCSI(command: Char) {
-        val params = escapeParams.toString().split(";").mapNotNull { it.toIntOrNull() }
-
-        when (command) {
-            'H', 'f' -> { // Cursor position
-                cursorRow = (params.getOrElse(0) { 1 } - 1).coerceIn(0, rows - 1)
-                cursorCol = (params.getOrElse(1) { 1 } - 1).coerceIn(0, cols - 1)
-            }
-            'A' -> cursorRow = (cursorRow - params.getOrElse(0) { 1 }).coerceAtLeast(0)
-            'B' -> cursorRow = (cursorRow + params.getOrElse(0) { 1 }).coerceAtMost(rows - 1)
-            'C' -> cursorCol = (cursorCol + params.getOrElse(0) { 1 }).coerceAtMost(cols - 1)
-            'D' -> cursorCol = (cursorCol - params.getOrElse(0) { 1 }).coerceAtLeast(0)
-            'J' -> { // Erase display
-                when (params.getOrElse(0) { 0 }) {
-                    0 -> clearToEnd()
-                    1 -> clearToBeginning()
-                    2 -> clearScreen()
-                }
-            }
-            'K' -> { // Erase line
-                when (params.getOrElse(0) { 0 }) {
-                    0 -> clearLineToEnd()
-                    1 -> clearLineToBeginning()
-                    2 -> clearLine()
-                }
-            }
-            'm' -> { // SGR - Select Graphic Rendition
-                if (params.isEmpty()) {
-                    currentFgColor = Color.GREEN
-                } else {
-                    for (p in params) {
-                        when {
-                            p == 0 -> currentFgColor = Color.GREEN
-                            p in 30..37 -> currentFgColor = cgaColors[p - 30]
-                            p in 90..97 -> currentFgColor = cgaColors[p - 90 + 8]
-                        }
-                    }
-                }
+        val scrollback = buffer.getInt(32)
+
+        var pos = FRAME_HEADER
+        for (i in 0 until spans) {
+            val row = buffer.getShort(pos).toInt() and 0xFFFF
+            val first = buffer.getShort(pos + 2).toInt() and 0xFFFF
+            val count = buffer.getShort(pos + 4).toInt() and 0xFFFF
+            pos += 6
+            val start = row * screenCols + first
+            for (c in 0 until count) {
+                cells[start + c] = buffer.getShort(pos)
+                pos += 2
             }
+            renderSpan(row, first, first + count)
         }
-    }
 
-    private fun putChar(ch: Char) {
-        // When wrap is enabled, wrap at visible screen edge
-        // When wrap is disabled, truncate at buffer edge (cols)
-        val wrapAt = if (wrapLines) visibleCols else cols
-
-        if (cursorCol >= wrapAt) {
-            if (wrapLines) {
-                cursorCol = 0
-                newLine()
+        // Lines that scrolled off, reusing the oldest history lines
+        for (i in 0 until scrollback) {
+            val line = if (history.size >= HISTORY_LINES && history.first().size == frameCols) {
+                history.removeFirst()
             } else {
-                // Truncate - don't advance, just stay at end of line
-                return
+                if (history.size >= HISTORY_LINES) history.removeFirst()
+                ShortArray(frameCols)
+            }
+            for (c in 0 until frameCols) {
+                line[c] = buffer.getShort(pos)
+                pos += 2
             }
+            history.addLast(line)
         }
-        screenBuffer[cursorRow][cursorCol] = ch
-        colorBuffer[cursorRow][cursorCol] = currentFgColor
-        cursorCol++
-    }
 
-    private fun newLine() {
-        cursorRow++
-        if (cursorRow >= rows) {
-            scrollUp()
-            cursorRow = rows - 1
-        }
+        if (bells > 0) playBell()
+        invalidate()
     }
 
-    private fun scrollUp() {
-        for (row in 0 until rows - 1) {
-            screenBuffer[row] = screenBuffer[row + 1].copyOf()
-            colorBuffer[row] = colorBuffer[row + 1].copyOf()
-        }
-        screenBuffer[rows - 1] = CharArray(cols) { ' ' }
-        colorBuffer[rows - 1] = IntArray(cols) { currentFgColor }
-    }
+    // Cells as published, screenRows x screenCols
+    private fun cellChar(cell: Int): Char = (cell and 0xFF).toChar()
+    private fun cellColor(cell: Int): Int = palette[((cell shr 8) and 0xFF).coerceAtMost(DEFAULT_ATTR)]
 
-    private fun clearScreen() {
-        for (row in 0 until rows) {
-            screenBuffer[row].fill(' ')
-            colorBuffer[row].fill(currentFgColor)
+    // Move rows up by lines (down if negative). The frame's spans repaint
+    // the rows uncovered, so their cells and bands are left as they are.
+    private fun scrollRows(lines: Int) {
+        val shift = lines * screenCols
+        if (lines > 0) {
+            System.arraycopy(cells, shift, cells, 0, cells.size - shift)
+        } else {
+            System.arraycopy(cells, 0, cells, -shift, cells.size + shift)
         }
-        cursorRow = 0
-        cursorCol = 0
-    }
-
-    private fun clearToEnd() {
-        clearLineToEnd()
-        for (row in cursorRow + 1 until rows) {
-            screenBuffer[row].fill(' ')
-            colorBuffer[row].fill(currentFgColor)
+        topBand = Math.floorMod(topBand + lines, screenRows)
+    }
+
+    // Screen bitmap sized for the current grid and font, or none before layout
+    private fun ensureBitmap(): Boolean {
+        if (charWidth <= 0f || charHeight <= 0f) return false
+        val w = Math.ceil((screenCols * charWidth).toDouble()).toInt()
+        val h = screenRows * charHeight.toInt()
+        val current = screenBitmap
+        if (current == null || current.width != w || current.height != h) {
+            current?.recycle()
+            val bitmap = Bitmap.createBitmap(w, h, Bitmap.Config.ARGB_8888)
+            screenBitmap = bitmap
+            screenCanvas = Canvas(bitmap)
         }
+        if (rowChars.size < screenCols) rowChars = CharArray(screenCols)
+        return true
     }
 
-    private fun clearToBeginning() {
-        clearLineToBeginning()
-        for (row in 0 until cursorRow) {
-            screenBuffer[row].fill(' ')
-            colorBuffer[row].fill(currentFgColor)
+    // Re-render every row, after the font or grid changed
+    private fun renderAll() {
+        if (!ensureBitmap()) return
+        topBand = 0
+        for (row in 0 until screenRows) {
+            renderSpan(row, 0, screenCols)
         }
+        invalidate()
     }
 
-    private fun clearLine() {
-        screenBuffer[cursorRow].fill(' ')
-        colorBuffer[cursorRow].fill(currentFgColor)
-    }
-
-    private fun clearLineToEnd() {
-        for (col in cursorCol until cols) {
-            screenBuffer[cursorRow][col] = ' '
-            colorBuffer[cursorRow][col] = currentFgColor
+    // Draw a history line straight to canvas; only while dragged into view
+    private fun drawLine(canvas: Canvas, line: ShortArray, x: Float, top: Float) {
+        if (rowChars.size < line.size) rowChars = CharArray(line.size)
+        var col = 0
+        while (col < line.size) {
+            val color = cellColor(line[col].toInt())
+            var end = col
+            while (end < line.size && cellColor(line[end].toInt()) == color) {
+                rowChars[end] = cellChar(line[end].toInt())
+                end++
+            }
+            textPaint.color = color
+            canvas.drawText(rowChars, col, end - col, x + col * charWidth, top + baseline, textPaint)
+            col = end
         }
     }
 
-    private fun clearLineToBeginning() {
-        for (col in 0..cursorCol) {
-            screenBuffer[cursorRow][col] = ' '
-            colorBuffer[cursorRow][col] = currentFgColor
+    // Render columns [from, to) of row into its band, in runs of one colour
+    private fun renderSpan(row: Int, from: Int, to: Int) {
+        val canvas = screenCanvas ?: return
+        if (from >= to) return
+        val band = charHeight.toInt()
+        val top = ((topBand + row) % screenRows) * band
+        val left = from * charWidth
+        canvas.save()
+        canvas.clipRect(left, top.toFloat(), to * charWidth, (top + band).toFloat())
+        canvas.drawRect(left, top.toFloat(), to * charWidth, (top + band).toFloat(), bgPaint)
+
+        val y = top + baseline
+        val base = row * screenCols
+        var col = from
+        while (col < to) {
+            val color = cellColor(cells[base + col].toInt())
+            var end = col
+            while (end < to && cellColor(cells[base + end].toInt()) == color) {
+                rowChars[end] = cellChar(cells[base + end].toInt())
+                end++
+            }
+            textPaint.color = color
+            canvas.drawText(rowChars, col, end - col, col * charWidth, y, textPaint)
+            col = end
         }
+        canvas.restore()
     }
 
+    /** Blank the view until the next frame; the native screen is unchanged */
     fun clear() {
-        clearScreen()
+        cells.fill(BLANK_CELL)
+        cursorRow = 0
+        cursorCol = 0
+        renderAll()
         invalidate()
     }
 }
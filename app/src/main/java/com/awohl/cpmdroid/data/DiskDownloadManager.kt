@@ -1,6 +1,7 @@
 package com.awohl.cpmdroid.data
 
 import android.content.Context
+import com.awohl.cpmdroid.EmulatorEngine
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.withContext
 import okhttp3.OkHttpClient
@@ -85,9 +86,14 @@ class DiskDownloadManager(private val context: Context) {
                 }
             }
 
-            // Rename temp to final
+            // Store it packed; most of a fresh image is empty. Keep the raw
+            // file if packing fails.
             if (destFile.exists()) destFile.delete()
-            tempFile.renameTo(destFile)
+            if (EmulatorEngine.packDisk(tempFile.path, destFile.path) >= 0) {
+                tempFile.delete()
+            } else {
+                tempFile.renameTo(destFile)
+            }
             Result.success(destFile)
 
         } catch (e: Exception) {
@@ -111,11 +117,6 @@ class DiskDownloadManager(private val context: Context) {
         return getDiskFile(filename).delete()
     }
 
-    fun loadDiskData(filename: String): ByteArray? {
-        val file = getDiskFile(filename)
-        return if (file.exists()) file.readBytes() else null
-    }
-
     // =========================================================================
     // Disk Persistence - for saving modified disks
     // =========================================================================
@@ -141,38 +142,54 @@ class DiskDownloadManager(private val context: Context) {
     fun hasPersistedDisk(filename: String): Boolean = getPersistedDiskFile(filename).exists()
 
     /**
-     * Load a persisted disk if it exists, otherwise fall back to the catalog version.
-     * Returns the disk data and whether it was from the persisted version.
+     * Find the image file to mount: the persisted disk if it exists, otherwise
+     * the catalog version. Returns the file and whether it is the persisted one.
      */
-    fun loadDiskDataWithPersistence(filename: String): Pair<ByteArray?, Boolean> {
+    fun resolveDiskFile(filename: String): Pair<File?, Boolean> {
         val persistedFile = getPersistedDiskFile(filename)
         if (persistedFile.exists()) {
-            return Pair(persistedFile.readBytes(), true)
+            return Pair(persistedFile, true)
         }
         val catalogFile = getDiskFile(filename)
         if (catalogFile.exists()) {
-            return Pair(catalogFile.readBytes(), false)
+            return Pair(catalogFile, false)
         }
         return Pair(null, false)
     }
 
     /**
-     * Save modified disk data to the persisted disks directory.
+     * Write journal kept next to a persisted disk (see disk_journal.h). It
+     * exists even before the first save, while the catalog disk is in use.
      */
-    fun savePersistedDisk(filename: String, data: ByteArray): Boolean {
-        return try {
-            val file = getPersistedDiskFile(filename)
-            file.writeBytes(data)
-            true
-        } catch (e: Exception) {
-            false
-        }
-    }
+    fun getPersistedJournalFile(filename: String): File =
+        File(getPersistedDisksDir(), "$filename.jnl")
 
     /**
-     * Delete a persisted disk (revert to catalog version).
+     * Delete a persisted disk (revert to catalog version), together with its
+     * journal so the discarded writes are not replayed on the next mount.
+     * Unmount the disk first.
      */
     fun deletePersistedDisk(filename: String): Boolean {
-        return getPersistedDiskFile(filename).delete()
+        val journal = getPersistedJournalFile(filename)
+        if (journal.exists() && !journal.delete()) return false
+        val file = getPersistedDiskFile(filename)
+        return !file.exists() || file.delete()
+    }
+
+    /**
+     * Write the current contents of a disk (the persisted copy if there is
+     * one) as a raw image to the Exports folder. Disks and persisted copies
+     * are stored packed (see sparse_disk.h), which other emulators and
+     * tools don't read. Writes still only in the disk's journal are not
+     * included; they are folded in when the emulator saves the disk.
+     * Returns the exported file, or null on failure.
+     */
+    suspend fun exportDisk(filename: String): File? = withContext(Dispatchers.IO) {
+        val (source, _) = resolveDiskFile(filename)
+        if (source == null) return@withContext null
+        val exportsDir = File(context.getExternalFilesDir(null), "Exports")
+        if (!exportsDir.exists()) exportsDir.mkdirs()
+        val target = File(exportsDir, filename)
+        if (EmulatorEngine.unpackDisk(source.path, target.path) >= 0) target else null
     }
 }
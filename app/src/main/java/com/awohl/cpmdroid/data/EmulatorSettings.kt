@@ -4,5 +4,6 @@ data class EmulatorSettings(
     val romName: String = "emu_avw.rom",
     val diskSlots: List<String?> = listOf(null, null, null, null),
     val fontSize: Int = 14,
-    val wrapLines: Boolean = false
+    val wrapLines: Boolean = false,
+    val cpuClockHz: Int = 0  // 0 = unlimited
 )
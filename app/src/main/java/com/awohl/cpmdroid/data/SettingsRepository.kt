@@ -12,9 +12,12 @@ class SettingsRepository(context: Context) {
         private const val KEY_DISK_SLOT_PREFIX = "disk_slot_"
         private const val KEY_FONT_SIZE = "font_size"
         private const val KEY_WRAP_LINES = "wrap_lines"
+        private const val KEY_CPU_CLOCK_HZ = "cpu_clock_hz"
         private const val KEY_FIRST_LAUNCH_DONE = "first_launch_done"
         private const val KEY_WARN_MANIFEST_WRITES = "warn_manifest_writes"
         private const val KEY_SOUND_ENABLED = "sound_enabled"
+        private const val KEY_PASTE_PACING = "paste_pacing"
+        private const val KEY_RESUME_STATE = "resume_state"
         private const val KEY_PREFS_VERSION = "prefs_version"
         private const val CURRENT_PREFS_VERSION = 3
         private const val KEY_NVRAM = "nvram"
@@ -31,7 +34,8 @@ class SettingsRepository(context: Context) {
             romName = prefs.getString(KEY_ROM_NAME, DEFAULT_ROM) ?: DEFAULT_ROM,
             diskSlots = (0..3).map { prefs.getString("$KEY_DISK_SLOT_PREFIX$it", null) },
             fontSize = prefs.getInt(KEY_FONT_SIZE, DEFAULT_FONT_SIZE),
-            wrapLines = prefs.getBoolean(KEY_WRAP_LINES, false)
+            wrapLines = prefs.getBoolean(KEY_WRAP_LINES, false),
+            cpuClockHz = prefs.getInt(KEY_CPU_CLOCK_HZ, 0)
         )
     }
 
@@ -47,6 +51,7 @@ class SettingsRepository(context: Context) {
             }
             putInt(KEY_FONT_SIZE, settings.fontSize)
             putBoolean(KEY_WRAP_LINES, settings.wrapLines)
+            putInt(KEY_CPU_CLOCK_HZ, settings.cpuClockHz)
         }
     }
 
@@ -84,6 +89,20 @@ class SettingsRepository(context: Context) {
         prefs.edit { putBoolean(KEY_SOUND_ENABLED, enabled) }
     }
 
+    fun isPastePacingEnabled(): Boolean =
+        prefs.getBoolean(KEY_PASTE_PACING, false)
+
+    fun setPastePacingEnabled(enabled: Boolean) {
+        prefs.edit { putBoolean(KEY_PASTE_PACING, enabled) }
+    }
+
+    fun isResumeStateEnabled(): Boolean =
+        prefs.getBoolean(KEY_RESUME_STATE, true)
+
+    fun setResumeStateEnabled(enabled: Boolean) {
+        prefs.edit { putBoolean(KEY_RESUME_STATE, enabled) }
+    }
+
     fun migrateIfNeeded() {
         val version = prefs.getInt(KEY_PREFS_VERSION, 1)
         if (version < CURRENT_PREFS_VERSION) {